@@ -0,0 +1,179 @@
+/*
+ * iconstatebench.c
+ * Measures building, serializing and diffing large springboard icon states.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <plist/plist.h>
+
+#include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/sbservices.h>
+
+#define DEFAULT_ITERATIONS 100
+#define DEFAULT_PAGES 11
+#define ROWS 4
+#define COLUMNS 4
+
+static plist_t build_icon(int page, int row, int column)
+{
+	char identifier[64];
+	char name[32];
+	plist_t icon = plist_new_dict();
+
+	snprintf(identifier, sizeof(identifier), "com.example.app%d.%d.%d", page, row, column);
+	snprintf(name, sizeof(name), "App %d-%d-%d", page, row, column);
+	plist_dict_insert_item(icon, "bundleIdentifier", plist_new_string(identifier));
+	plist_dict_insert_item(icon, "bundleVersion", plist_new_string("1.0"));
+	plist_dict_insert_item(icon, "displayIdentifier", plist_new_string(identifier));
+	plist_dict_insert_item(icon, "displayName", plist_new_string(name));
+	plist_dict_insert_item(icon, "iconModDate", plist_new_date(1262304000, 0));
+	return icon;
+}
+
+static plist_t build_state(int pages)
+{
+	plist_t state = plist_new_array();
+	int page, row, column;
+
+	for (page = 0; page < pages; page++) {
+		plist_t rows = plist_new_array();
+		for (row = 0; row < ROWS; row++) {
+			plist_t columns = plist_new_array();
+			for (column = 0; column < COLUMNS; column++) {
+				plist_array_append_item(columns, build_icon(page, row, column));
+			}
+			plist_array_append_item(rows, columns);
+		}
+		plist_array_append_item(state, rows);
+	}
+	return state;
+}
+
+/* swaps the first and the last icon of the last page */
+static void move_one_icon(plist_t state)
+{
+	plist_t page = plist_array_get_item(state, plist_array_get_size(state) - 1);
+	plist_t first_row = plist_array_get_item(page, 0);
+	plist_t last_row = plist_array_get_item(page, ROWS - 1);
+	plist_t first = plist_copy(plist_array_get_item(first_row, 0));
+	plist_t last = plist_copy(plist_array_get_item(last_row, COLUMNS - 1));
+
+	plist_array_set_item(first_row, last, 0);
+	plist_array_set_item(last_row, first, COLUMNS - 1);
+}
+
+static double elapsed_usec(struct timeval *start, struct timeval *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000.0 + (end->tv_usec - start->tv_usec);
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = DEFAULT_ITERATIONS;
+	int pages = DEFAULT_PAGES;
+	struct timeval start, end;
+	plist_t state, moved;
+	char *data = NULL;
+	uint32_t size = 0;
+	sbservices_icon_change_t *changes = NULL;
+	uint32_t count = 0;
+	int i;
+
+	if (argc > 1) {
+		iterations = atoi(argv[1]);
+		if (argc > 2)
+			pages = atoi(argv[2]);
+		if (iterations <= 0 || pages <= 0) {
+			printf("Usage: %s [ITERATIONS] [PAGES]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	printf("%d pages with %d icons each, %d iterations, times in microseconds\n\n", pages, ROWS * COLUMNS, iterations);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		state = build_state(pages);
+		plist_free(state);
+	}
+	gettimeofday(&end, NULL);
+	printf("%-28s %10.2f\n", "build", elapsed_usec(&start, &end) / iterations);
+
+	state = build_state(pages);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		plist_to_xml(state, &data, &size);
+		free(data);
+	}
+	gettimeofday(&end, NULL);
+	plist_to_xml(state, &data, &size);
+	free(data);
+	printf("%-28s %10.2f  (%u bytes)\n", "serialize xml", elapsed_usec(&start, &end) / iterations, size);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		plist_to_bin(state, &data, &size);
+		free(data);
+	}
+	gettimeofday(&end, NULL);
+	plist_to_bin(state, &data, &size);
+	free(data);
+	printf("%-28s %10.2f  (%u bytes)\n", "serialize binary", elapsed_usec(&start, &end) / iterations, size);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		moved = plist_copy(state);
+		plist_free(moved);
+	}
+	gettimeofday(&end, NULL);
+	printf("%-28s %10.2f\n", "copy", elapsed_usec(&start, &end) / iterations);
+
+	moved = plist_copy(state);
+	move_one_icon(moved);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		sbservices_icon_state_diff(state, state, &changes, &count);
+		sbservices_icon_changes_free(changes, count);
+	}
+	gettimeofday(&end, NULL);
+	printf("%-28s %10.2f  (%u changes)\n", "diff unchanged", elapsed_usec(&start, &end) / iterations, count);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		sbservices_icon_state_diff(state, moved, &changes, &count);
+		sbservices_icon_changes_free(changes, count);
+	}
+	gettimeofday(&end, NULL);
+	printf("%-28s %10.2f  (%u changes)\n", "diff one icon moved", elapsed_usec(&start, &end) / iterations, count);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		sbservices_icon_state_validate(state, moved);
+	}
+	gettimeofday(&end, NULL);
+	printf("%-28s %10.2f  (%s)\n", "validate", elapsed_usec(&start, &end) / iterations,
+		(sbservices_icon_state_validate(state, moved) == SBSERVICES_E_SUCCESS) ? "valid" : "invalid");
+
+	plist_free(moved);
+	plist_free(state);
+
+	return 0;
+}
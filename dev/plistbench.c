@@ -0,0 +1,199 @@
+/*
+ * plistbench.c
+ * Compares XML and binary plist encoding for typical service messages.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <plist/plist.h>
+
+#define DEFAULT_ITERATIONS 10000
+
+static const char fake_cert[] =
+	"-----BEGIN CERTIFICATE-----\n"
+	"MIICOTCCAaKgAwIBAgIBADANBgkqhkiG9w0BAQUFADAAMB4XDTEwMDEwMTAwMDAw\n"
+	"MFoXDTIwMDEwMTAwMDAwMFowADCBnzANBgkqhkiG9w0BAQEFAAOBjQAwgYkCgYEA\n"
+	"u6OvSgrf3Gz1JaeJhz2FZ8Vq6tqxVZ7f0J5DqQb7x1o9iU1p0bBqQ5o4wA7uK3yS\n"
+	"w7kq6m8K9k5mUq0pQ3x7z1B8t8n2d0qvQ9Jt2s7J3u1n6E0r4Y6dXj3V7y8Zx0oS\n"
+	"dQ1sE2P3l8hT6j2qv7K8aX1b2c3d4e5f6g7h8i9j0k1l2m3n4o5p6q7r8s9t0u1v\n"
+	"AgMBAAGjQzBBMA8GA1UdEwEB/wQFMAMBAf8wDgYDVR0PAQH/BAQDAgKkMB4GA1Ud\n"
+	"DgQXBBVpbWFnaW5hcnkgaG9zdCBrZXkgaWQwDQYJKoZIhvcNAQEFBQADgYEAWm9l\n"
+	"-----END CERTIFICATE-----\n";
+
+static plist_t build_lockdown_get_value()
+{
+	plist_t dict = plist_new_dict();
+	plist_dict_insert_item(dict, "Label", plist_new_string("plistbench"));
+	plist_dict_insert_item(dict, "Domain", plist_new_string("com.apple.disk_usage"));
+	plist_dict_insert_item(dict, "Key", plist_new_string("TotalDataAvailable"));
+	plist_dict_insert_item(dict, "Request", plist_new_string("GetValue"));
+	return dict;
+}
+
+static plist_t build_lockdown_start_service()
+{
+	plist_t dict = plist_new_dict();
+	plist_dict_insert_item(dict, "Label", plist_new_string("plistbench"));
+	plist_dict_insert_item(dict, "Request", plist_new_string("StartService"));
+	plist_dict_insert_item(dict, "Service", plist_new_string("com.apple.mobile.installation_proxy"));
+	return dict;
+}
+
+static plist_t build_lockdown_pair()
+{
+	plist_t dict = plist_new_dict();
+	plist_t record = plist_new_dict();
+	plist_dict_insert_item(record, "DeviceCertificate", plist_new_data(fake_cert, strlen(fake_cert)));
+	plist_dict_insert_item(record, "HostCertificate", plist_new_data(fake_cert, strlen(fake_cert)));
+	plist_dict_insert_item(record, "HostID", plist_new_string("29942970-207913891623273984"));
+	plist_dict_insert_item(record, "RootCertificate", plist_new_data(fake_cert, strlen(fake_cert)));
+	plist_dict_insert_item(dict, "Label", plist_new_string("plistbench"));
+	plist_dict_insert_item(dict, "PairRecord", record);
+	plist_dict_insert_item(dict, "Request", plist_new_string("Pair"));
+	return dict;
+}
+
+static plist_t build_file_relay_request()
+{
+	static const char *sources[] = { "AppleSupport", "Network", "VPN", "WiFi", "UserDatabases", "CrashReporter", "tmp", "SystemConfiguration", NULL };
+	plist_t dict = plist_new_dict();
+	plist_t array = plist_new_array();
+	int i;
+	for (i = 0; sources[i]; i++) {
+		plist_array_append_item(array, plist_new_string(sources[i]));
+	}
+	plist_dict_insert_item(dict, "Sources", array);
+	return dict;
+}
+
+static plist_t build_mount_image()
+{
+	char signature[128];
+	int i;
+	for (i = 0; i < (int)sizeof(signature); i++) {
+		signature[i] = (char)(i * 7);
+	}
+	plist_t dict = plist_new_dict();
+	plist_dict_insert_item(dict, "Command", plist_new_string("MountImage"));
+	plist_dict_insert_item(dict, "ImagePath", plist_new_string("/var/mobile/Media/PublicStaging/staging.dimage"));
+	plist_dict_insert_item(dict, "ImageSignature", plist_new_data(signature, sizeof(signature)));
+	plist_dict_insert_item(dict, "ImageType", plist_new_string("Developer"));
+	return dict;
+}
+
+static plist_t build_np_observe()
+{
+	plist_t dict = plist_new_dict();
+	plist_dict_insert_item(dict, "Command", plist_new_string("ObserveNotification"));
+	plist_dict_insert_item(dict, "Name", plist_new_string("com.apple.itunes-mobdev.syncWillStart"));
+	return dict;
+}
+
+static double elapsed_usec(struct timeval *start, struct timeval *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000.0 + (end->tv_usec - start->tv_usec);
+}
+
+static void bench(const char *name, plist_t msg, int iterations)
+{
+	char *xml = NULL;
+	char *bin = NULL;
+	uint32_t xml_len = 0;
+	uint32_t bin_len = 0;
+	struct timeval start, end;
+	double xml_enc, xml_dec, bin_enc, bin_dec;
+	int i;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		plist_to_xml(msg, &xml, &xml_len);
+		free(xml);
+	}
+	gettimeofday(&end, NULL);
+	xml_enc = elapsed_usec(&start, &end) / iterations;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		plist_to_bin(msg, &bin, &bin_len);
+		free(bin);
+	}
+	gettimeofday(&end, NULL);
+	bin_enc = elapsed_usec(&start, &end) / iterations;
+
+	plist_to_xml(msg, &xml, &xml_len);
+	plist_to_bin(msg, &bin, &bin_len);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		plist_t tmp = NULL;
+		plist_from_xml(xml, xml_len, &tmp);
+		plist_free(tmp);
+	}
+	gettimeofday(&end, NULL);
+	xml_dec = elapsed_usec(&start, &end) / iterations;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		plist_t tmp = NULL;
+		plist_from_bin(bin, bin_len, &tmp);
+		plist_free(tmp);
+	}
+	gettimeofday(&end, NULL);
+	bin_dec = elapsed_usec(&start, &end) / iterations;
+
+	printf("%-22s %7u %7u %9.2f %9.2f %9.2f %9.2f\n", name, xml_len, bin_len, xml_enc, bin_enc, xml_dec, bin_dec);
+
+	free(xml);
+	free(bin);
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = DEFAULT_ITERATIONS;
+	int i;
+	struct {
+		const char *name;
+		plist_t (*build)();
+	} messages[] = {
+		{ "lockdown GetValue", build_lockdown_get_value },
+		{ "lockdown StartService", build_lockdown_start_service },
+		{ "lockdown Pair", build_lockdown_pair },
+		{ "file_relay Sources", build_file_relay_request },
+		{ "image_mounter Mount", build_mount_image },
+		{ "np Observe", build_np_observe },
+		{ NULL, NULL }
+	};
+
+	if (argc > 1) {
+		iterations = atoi(argv[1]);
+		if (iterations <= 0) {
+			printf("Usage: %s [ITERATIONS]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	printf("%d iterations, times in microseconds per message\n\n", iterations);
+	printf("%-22s %7s %7s %9s %9s %9s %9s\n", "message", "xml", "binary", "xml-enc", "bin-enc", "xml-dec", "bin-dec");
+	for (i = 0; messages[i].name; i++) {
+		plist_t msg = messages[i].build();
+		bench(messages[i].name, msg, iterations);
+		plist_free(msg);
+	}
+
+	return 0;
+}
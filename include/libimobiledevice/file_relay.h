@@ -49,6 +49,7 @@ typedef file_relay_client_private *file_relay_client_t; /**< The client handle.
 
 file_relay_error_t file_relay_client_new(idevice_t device, uint16_t port, file_relay_client_t *client);
 file_relay_error_t file_relay_client_free(file_relay_client_t client);
+file_relay_error_t file_relay_client_set_plist_encoding(file_relay_client_t client, enum idevice_plist_encoding encoding);
 
 file_relay_error_t file_relay_request_sources(file_relay_client_t client, const char **sources, idevice_connection_t *connection);
 
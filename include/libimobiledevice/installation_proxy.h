@@ -51,11 +51,77 @@ typedef instproxy_client_private *instproxy_client_t; /**< The client handle. */
 /** Reports the status of the given operation */
 typedef void (*instproxy_status_cb_t) (const char *operation, plist_t status, void *user_data);
 
+/** Receives a chunk of applications while browsing, as PLIST_ARRAY */
+typedef void (*instproxy_browse_cb_t) (plist_t apps, void *user_data);
+
+/** Compact information about an installed application */
+typedef struct {
+	char *bundle_id; /**< CFBundleIdentifier */
+	char *version;   /**< CFBundleVersion, or NULL */
+	uint64_t size;   /**< static plus dynamic disk usage in bytes */
+} instproxy_app_info_t;
+
+/** Receives a chunk of compact application information while browsing */
+typedef void (*instproxy_app_info_cb_t) (const instproxy_app_info_t *apps, uint32_t count, void *user_data);
+
+/** Kinds of changes reported by an application inventory */
+enum instproxy_inventory_change_type {
+	INSTPROXY_APP_INSTALLED = 1, /**< the application is new */
+	INSTPROXY_APP_REMOVED,       /**< the application is gone */
+	INSTPROXY_APP_UPGRADED       /**< the version of the application changed */
+};
+
+/** A change between two inventory snapshots */
+typedef struct {
+	enum instproxy_inventory_change_type type;
+	char *bundle_id;   /**< CFBundleIdentifier */
+	char *old_version; /**< version before, NULL if installed */
+	char *new_version; /**< version now, NULL if removed */
+} instproxy_inventory_change_t;
+
+typedef struct instproxy_inventory_private instproxy_inventory_private;
+typedef instproxy_inventory_private *instproxy_inventory_t; /**< The inventory handle. */
+
+/** Reports that a background refresh found changed applications */
+typedef void (*instproxy_inventory_cb_t) (instproxy_inventory_t inventory, void *user_data);
+
+/** How status updates of operations are delivered */
+enum instproxy_status_mode {
+	INSTPROXY_STATUS_CALLBACK = 0, /**< synchronously or via a thread per operation */
+	INSTPROXY_STATUS_POLL          /**< read by the caller with instproxy_read_status */
+};
+
+/** Parsed progress of an operation */
+typedef struct {
+	int percent;              /**< 0-100, or -1 if not reported yet */
+	char status[64];          /**< last reported status */
+	char error[128];          /**< error reported by the device, if any */
+	int complete;             /**< set when the operation is over */
+	instproxy_error_t result; /**< outcome once complete is set */
+} instproxy_progress_t;
+
+/** Progress of all operations followed by an aggregator */
+typedef struct {
+	uint32_t operations; /**< number of operations */
+	uint32_t running;    /**< operations not yet complete */
+	uint32_t succeeded;  /**< operations completed successfully */
+	uint32_t failed;     /**< operations that failed */
+	int percent;         /**< overall progress, 0-100 */
+} instproxy_progress_summary_t;
+
+typedef struct instproxy_aggregator_private instproxy_aggregator_private;
+typedef instproxy_aggregator_private *instproxy_aggregator_t; /**< The aggregator handle. */
+
+/** Reports a parsed status update of the operation running on client */
+typedef void (*instproxy_progress_cb_t) (instproxy_client_t client, const instproxy_progress_t *progress, void *user_data);
+
 /* Interface */
 instproxy_error_t instproxy_client_new(idevice_t device, uint16_t port, instproxy_client_t *client);
 instproxy_error_t instproxy_client_free(instproxy_client_t client);
 
 instproxy_error_t instproxy_browse(instproxy_client_t client, plist_t client_options, plist_t *result);
+instproxy_error_t instproxy_browse_with_callback(instproxy_client_t client, plist_t client_options, instproxy_browse_cb_t browse_cb, void *user_data);
+instproxy_error_t instproxy_browse_app_info(instproxy_client_t client, plist_t client_options, instproxy_app_info_cb_t app_info_cb, void *user_data);
 instproxy_error_t instproxy_install(instproxy_client_t client, const char *pkg_path, plist_t client_options, instproxy_status_cb_t status_cb, void *user_data);
 instproxy_error_t instproxy_upgrade(instproxy_client_t client, const char *pkg_path, plist_t client_options, instproxy_status_cb_t status_cb, void *user_data);
 instproxy_error_t instproxy_uninstall(instproxy_client_t client, const char *appid, plist_t client_options, instproxy_status_cb_t status_cb, void *user_data);
@@ -65,8 +131,28 @@ instproxy_error_t instproxy_archive(instproxy_client_t client, const char *appid
 instproxy_error_t instproxy_restore(instproxy_client_t client, const char *appid, plist_t client_options, instproxy_status_cb_t status_cb, void *user_data);
 instproxy_error_t instproxy_remove_archive(instproxy_client_t client, const char *appid, plist_t client_options, instproxy_status_cb_t status_cb, void *user_data);
 
+instproxy_error_t instproxy_set_status_mode(instproxy_client_t client, enum instproxy_status_mode mode);
+int instproxy_get_status_fd(instproxy_client_t client);
+int instproxy_status_pending(instproxy_client_t client);
+instproxy_error_t instproxy_read_status(instproxy_client_t client, instproxy_progress_t *progress);
+
+instproxy_error_t instproxy_aggregator_new(instproxy_progress_cb_t progress_cb, void *user_data, instproxy_aggregator_t *aggregator);
+instproxy_error_t instproxy_aggregator_free(instproxy_aggregator_t aggregator);
+instproxy_error_t instproxy_aggregator_add(instproxy_aggregator_t aggregator, instproxy_client_t client);
+instproxy_error_t instproxy_aggregator_poll(instproxy_aggregator_t aggregator, int timeout, uint32_t *running);
+instproxy_error_t instproxy_aggregator_get_summary(instproxy_aggregator_t aggregator, instproxy_progress_summary_t *summary);
+
+instproxy_error_t instproxy_inventory_new(const char *uuid, instproxy_inventory_t *inventory);
+instproxy_error_t instproxy_inventory_free(instproxy_inventory_t inventory);
+instproxy_error_t instproxy_inventory_refresh(instproxy_inventory_t inventory, instproxy_client_t client);
+instproxy_error_t instproxy_inventory_get_changes(instproxy_inventory_t inventory, instproxy_inventory_change_t **changes, uint32_t *count);
+void instproxy_inventory_changes_free(instproxy_inventory_change_t *changes, uint32_t count);
+instproxy_error_t instproxy_inventory_start_refresh(instproxy_inventory_t inventory, idevice_t device, unsigned int interval, instproxy_inventory_cb_t changed_cb, void *user_data);
+instproxy_error_t instproxy_inventory_stop_refresh(instproxy_inventory_t inventory);
+
 plist_t instproxy_client_options_new();
 void instproxy_client_options_add(plist_t client_options, ...) G_GNUC_NULL_TERMINATED;
+void instproxy_client_options_set_return_attributes(plist_t client_options, ...) G_GNUC_NULL_TERMINATED;
 void instproxy_client_options_free(plist_t client_options);
 
 #ifdef __cplusplus
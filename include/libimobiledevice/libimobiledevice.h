@@ -62,6 +62,29 @@ enum idevice_event_type {
 	IDEVICE_DEVICE_REMOVE
 };
 
+/** The encoding used when sending property lists to a device service. */
+enum idevice_plist_encoding {
+	IDEVICE_PLIST_ENCODING_XML = 1,
+	IDEVICE_PLIST_ENCODING_BINARY
+};
+
+/** Transfer statistics of a connection, or of all connections of a device. */
+typedef struct {
+	uint64_t bytes_sent; /**< Payload bytes sent. */
+	uint64_t bytes_received; /**< Payload bytes received. */
+	uint64_t wire_bytes_sent; /**< Bytes handed to the transport, including SSL overhead. */
+	uint64_t wire_bytes_received; /**< Bytes read from the transport, including SSL overhead. */
+	uint64_t send_calls; /**< Number of transport send calls. */
+	uint64_t recv_calls; /**< Number of transport receive calls. */
+	uint64_t partial_reads; /**< Transport receive calls that returned less than requested. */
+	uint64_t blocked_usec; /**< Time spent inside transport send and receive calls, in microseconds. */
+	uint64_t ssl_send_calls; /**< Number of gnutls_record_send calls; each may produce several SSL records. */
+	uint64_t ssl_recv_calls; /**< Number of gnutls_record_recv calls that returned data; not a count of SSL records. */
+	uint64_t ssl_handshakes_full; /**< Number of SSL handshakes that negotiated a new session. */
+	uint64_t ssl_handshakes_resumed; /**< Number of SSL handshakes that resumed a previous session. */
+	uint32_t connections; /**< Number of connections these statistics cover. */
+} idevice_stats_t;
+
 /* event data structure */
 /** Provides information about the occured event. */
 typedef struct {
@@ -99,6 +122,10 @@ idevice_error_t idevice_connection_receive(idevice_connection_t connection, char
 idevice_error_t idevice_get_handle(idevice_t device, uint32_t *handle);
 idevice_error_t idevice_get_uuid(idevice_t device, char **uuid);
 
+/* statistics */
+idevice_error_t idevice_connection_get_stats(idevice_connection_t connection, idevice_stats_t *stats);
+idevice_error_t idevice_get_stats(idevice_t device, idevice_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
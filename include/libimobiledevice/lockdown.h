@@ -70,16 +70,60 @@ struct lockdownd_pair_record {
 /** A pair record holding device, host and root certificates along the host_id */
 typedef struct lockdownd_pair_record *lockdownd_pair_record_t;
 
+/** A domain and key to query with lockdownd_get_values */
+struct lockdownd_value_request {
+	const char *domain; /**< The domain to query or NULL for the global domain */
+	const char *key;    /**< The key to query or NULL to query all keys of the domain */
+};
+
+/** The outcome of a handshake started by lockdownd_handshake_all */
+struct lockdownd_handshake_result {
+	char *uuid;                /**< The UUID of the device */
+	idevice_t device;          /**< The connected device or NULL on error */
+	lockdownd_client_t client; /**< The client with a running session or NULL on error */
+	lockdownd_error_t error;   /**< LOCKDOWN_E_SUCCESS or the error that occured */
+};
+
+/**
+ * Creates a client for a started service and stores it in *client. Wrap the
+ * service's client_new function, e.g. afc_client_new, in a function with
+ * this exact signature; calling it through a cast pointer is undefined.
+ */
+typedef int16_t (*lockdownd_service_client_new_t)(idevice_t device, uint16_t port, void *client);
+
+/** A service to start and connect with lockdownd_start_service_clients */
+struct lockdownd_service {
+	const char *name;                          /**< The name of the service to start */
+	lockdownd_service_client_new_t client_new; /**< The function creating the service client, or NULL */
+	uint16_t port;                             /**< Set to the port the service was started on */
+	void *client;                              /**< Set to the created service client or NULL */
+	lockdownd_error_t error;                   /**< Set to the result of starting the service */
+	int16_t client_error;                      /**< Set to the result of client_new */
+};
+
+/** How values retrieved with lockdownd_get_value are cached. */
+enum lockdownd_value_cache_mode {
+	LOCKDOWN_VALUE_CACHE_OFF = 0,
+	LOCKDOWN_VALUE_CACHE_MEMORY,
+	LOCKDOWN_VALUE_CACHE_PERSISTENT
+};
+
 /* Interface */
 lockdownd_error_t lockdownd_client_new(idevice_t device, lockdownd_client_t *client, const char *label);
 lockdownd_error_t lockdownd_client_new_with_handshake(idevice_t device, lockdownd_client_t *client, const char *label);
+lockdownd_error_t lockdownd_client_new_shared(idevice_t device, lockdownd_client_t *client, const char *label);
 lockdownd_error_t lockdownd_client_free(lockdownd_client_t client);
+lockdownd_error_t lockdownd_handshake_all(char **uuids, int count, const char *label, int max_threads, struct lockdownd_handshake_result **results);
+void lockdownd_handshake_results_free(struct lockdownd_handshake_result *results, int count);
 
 lockdownd_error_t lockdownd_query_type(lockdownd_client_t client, char **type);
 lockdownd_error_t lockdownd_get_value(lockdownd_client_t client, const char *domain, const char *key, plist_t *value);
+lockdownd_error_t lockdownd_get_values(lockdownd_client_t client, const struct lockdownd_value_request *pairs, uint32_t count, plist_t *values);
 lockdownd_error_t lockdownd_set_value(lockdownd_client_t client, const char *domain, const char *key, plist_t value);
 lockdownd_error_t lockdownd_remove_value(lockdownd_client_t client, const char *domain, const char *key);
 lockdownd_error_t lockdownd_start_service(lockdownd_client_t client, const char *service, uint16_t *port);
+lockdownd_error_t lockdownd_start_services(lockdownd_client_t client, const char **services, uint32_t count, uint16_t *ports);
+lockdownd_error_t lockdownd_start_service_clients(lockdownd_client_t client, idevice_t device, struct lockdownd_service *services, uint32_t count);
 lockdownd_error_t lockdownd_start_session(lockdownd_client_t client, const char *host_id, char **session_id, int *ssl_enabled);
 lockdownd_error_t lockdownd_stop_session(lockdownd_client_t client, const char *session_id);
 lockdownd_error_t lockdownd_send(lockdownd_client_t client, plist_t plist);
@@ -93,7 +137,11 @@ lockdownd_error_t lockdownd_enter_recovery(lockdownd_client_t client);
 lockdownd_error_t lockdownd_goodbye(lockdownd_client_t client);
 
 /* Helper */
+void lockdownd_set_handshake_cache_ttl(unsigned int seconds);
+lockdownd_error_t lockdownd_prepare_host_keys(int wait);
 void lockdownd_client_set_label(lockdownd_client_t client, const char *label);
+lockdownd_error_t lockdownd_client_set_value_cache(lockdownd_client_t client, enum lockdownd_value_cache_mode mode);
+lockdownd_error_t lockdownd_client_set_plist_encoding(lockdownd_client_t client, enum idevice_plist_encoding encoding);
 lockdownd_error_t lockdownd_get_device_uuid(lockdownd_client_t control, char **uuid);
 lockdownd_error_t lockdownd_get_device_name(lockdownd_client_t client, char **device_name);
 
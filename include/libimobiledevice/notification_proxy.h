@@ -88,6 +88,32 @@ typedef np_client_private *np_client_t; /**< The client handle. */
 /** Reports which notification was received. */
 typedef void (*np_notify_cb_t) (const char *notification, void *user_data);
 
+/** What happens when a notification arrives while the callback queue is full. */
+enum np_queue_policy {
+	NP_QUEUE_DROP_OLDEST = 1, /**< Discard the oldest queued notification */
+	NP_QUEUE_COALESCE,        /**< Discard notifications already queued under the same name, otherwise the oldest */
+	NP_QUEUE_BLOCK            /**< Stop reading from the device until there is space */
+};
+
+/** Counters of the callback queue of a client. */
+typedef struct {
+	uint64_t received;  /**< Notifications read from the device */
+	uint64_t delivered; /**< Notifications passed to the callback */
+	uint64_t dropped;   /**< Notifications discarded because the queue was full */
+	uint64_t coalesced; /**< Notifications merged with an identical queued one */
+	uint32_t max_depth; /**< Highest number of queued notifications */
+} np_queue_stats_t;
+
+typedef struct np_hub_private np_hub_private;
+typedef np_hub_private *np_hub_t; /**< The notification hub handle. */
+
+/**
+ * Reports which notification was received by which client of a hub. The
+ * notification is NULL when the connection of the client closed; the hub
+ * stops reading from it, and it should be freed once the callback returned.
+ */
+typedef void (*np_hub_cb_t) (np_client_t client, const char *notification, void *user_data);
+
 /* Interface */
 np_error_t np_client_new(idevice_t device, uint16_t port, np_client_t *client);
 np_error_t np_client_free(np_client_t client);
@@ -95,6 +121,14 @@ np_error_t np_post_notification(np_client_t client, const char *notification);
 np_error_t np_observe_notification(np_client_t client, const char *notification);
 np_error_t np_observe_notifications(np_client_t client, const char **notification_spec);
 np_error_t np_set_notify_callback(np_client_t client, np_notify_cb_t notify_cb, void *userdata);
+np_error_t np_set_notify_queue(np_client_t client, uint32_t capacity, enum np_queue_policy policy);
+np_error_t np_get_notify_queue_stats(np_client_t client, np_queue_stats_t *stats);
+
+np_error_t np_hub_new(int workers, np_hub_t *hub);
+np_error_t np_hub_free(np_hub_t hub);
+np_error_t np_hub_set_callback(np_hub_t hub, np_hub_cb_t callback, void *user_data);
+np_error_t np_hub_add_client(np_hub_t hub, np_client_t client, np_hub_cb_t callback, void *user_data);
+np_error_t np_hub_remove_client(np_hub_t hub, np_client_t client);
 
 #ifdef __cplusplus
 }
@@ -35,6 +35,7 @@ extern "C" {
 #define SBSERVICES_E_INVALID_ARG           -1
 #define SBSERVICES_E_PLIST_ERROR           -2
 #define SBSERVICES_E_CONN_FAILED           -3
+#define SBSERVICES_E_INVALID_STATE         -4
 
 #define SBSERVICES_E_UNKNOWN_ERROR       -256
 /*@}*/
@@ -45,12 +46,42 @@ typedef int16_t sbservices_error_t;
 typedef struct sbservices_client_private sbservices_client_private;
 typedef sbservices_client_private *sbservices_client_t; /**< The client handle. */
 
+/** An app icon to get with sbservices_get_icons */
+struct sbservices_icon {
+	const char *bundle_id;    /**< The bundle identifier of the app */
+	const char *version;      /**< The version of the app to cache the icon for, or NULL; the cache is keyed by bundle_id and version only */
+	char *pngdata;            /**< Set to the PNG data, to be freed by the caller */
+	uint64_t pngsize;         /**< Set to the size of the PNG data */
+	int from_cache;           /**< Set if the icon was read from the cache */
+	sbservices_error_t error; /**< Set to the result for this icon */
+};
+
+/** Kinds of icon changes between two icon states */
+enum sbservices_icon_change_type {
+	SBSERVICES_ICON_ADDED = 1, /**< the icon is new */
+	SBSERVICES_ICON_REMOVED,   /**< the icon is gone */
+	SBSERVICES_ICON_MOVED      /**< the icon is at another position */
+};
+
+/** An icon change between two icon states */
+typedef struct {
+	enum sbservices_icon_change_type type;
+	char *identifier;   /**< The display identifier of the icon */
+	char *old_position; /**< e.g. "1.0.3" for page 1, row 0, column 3, NULL if added */
+	char *new_position; /**< The position now, NULL if removed */
+} sbservices_icon_change_t;
+
 /* Interface */
 sbservices_error_t sbservices_client_new(idevice_t device, uint16_t port, sbservices_client_t *client);
 sbservices_error_t sbservices_client_free(sbservices_client_t client);
 sbservices_error_t sbservices_get_icon_state(sbservices_client_t client, plist_t *state);
 sbservices_error_t sbservices_set_icon_state(sbservices_client_t client, plist_t newstate);
+sbservices_error_t sbservices_set_icon_state_if_changed(sbservices_client_t client, plist_t newstate, int *changed);
+sbservices_error_t sbservices_icon_state_diff(plist_t oldstate, plist_t newstate, sbservices_icon_change_t **changes, uint32_t *count);
+void sbservices_icon_changes_free(sbservices_icon_change_t *changes, uint32_t count);
+sbservices_error_t sbservices_icon_state_validate(plist_t oldstate, plist_t newstate);
 sbservices_error_t sbservices_get_icon_pngdata(sbservices_client_t client, const char *bundleId, char **pngdata, uint64_t *pngsize);
+sbservices_error_t sbservices_get_icons(sbservices_client_t client, struct sbservices_icon *icons, uint32_t count);
 
 #ifdef __cplusplus
 }
@@ -46,9 +46,23 @@ typedef int16_t screenshotr_error_t;
 typedef struct screenshotr_client_private screenshotr_client_private;
 typedef screenshotr_client_private *screenshotr_client_t; /**< The client handle. */
 
+/** Statistics of a capture with screenshotr_capture */
+typedef struct {
+	uint64_t frames;    /**< frames delivered to the callback */
+	double duration;    /**< seconds spent capturing */
+	double fps;         /**< frames per second achieved */
+	double min_latency; /**< shortest time from request to frame, in ms */
+	double avg_latency; /**< average time from request to frame, in ms */
+	double max_latency; /**< longest time from request to frame, in ms */
+} screenshotr_capture_stats_t;
+
+/** Receives a captured frame; return nonzero to stop capturing */
+typedef int (*screenshotr_frame_cb_t) (const char *imgdata, uint64_t imgsize, uint64_t frame, void *user_data);
+
 screenshotr_error_t screenshotr_client_new(idevice_t device, uint16_t port, screenshotr_client_t * client);
 screenshotr_error_t screenshotr_client_free(screenshotr_client_t client);
 screenshotr_error_t screenshotr_take_screenshot(screenshotr_client_t client, char **imgdata, uint64_t *imgsize);
+screenshotr_error_t screenshotr_capture(screenshotr_client_t client, uint32_t max_frames, screenshotr_frame_cb_t frame_cb, void *user_data, screenshotr_capture_stats_t *stats);
 
 #ifdef __cplusplus
 }
@@ -313,25 +313,22 @@ device_link_service_error_t device_link_service_send_process_message(device_link
 }
 
 /**
- * Receives a DLMessageProcessMessage plist.
- *
- * @param client The connected device link service client used for receiving.
- * @param message Pointer to a plist that will be set to the contents of the
- *    message contents upon successful return.
- *
- * @return DEVICE_LINK_SERVICE_E_SUCCESS when a DLMessageProcessMessage was
- *    received, DEVICE_LINK_SERVICE_E_INVALID_ARG when client or message is
- *    invalid, DEVICE_LINK_SERVICE_E_PLIST_ERROR if the received plist is
- *    invalid or is not a DLMessageProcessMessage,
- *    or DEVICE_LINK_SERVICE_E_MUX_ERROR if receiving from device fails.
+ * Internally used function to receive a DLMessageProcessMessage plist,
+ * optionally returning one data node as a view.
  */
-device_link_service_error_t device_link_service_receive_process_message(device_link_service_client_t client, plist_t *message)
+static device_link_service_error_t internal_receive_process_message(device_link_service_client_t client, plist_t *message, const char *key, const char **data, uint64_t *length)
 {
 	if (!client || !client->parent || !message)
 		return DEVICE_LINK_SERVICE_E_INVALID_ARG;
 
 	plist_t pmsg = NULL;
-	if (property_list_service_receive_plist(client->parent, &pmsg) != PROPERTY_LIST_SERVICE_E_SUCCESS) {
+	property_list_service_error_t perr;
+	if (key) {
+		perr = property_list_service_receive_plist_with_data(client->parent, &pmsg, key, data, length);
+	} else {
+		perr = property_list_service_receive_plist(client->parent, &pmsg);
+	}
+	if (perr != PROPERTY_LIST_SERVICE_E_SUCCESS) {
 		return DEVICE_LINK_SERVICE_E_MUX_ERROR;
 	}
 
@@ -368,6 +365,54 @@ leave:
 	return err;
 }
 
+/**
+ * Receives a DLMessageProcessMessage plist.
+ *
+ * @param client The connected device link service client used for receiving.
+ * @param message Pointer to a plist that will be set to the contents of the
+ *    message contents upon successful return.
+ *
+ * @return DEVICE_LINK_SERVICE_E_SUCCESS when a DLMessageProcessMessage was
+ *    received, DEVICE_LINK_SERVICE_E_INVALID_ARG when client or message is
+ *    invalid, DEVICE_LINK_SERVICE_E_PLIST_ERROR if the received plist is
+ *    invalid or is not a DLMessageProcessMessage,
+ *    or DEVICE_LINK_SERVICE_E_MUX_ERROR if receiving from device fails.
+ */
+device_link_service_error_t device_link_service_receive_process_message(device_link_service_client_t client, plist_t *message)
+{
+	return internal_receive_process_message(client, message, NULL, NULL, NULL);
+}
+
+/**
+ * Receives a DLMessageProcessMessage plist and returns the payload of the
+ * data node stored under key as a view instead of a copy.
+ *
+ * @see property_list_service_receive_plist_with_data
+ *
+ * @param client The connected device link service client used for receiving.
+ * @param message Pointer to a plist that will be set to the contents of the
+ *    message contents upon successful return. The data node stored under
+ *    key might be empty.
+ * @param key The dictionary key of the data node.
+ * @param data Set to the data view, or NULL if there is no data node stored
+ *    under key. The view stays valid until the next receive on this client
+ *    and must not be freed.
+ * @param length Set to the size of the data view.
+ *
+ * @return DEVICE_LINK_SERVICE_E_SUCCESS when a DLMessageProcessMessage was
+ *    received, DEVICE_LINK_SERVICE_E_INVALID_ARG when an argument is
+ *    invalid, DEVICE_LINK_SERVICE_E_PLIST_ERROR if the received plist is
+ *    invalid or is not a DLMessageProcessMessage,
+ *    or DEVICE_LINK_SERVICE_E_MUX_ERROR if receiving from device fails.
+ */
+device_link_service_error_t device_link_service_receive_process_message_with_data(device_link_service_client_t client, plist_t *message, const char *key, const char **data, uint64_t *length)
+{
+	if (!key || !data || !length)
+		return DEVICE_LINK_SERVICE_E_INVALID_ARG;
+
+	return internal_receive_process_message(client, message, key, data, length);
+}
+
 /**
  * Generic device link service send function.
  *
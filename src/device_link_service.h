@@ -47,6 +47,7 @@ device_link_service_error_t device_link_service_version_exchange(device_link_ser
 device_link_service_error_t device_link_service_send_ping(device_link_service_client_t client, const char *message);
 device_link_service_error_t device_link_service_send_process_message(device_link_service_client_t client, plist_t message);
 device_link_service_error_t device_link_service_receive_process_message(device_link_service_client_t client, plist_t *message);
+device_link_service_error_t device_link_service_receive_process_message_with_data(device_link_service_client_t client, plist_t *message, const char *key, const char **data, uint64_t *length);
 device_link_service_error_t device_link_service_disconnect(device_link_service_client_t client);
 device_link_service_error_t device_link_service_send(device_link_service_client_t client, plist_t plist);
 device_link_service_error_t device_link_service_receive(device_link_service_client_t client, plist_t *plist);
@@ -46,6 +46,7 @@ file_relay_error_t file_relay_client_new(idevice_t device, uint16_t port, file_r
 	if (property_list_service_client_new(device, port, &plistclient) != PROPERTY_LIST_SERVICE_E_SUCCESS) {
 		return FILE_RELAY_E_MUX_ERROR;
 	}
+	property_list_service_set_encoding(plistclient, property_list_service_get_service_encoding("com.apple.mobile.file_relay"));
 
 	/* create client object */
 	file_relay_client_t client_loc = (file_relay_client_t) malloc(sizeof(struct file_relay_client_private));
@@ -78,6 +79,27 @@ file_relay_error_t file_relay_client_free(file_relay_client_t client)
 	return FILE_RELAY_E_SUCCESS;
 }
 
+/**
+ * Sets the plist encoding used for requests to the file_relay service.
+ * By default the encoding from the internal service encoding table is used.
+ *
+ * @param client The file_relay client to configure.
+ * @param encoding IDEVICE_PLIST_ENCODING_XML or IDEVICE_PLIST_ENCODING_BINARY
+ *
+ * @return FILE_RELAY_E_SUCCESS on success, or FILE_RELAY_E_INVALID_ARG when
+ *     client is NULL or encoding is invalid.
+ */
+file_relay_error_t file_relay_client_set_plist_encoding(file_relay_client_t client, enum idevice_plist_encoding encoding)
+{
+	if (!client || !client->parent)
+		return FILE_RELAY_E_INVALID_ARG;
+
+	if (property_list_service_set_encoding(client->parent, encoding) != PROPERTY_LIST_SERVICE_E_SUCCESS)
+		return FILE_RELAY_E_INVALID_ARG;
+
+	return FILE_RELAY_E_SUCCESS;
+}
+
 /**
  * Request data for the given sources.
  *
@@ -125,7 +147,7 @@ file_relay_error_t file_relay_request_sources(file_relay_client_t client, const
 	plist_t dict = plist_new_dict();
 	plist_dict_insert_item(dict, "Sources", array);
 
-	if (property_list_service_send_xml_plist(client->parent, dict) != PROPERTY_LIST_SERVICE_E_SUCCESS) {
+	if (property_list_service_send_plist(client->parent, dict) != PROPERTY_LIST_SERVICE_E_SUCCESS) {
 		debug_info("ERROR: Could not send request to device!");
 		err = FILE_RELAY_E_MUX_ERROR;
 		goto leave;
@@ -31,6 +31,22 @@
 
 static idevice_event_cb_t event_cb = NULL;
 
+/** Protects the connection lists and retired statistics of all devices. */
+static GStaticMutex stats_mutex = G_STATIC_MUTEX_INIT;
+
+/**
+ * Certificate credentials shared by all SSL sessions of the process. The
+ * process holds one reference for as long as it runs, every SSL session
+ * holds another one while it is active.
+ */
+static gnutls_certificate_credentials_t ssl_credentials = NULL;
+static unsigned int ssl_credentials_refs = 0;
+static GStaticMutex ssl_credentials_mutex = G_STATIC_MUTEX_INIT;
+
+/** SSL session data of the last session per device uuid, for resumption. */
+static GHashTable *ssl_session_cache = NULL;
+static GStaticMutex ssl_session_cache_mutex = G_STATIC_MUTEX_INIT;
+
 static void usbmux_event_cb(const usbmuxd_event_t *event, void *user_data)
 {
 	idevice_event_t ev;
@@ -159,7 +175,10 @@ idevice_error_t idevice_new(idevice_t * device, const char *uuid)
 	usbmuxd_device_info_t muxdev;
 	int res = usbmuxd_get_device_by_uuid(uuid, &muxdev);
 	if (res > 0) {
+		if (!g_thread_supported())
+			g_thread_init(NULL);
 		idevice_t phone = (idevice_t) malloc(sizeof(struct idevice_private));
+		memset(phone, '\0', sizeof(struct idevice_private));
 		phone->uuid = strdup(muxdev.uuid);
 		phone->conn_type = CONNECTION_USBMUXD;
 		phone->conn_data = (void*)muxdev.handle;
@@ -188,6 +207,15 @@ idevice_error_t idevice_free(idevice_t device)
 
 	free(device->uuid);
 
+	/* connections may outlive their device; detach them */
+	g_static_mutex_lock(&stats_mutex);
+	GSList *iter;
+	for (iter = device->connections; iter; iter = iter->next) {
+		((idevice_connection_t)iter->data)->device = NULL;
+	}
+	g_slist_free(device->connections);
+	g_static_mutex_unlock(&stats_mutex);
+
 	if (device->conn_type == CONNECTION_USBMUXD) {
 		device->conn_data = 0;
 	}
@@ -198,6 +226,90 @@ idevice_error_t idevice_free(idevice_t device)
 	return ret;
 }
 
+/**
+ * Returns the current time in microseconds, used to measure how long
+ * transport calls block.
+ */
+static uint64_t stats_time_usec()
+{
+	GTimeVal tv;
+	g_get_current_time(&tv);
+	return ((uint64_t)tv.tv_sec * G_USEC_PER_SEC) + tv.tv_usec;
+}
+
+/**
+ * Adds the counters of stats to total.
+ */
+static void stats_add(idevice_stats_t *total, const idevice_stats_t *stats)
+{
+	total->bytes_sent += stats->bytes_sent;
+	total->bytes_received += stats->bytes_received;
+	total->wire_bytes_sent += stats->wire_bytes_sent;
+	total->wire_bytes_received += stats->wire_bytes_received;
+	total->send_calls += stats->send_calls;
+	total->recv_calls += stats->recv_calls;
+	total->partial_reads += stats->partial_reads;
+	total->blocked_usec += stats->blocked_usec;
+	total->ssl_send_calls += stats->ssl_send_calls;
+	total->ssl_recv_calls += stats->ssl_recv_calls;
+	total->ssl_handshakes_full += stats->ssl_handshakes_full;
+	total->ssl_handshakes_resumed += stats->ssl_handshakes_resumed;
+	total->connections += stats->connections;
+}
+
+/**
+ * Updates the transport counters of a connection after a receive call.
+ */
+static void stats_update_recv(idevice_connection_t connection, uint32_t requested, uint32_t received, uint64_t start)
+{
+	uint64_t blocked = stats_time_usec() - start;
+
+	g_static_mutex_lock(&stats_mutex);
+	connection->stats.recv_calls++;
+	connection->stats.wire_bytes_received += received;
+	if (received < requested) {
+		connection->stats.partial_reads++;
+	}
+	connection->stats.blocked_usec += blocked;
+	g_static_mutex_unlock(&stats_mutex);
+}
+
+/**
+ * Updates the transport counters of a connection after a send call.
+ */
+static void stats_update_send(idevice_connection_t connection, uint32_t sent, uint64_t start)
+{
+	uint64_t blocked = stats_time_usec() - start;
+
+	g_static_mutex_lock(&stats_mutex);
+	connection->stats.send_calls++;
+	connection->stats.wire_bytes_sent += sent;
+	connection->stats.blocked_usec += blocked;
+	g_static_mutex_unlock(&stats_mutex);
+}
+
+/**
+ * Updates the payload counters of a connection after data was passed to or
+ * from the caller.
+ *
+ * @param connection The connection
+ * @param sent Payload bytes sent
+ * @param received Payload bytes received
+ * @param ssl Whether the data went through a gnutls_record_send or
+ *     gnutls_record_recv call.
+ */
+static void stats_update_payload(idevice_connection_t connection, uint32_t sent, uint32_t received, int ssl)
+{
+	g_static_mutex_lock(&stats_mutex);
+	connection->stats.bytes_sent += sent;
+	connection->stats.bytes_received += received;
+	if (ssl && sent)
+		connection->stats.ssl_send_calls++;
+	if (ssl && received)
+		connection->stats.ssl_recv_calls++;
+	g_static_mutex_unlock(&stats_mutex);
+}
+
 /**
  * Set up a connection to the given device.
  *
@@ -224,6 +336,13 @@ idevice_error_t idevice_connect(idevice_t device, uint16_t port, idevice_connect
 		new_connection->type = CONNECTION_USBMUXD;
 		new_connection->data = (void*)sfd;
 		new_connection->ssl_data = NULL;
+		new_connection->device = device;
+		new_connection->uuid = strdup(device->uuid);
+		memset(&new_connection->stats, '\0', sizeof(idevice_stats_t));
+		new_connection->stats.connections = 1;
+		g_static_mutex_lock(&stats_mutex);
+		device->connections = g_slist_prepend(device->connections, new_connection);
+		g_static_mutex_unlock(&stats_mutex);
 		*connection = new_connection;
 		return IDEVICE_E_SUCCESS;
 	} else {
@@ -256,6 +375,13 @@ idevice_error_t idevice_disconnect(idevice_connection_t connection)
 	} else {
 		debug_info("Unknown connection type %d", connection->type);
 	}
+	g_static_mutex_lock(&stats_mutex);
+	if (connection->device) {
+		stats_add(&connection->device->retired_stats, &connection->stats);
+		connection->device->connections = g_slist_remove(connection->device->connections, connection);
+	}
+	g_static_mutex_unlock(&stats_mutex);
+	free(connection->uuid);
 	free(connection);
 	return result;
 }
@@ -270,7 +396,9 @@ static idevice_error_t internal_connection_send(idevice_connection_t connection,
 	}
 
 	if (connection->type == CONNECTION_USBMUXD) {
+		uint64_t start = stats_time_usec();
 		int res = usbmuxd_send((int)(connection->data), data, len, sent_bytes);
+		stats_update_send(connection, (res < 0) ? 0 : *sent_bytes, start);
 		if (res < 0) {
 			debug_info("ERROR: usbmuxd_send returned %d (%s)", res, strerror(-res));
 			return IDEVICE_E_UNKNOWN_ERROR;
@@ -304,12 +432,17 @@ idevice_error_t idevice_connection_send(idevice_connection_t connection, const c
 		ssize_t sent = gnutls_record_send(connection->ssl_data->session, (void*)data, (size_t)len);
 		if ((uint32_t)sent == (uint32_t)len) {
 			*sent_bytes = sent;
+			stats_update_payload(connection, sent, 0, 1);
 			return IDEVICE_E_SUCCESS;
 		}
 		*sent_bytes = 0;
 		return IDEVICE_E_SSL_ERROR;
 	}
-	return internal_connection_send(connection, data, len, sent_bytes);
+	idevice_error_t res = internal_connection_send(connection, data, len, sent_bytes);
+	if (res == IDEVICE_E_SUCCESS) {
+		stats_update_payload(connection, *sent_bytes, 0, 0);
+	}
+	return res;
 }
 
 /**
@@ -323,7 +456,9 @@ static idevice_error_t internal_connection_receive_timeout(idevice_connection_t
 	}
 
 	if (connection->type == CONNECTION_USBMUXD) {
+		uint64_t start = stats_time_usec();
 		int res = usbmuxd_recv_timeout((int)(connection->data), data, len, recv_bytes, timeout);
+		stats_update_recv(connection, len, (res < 0) ? 0 : *recv_bytes, start);
 		if (res < 0) {
 			debug_info("ERROR: usbmuxd_recv_timeout returned %d (%s)", res, strerror(-res));
 			return IDEVICE_E_UNKNOWN_ERROR;
@@ -360,12 +495,17 @@ idevice_error_t idevice_connection_receive_timeout(idevice_connection_t connecti
 		ssize_t received = gnutls_record_recv(connection->ssl_data->session, (void*)data, (size_t)len);
 		if (received > 0) {
 			*recv_bytes = received;
+			stats_update_payload(connection, 0, received, 1);
 			return IDEVICE_E_SUCCESS;
 		}
 		*recv_bytes = 0;
 		return IDEVICE_E_SSL_ERROR;
 	}
-	return internal_connection_receive_timeout(connection, data, len, recv_bytes, timeout);
+	idevice_error_t res = internal_connection_receive_timeout(connection, data, len, recv_bytes, timeout);
+	if (res == IDEVICE_E_SUCCESS) {
+		stats_update_payload(connection, 0, *recv_bytes, 0);
+	}
+	return res;
 }
 
 /**
@@ -378,7 +518,9 @@ static idevice_error_t internal_connection_receive(idevice_connection_t connecti
 	}
 
 	if (connection->type == CONNECTION_USBMUXD) {
+		uint64_t start = stats_time_usec();
 		int res = usbmuxd_recv((int)(connection->data), data, len, recv_bytes);
+		stats_update_recv(connection, len, (res < 0) ? 0 : *recv_bytes, start);
 		if (res < 0) {
 			debug_info("ERROR: usbmuxd_recv returned %d (%s)", res, strerror(-res));
 			return IDEVICE_E_UNKNOWN_ERROR;
@@ -414,12 +556,58 @@ idevice_error_t idevice_connection_receive(idevice_connection_t connection, char
 		ssize_t received = gnutls_record_recv(connection->ssl_data->session, (void*)data, (size_t)len);
 		if (received > 0) {
 			*recv_bytes = received;
+			stats_update_payload(connection, 0, received, 1);
 			return IDEVICE_E_SUCCESS;
 		}
 		*recv_bytes = 0;
 		return IDEVICE_E_SSL_ERROR;
 	}
-	return internal_connection_receive(connection, data, len, recv_bytes);
+	idevice_error_t res = internal_connection_receive(connection, data, len, recv_bytes);
+	if (res == IDEVICE_E_SUCCESS) {
+		stats_update_payload(connection, 0, *recv_bytes, 0);
+	}
+	return res;
+}
+
+/**
+ * Internally used function to get the file descriptor of a connection, so
+ * callers can wait for incoming data with poll() instead of polling with
+ * receive timeouts.
+ *
+ * @note Data that SSL has already read from the descriptor is not signaled
+ *   by poll(), check idevice_connection_get_pending first.
+ *
+ * @param connection The connection to get the file descriptor of.
+ *
+ * @return The file descriptor, or -1 if connection is NULL or of an unknown
+ *   type.
+ */
+int idevice_connection_get_fd(idevice_connection_t connection)
+{
+	if (!connection)
+		return -1;
+
+	if (connection->type == CONNECTION_USBMUXD) {
+		return (int)(long)connection->data;
+	}
+	debug_info("Unknown connection type %d", connection->type);
+	return -1;
+}
+
+/**
+ * Internally used function to get the number of bytes that can be received
+ * from a connection without reading from its file descriptor.
+ *
+ * @param connection The connection to check.
+ *
+ * @return The number of decrypted bytes buffered by SSL, or 0.
+ */
+size_t idevice_connection_get_pending(idevice_connection_t connection)
+{
+	if (!connection || !connection->ssl_data || !connection->ssl_data->session)
+		return 0;
+
+	return gnutls_record_check_pending(connection->ssl_data->session);
 }
 
 /**
@@ -451,6 +639,59 @@ idevice_error_t idevice_get_uuid(idevice_t device, char **uuid)
 	return IDEVICE_E_SUCCESS;
 }
 
+/**
+ * Gets a snapshot of the transfer statistics of the given connection.
+ *
+ * @param connection The connection to get the statistics for.
+ * @param stats Pointer to an idevice_stats_t that will be filled with the
+ *   current counters.
+ *
+ * @return IDEVICE_E_SUCCESS if ok, IDEVICE_E_INVALID_ARG when connection or
+ *   stats is NULL.
+ */
+idevice_error_t idevice_connection_get_stats(idevice_connection_t connection, idevice_stats_t *stats)
+{
+	if (!connection || !stats)
+		return IDEVICE_E_INVALID_ARG;
+
+	g_static_mutex_lock(&stats_mutex);
+	memcpy(stats, &connection->stats, sizeof(idevice_stats_t));
+	g_static_mutex_unlock(&stats_mutex);
+	return IDEVICE_E_SUCCESS;
+}
+
+/**
+ * Gets the aggregated transfer statistics of all connections that have
+ * been made to the given device, including connections that are already
+ * closed.
+ *
+ * @note The counters are taken under the same lock that guards their
+ *   updates, so the result is a consistent snapshot; transfers still in
+ *   progress are counted once they completed.
+ *
+ * @param device The device to get the statistics for.
+ * @param stats Pointer to an idevice_stats_t that will be filled with the
+ *   aggregated counters.
+ *
+ * @return IDEVICE_E_SUCCESS if ok, IDEVICE_E_INVALID_ARG when device or
+ *   stats is NULL.
+ */
+idevice_error_t idevice_get_stats(idevice_t device, idevice_stats_t *stats)
+{
+	if (!device || !stats)
+		return IDEVICE_E_INVALID_ARG;
+
+	g_static_mutex_lock(&stats_mutex);
+	memcpy(stats, &device->retired_stats, sizeof(idevice_stats_t));
+	GSList *iter;
+	for (iter = device->connections; iter; iter = iter->next) {
+		stats_add(stats, &((idevice_connection_t)iter->data)->stats);
+	}
+	g_static_mutex_unlock(&stats_mutex);
+
+	return IDEVICE_E_SUCCESS;
+}
+
 /**
  * Internally used gnutls callback function for receiving encrypted data.
  */
@@ -509,6 +750,53 @@ static ssize_t internal_ssl_write(gnutls_transport_ptr_t transport, char *buffer
 	return bytes;
 }
 
+/**
+ * Internally used function to get a reference to the shared certificate
+ * credentials. GnuTLS is initialized and the credentials are set up on
+ * first use only.
+ *
+ * @return The shared credentials, or NULL if they could not be allocated.
+ */
+static gnutls_certificate_credentials_t internal_ssl_credentials_ref()
+{
+	gnutls_certificate_credentials_t credentials = NULL;
+
+	g_static_mutex_lock(&ssl_credentials_mutex);
+	if (!ssl_credentials) {
+		debug_info("setting up shared SSL credentials");
+		gnutls_global_init();
+		if (gnutls_certificate_allocate_credentials(&ssl_credentials) == GNUTLS_E_SUCCESS) {
+			gnutls_certificate_set_x509_trust_file(ssl_credentials, "hostcert.pem", GNUTLS_X509_FMT_PEM);
+			ssl_credentials_refs = 1;
+		} else {
+			ssl_credentials = NULL;
+			gnutls_global_deinit();
+		}
+	}
+	if (ssl_credentials) {
+		ssl_credentials_refs++;
+		credentials = ssl_credentials;
+	}
+	g_static_mutex_unlock(&ssl_credentials_mutex);
+
+	return credentials;
+}
+
+/**
+ * Internally used function to release a reference to the shared
+ * certificate credentials.
+ */
+static void internal_ssl_credentials_unref(gnutls_certificate_credentials_t credentials)
+{
+	g_static_mutex_lock(&ssl_credentials_mutex);
+	if (credentials == ssl_credentials && --ssl_credentials_refs == 0) {
+		gnutls_certificate_free_credentials(ssl_credentials);
+		ssl_credentials = NULL;
+		gnutls_global_deinit();
+	}
+	g_static_mutex_unlock(&ssl_credentials_mutex);
+}
+
 /**
  * Internally used function for cleaning up SSL stuff.
  */
@@ -521,10 +809,77 @@ static void internal_ssl_cleanup(ssl_data_t ssl_data)
 		gnutls_deinit(ssl_data->session);
 	}
 	if (ssl_data->certificate) {
-		gnutls_certificate_free_credentials(ssl_data->certificate);
+		internal_ssl_credentials_unref(ssl_data->certificate);
 	}
 }
 
+/**
+ * Internally used function to free stored SSL session data.
+ */
+static void internal_ssl_session_data_free(gpointer data)
+{
+	g_byte_array_free((GByteArray*)data, TRUE);
+}
+
+/**
+ * Internally used function that prepares an SSL session for resuming the
+ * last session that was established with the same device.
+ *
+ * @return 1 if session data was set, 0 otherwise.
+ */
+static int internal_ssl_session_restore(gnutls_session_t session, const char *uuid)
+{
+	int restored = 0;
+
+	if (!uuid)
+		return 0;
+
+	g_static_mutex_lock(&ssl_session_cache_mutex);
+	if (ssl_session_cache) {
+		GByteArray *data = (GByteArray*)g_hash_table_lookup(ssl_session_cache, uuid);
+		if (data && (gnutls_session_set_data(session, data->data, data->len) == GNUTLS_E_SUCCESS)) {
+			restored = 1;
+		}
+	}
+	g_static_mutex_unlock(&ssl_session_cache_mutex);
+
+	return restored;
+}
+
+/**
+ * Internally used function that stores the data of an established SSL
+ * session so that the next connection to the same device can resume it.
+ * Passing a NULL session forgets the stored data.
+ */
+static void internal_ssl_session_store(gnutls_session_t session, const char *uuid)
+{
+	GByteArray *data = NULL;
+	size_t size = 0;
+
+	if (!uuid)
+		return;
+
+	if (session && (gnutls_session_get_data(session, NULL, &size) == GNUTLS_E_SUCCESS) && (size > 0)) {
+		data = g_byte_array_sized_new(size);
+		g_byte_array_set_size(data, size);
+		if (gnutls_session_get_data(session, data->data, &size) != GNUTLS_E_SUCCESS) {
+			g_byte_array_free(data, TRUE);
+			data = NULL;
+		}
+	}
+
+	g_static_mutex_lock(&ssl_session_cache_mutex);
+	if (!ssl_session_cache) {
+		ssl_session_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, internal_ssl_session_data_free);
+	}
+	if (data) {
+		g_hash_table_replace(ssl_session_cache, g_strdup(uuid), data);
+	} else {
+		g_hash_table_remove(ssl_session_cache, uuid);
+	}
+	g_static_mutex_unlock(&ssl_session_cache_mutex);
+}
+
 /**
  * Enables SSL for the given connection.
  *
@@ -543,13 +898,17 @@ idevice_error_t idevice_connection_enable_ssl(idevice_connection_t connection)
 	uint32_t return_me = 0;
 
 	ssl_data_t ssl_data_loc = (ssl_data_t)malloc(sizeof(struct ssl_data_private));
+	memset(ssl_data_loc, '\0', sizeof(struct ssl_data_private));
 
 	/* Set up GnuTLS... */
 	debug_info("enabling SSL mode");
 	errno = 0;
-	gnutls_global_init();
-	gnutls_certificate_allocate_credentials(&ssl_data_loc->certificate);
-	gnutls_certificate_set_x509_trust_file(ssl_data_loc->certificate, "hostcert.pem", GNUTLS_X509_FMT_PEM);
+	ssl_data_loc->certificate = internal_ssl_credentials_ref();
+	if (!ssl_data_loc->certificate) {
+		debug_info("ERROR: could not set up SSL credentials");
+		free(ssl_data_loc);
+		return IDEVICE_E_SSL_ERROR;
+	}
 	gnutls_init(&ssl_data_loc->session, GNUTLS_CLIENT);
 	{
 		int protocol_priority[16] = { GNUTLS_SSL3, 0 };
@@ -566,6 +925,12 @@ idevice_error_t idevice_connection_enable_ssl(idevice_connection_t connection)
 	}
 	gnutls_credentials_set(ssl_data_loc->session, GNUTLS_CRD_CERTIFICATE, ssl_data_loc->certificate); /* this part is killing me. */
 
+	/* try to resume the previous session with this device; the device
+	 * falls back to a full handshake if it does not know the session */
+	if (internal_ssl_session_restore(ssl_data_loc->session, connection->uuid)) {
+		debug_info("trying to resume previous SSL session");
+	}
+
 	debug_info("GnuTLS step 1...");
 	gnutls_transport_set_ptr(ssl_data_loc->session, (gnutls_transport_ptr_t)connection);
 	debug_info("GnuTLS step 2...");
@@ -579,12 +944,24 @@ idevice_error_t idevice_connection_enable_ssl(idevice_connection_t connection)
 	debug_info("GnuTLS handshake done...");
 
 	if (return_me != GNUTLS_E_SUCCESS) {
+		internal_ssl_session_store(NULL, connection->uuid);
 		internal_ssl_cleanup(ssl_data_loc);
 		free(ssl_data_loc);
 		debug_info("GnuTLS reported something wrong.");
 		gnutls_perror(return_me);
 		debug_info("oh.. errno says %s", strerror(errno));
 	} else {
+		if (gnutls_session_is_resumed(ssl_data_loc->session)) {
+			g_static_mutex_lock(&stats_mutex);
+			connection->stats.ssl_handshakes_resumed++;
+			g_static_mutex_unlock(&stats_mutex);
+			debug_info("SSL session resumed");
+		} else {
+			g_static_mutex_lock(&stats_mutex);
+			connection->stats.ssl_handshakes_full++;
+			g_static_mutex_unlock(&stats_mutex);
+			internal_ssl_session_store(ssl_data_loc->session, connection->uuid);
+		}
 		connection->ssl_data = ssl_data_loc;
 		ret = IDEVICE_E_SUCCESS;
 		debug_info("SSL mode enabled");
@@ -22,6 +22,7 @@
 #define IDEVICE_H
 
 #include <gnutls/gnutls.h>
+#include <glib.h>
 
 #include "libimobiledevice/libimobiledevice.h"
 
@@ -39,15 +40,22 @@ struct idevice_connection_private {
 	enum connection_type type;
 	void *data;
 	ssl_data_t ssl_data;
+	idevice_t device;
+	char *uuid;
+	idevice_stats_t stats;
 };
 
 struct idevice_private {
 	char *uuid;
 	enum connection_type conn_type;
 	void *conn_data;
+	idevice_stats_t retired_stats;
+	GSList *connections;
 };
 
 idevice_error_t idevice_connection_enable_ssl(idevice_connection_t connection);
 idevice_error_t idevice_connection_disable_ssl(idevice_connection_t connection);
+int idevice_connection_get_fd(idevice_connection_t connection);
+size_t idevice_connection_get_pending(idevice_connection_t connection);
 
 #endif
@@ -22,11 +22,16 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
+#include <poll.h>
 #include <plist/plist.h>
 
 #include "installation_proxy.h"
 #include "property_list_service.h"
+#include "idevice.h"
+#include "userpref.h"
 #include "debug.h"
+#include "libimobiledevice/lockdown.h"
 
 struct instproxy_status_data {
 	instproxy_client_t client;
@@ -107,11 +112,14 @@ instproxy_error_t instproxy_client_new(idevice_t device, uint16_t port, instprox
 	if (property_list_service_client_new(device, port, &plistclient) != PROPERTY_LIST_SERVICE_E_SUCCESS) {
 		return INSTPROXY_E_CONN_FAILED;
 	}
+	property_list_service_set_encoding(plistclient, property_list_service_get_service_encoding("com.apple.mobile.installation_proxy"));
 
 	instproxy_client_t client_loc = (instproxy_client_t) malloc(sizeof(struct instproxy_client_private));
 	client_loc->parent = plistclient;
 	client_loc->mutex = g_mutex_new();
 	client_loc->status_updater = NULL;
+	client_loc->status_mode = INSTPROXY_STATUS_CALLBACK;
+	client_loc->operation_active = 0;
 
 	*client = client_loc;
 	return INSTPROXY_E_SUCCESS;
@@ -175,30 +183,26 @@ static instproxy_error_t instproxy_send_command(instproxy_client_t client, const
 		plist_dict_insert_item(dict, "PackagePath", plist_new_string(package_path));
 	}
 
-	instproxy_error_t err = instproxy_error(property_list_service_send_xml_plist(client->parent, dict));
+	instproxy_error_t err = instproxy_error(property_list_service_send_plist(client->parent, dict));
 	plist_free(dict);
 	return err;
 }
 
 /**
- * List installed applications. This function runs synchronously.
+ * Internally used function that runs a Browse command and hands every
+ * CurrentList chunk to chunk_cb as it arrives.
  *
  * @param client The connected installation_proxy client
  * @param client_options The client options to use, as PLIST_DICT, or NULL.
- *        Valid client options include:
- *          "ApplicationType" -> "User"
- *          "ApplicationType" -> "System"
- * @param result Pointer that will be set to a plist that will hold an array
- *        of PLIST_DICT holding information about the applications found.
+ * @param chunk_cb Called with each chunk as a PLIST_ARRAY. The array is only
+ *        valid during the call.
+ * @param user_data Pointer passed to chunk_cb.
  *
  * @return INSTPROXY_E_SUCCESS on success or an INSTPROXY_E_* error value if
  *     an error occured.
  */
-instproxy_error_t instproxy_browse(instproxy_client_t client, plist_t client_options, plist_t *result)
+static instproxy_error_t instproxy_browse_chunks(instproxy_client_t client, plist_t client_options, instproxy_browse_cb_t chunk_cb, void *user_data)
 {
-	if (!client || !client->parent || !result)
-		return INSTPROXY_E_INVALID_ARG;
-
 	instproxy_error_t res = INSTPROXY_E_UNKNOWN_ERROR;
 
 	instproxy_lock(client);
@@ -209,7 +213,6 @@ instproxy_error_t instproxy_browse(instproxy_client_t client, plist_t client_opt
 	}
 
 	int browsing = 0;
-	plist_t apps_array = plist_new_array();
 	plist_t dict = NULL;
 
 	do {
@@ -220,7 +223,6 @@ instproxy_error_t instproxy_browse(instproxy_client_t client, plist_t client_opt
 			break;
 		}
 		if (dict) {
-			uint64_t i;
 			uint64_t current_amount = 0;
 			char *status = NULL;
 			plist_t camount = plist_dict_get_item(dict, "CurrentAmount");
@@ -230,9 +232,8 @@ instproxy_error_t instproxy_browse(instproxy_client_t client, plist_t client_opt
 			}
 			if (current_amount > 0) {
 				plist_t current_list = plist_dict_get_item(dict, "CurrentList");
-				for (i = 0; current_list && (i < current_amount); i++) {
-					plist_t item = plist_array_get_item(current_list, i);
-					plist_array_append_item(apps_array, plist_copy(item));
+				if (current_list && (plist_get_node_type(current_list) == PLIST_ARRAY)) {
+					chunk_cb(current_list, user_data);
 				}
 			}
 			if (pstatus) {
@@ -251,15 +252,231 @@ instproxy_error_t instproxy_browse(instproxy_client_t client, plist_t client_opt
 		}
 	} while (browsing);
 
+leave_unlock:
+	instproxy_unlock(client);
+	return res;
+}
+
+/**
+ * Internally used browse callback collecting all apps into one array.
+ */
+static void instproxy_browse_append(plist_t apps, void *user_data)
+{
+	plist_t apps_array = (plist_t)user_data;
+	uint32_t i;
+
+	for (i = 0; i < plist_array_get_size(apps); i++) {
+		plist_array_append_item(apps_array, plist_copy(plist_array_get_item(apps, i)));
+	}
+}
+
+/**
+ * List installed applications. This function runs synchronously.
+ *
+ * @param client The connected installation_proxy client
+ * @param client_options The client options to use, as PLIST_DICT, or NULL.
+ *        Valid client options include:
+ *          "ApplicationType" -> "User"
+ *          "ApplicationType" -> "System"
+ * @param result Pointer that will be set to a plist that will hold an array
+ *        of PLIST_DICT holding information about the applications found.
+ *
+ * @return INSTPROXY_E_SUCCESS on success or an INSTPROXY_E_* error value if
+ *     an error occured.
+ */
+instproxy_error_t instproxy_browse(instproxy_client_t client, plist_t client_options, plist_t *result)
+{
+	if (!client || !client->parent || !result)
+		return INSTPROXY_E_INVALID_ARG;
+
+	plist_t apps_array = plist_new_array();
+	instproxy_error_t res = instproxy_browse_chunks(client, client_options, instproxy_browse_append, apps_array);
 	if (res == INSTPROXY_E_SUCCESS) {
 		*result = apps_array;
+	} else {
+		plist_free(apps_array);
 	}
 
-leave_unlock:
-	instproxy_unlock(client);
 	return res;
 }
 
+/**
+ * List installed applications, delivering them chunk by chunk as the device
+ * sends them instead of collecting the whole list first. This function runs
+ * synchronously.
+ *
+ * @param client The connected installation_proxy client
+ * @param client_options The client options to use, as PLIST_DICT, or NULL.
+ *        See instproxy_browse. Use
+ *        instproxy_client_options_set_return_attributes to have the device
+ *        send only the attributes needed.
+ * @param browse_cb Called for every chunk with a PLIST_ARRAY of application
+ *        dictionaries. The array belongs to the library and is only valid
+ *        during the call; copy what needs to be kept.
+ * @param user_data Pointer passed to browse_cb.
+ *
+ * @return INSTPROXY_E_SUCCESS on success or an INSTPROXY_E_* error value if
+ *     an error occured.
+ */
+instproxy_error_t instproxy_browse_with_callback(instproxy_client_t client, plist_t client_options, instproxy_browse_cb_t browse_cb, void *user_data)
+{
+	if (!client || !client->parent || !browse_cb)
+		return INSTPROXY_E_INVALID_ARG;
+
+	return instproxy_browse_chunks(client, client_options, browse_cb, user_data);
+}
+
+struct instproxy_app_info_browse {
+	instproxy_app_info_cb_t app_info_cb;
+	void *user_data;
+};
+
+/**
+ * Internally used function returning the value of a string node in an app
+ * dictionary, or NULL.
+ */
+static char *instproxy_app_get_string(plist_t app, const char *key)
+{
+	char *str = NULL;
+	plist_t node = plist_dict_get_item(app, key);
+	if (node && (plist_get_node_type(node) == PLIST_STRING)) {
+		plist_get_string_val(node, &str);
+	}
+	return str;
+}
+
+/**
+ * Internally used function returning the value of an integer node in an app
+ * dictionary, or 0.
+ */
+static uint64_t instproxy_app_get_uint(plist_t app, const char *key)
+{
+	uint64_t val = 0;
+	plist_t node = plist_dict_get_item(app, key);
+	if (node && (plist_get_node_type(node) == PLIST_UINT)) {
+		plist_get_uint_val(node, &val);
+	}
+	return val;
+}
+
+/**
+ * Internally used browse callback converting a chunk to app info structs.
+ */
+static void instproxy_browse_app_info_chunk(plist_t apps, void *user_data)
+{
+	struct instproxy_app_info_browse *browse = (struct instproxy_app_info_browse*)user_data;
+	uint32_t count = plist_array_get_size(apps);
+	uint32_t i;
+
+	if (count == 0)
+		return;
+
+	instproxy_app_info_t *infos = (instproxy_app_info_t*)malloc(sizeof(instproxy_app_info_t) * count);
+	for (i = 0; i < count; i++) {
+		plist_t app = plist_array_get_item(apps, i);
+		infos[i].bundle_id = instproxy_app_get_string(app, "CFBundleIdentifier");
+		infos[i].version = instproxy_app_get_string(app, "CFBundleVersion");
+		infos[i].size = instproxy_app_get_uint(app, "StaticDiskUsage") + instproxy_app_get_uint(app, "DynamicDiskUsage");
+	}
+
+	browse->app_info_cb(infos, count, browse->user_data);
+
+	for (i = 0; i < count; i++) {
+		free(infos[i].bundle_id);
+		free(infos[i].version);
+	}
+	free(infos);
+}
+
+/**
+ * List installed applications as compact structs holding only the bundle
+ * identifier, version and disk usage, delivered chunk by chunk as the device
+ * sends them. Only these attributes are requested from the device. This
+ * function runs synchronously.
+ *
+ * @param client The connected installation_proxy client
+ * @param client_options The client options to use, as PLIST_DICT, or NULL.
+ *        See instproxy_browse. Any "ReturnAttributes" given are replaced.
+ * @param app_info_cb Called for every chunk with an array of app info
+ *        structs. The structs and their strings are only valid during the
+ *        call.
+ * @param user_data Pointer passed to app_info_cb.
+ *
+ * @return INSTPROXY_E_SUCCESS on success or an INSTPROXY_E_* error value if
+ *     an error occured.
+ */
+instproxy_error_t instproxy_browse_app_info(instproxy_client_t client, plist_t client_options, instproxy_app_info_cb_t app_info_cb, void *user_data)
+{
+	if (!client || !client->parent || !app_info_cb || (client_options && (plist_get_node_type(client_options) != PLIST_DICT)))
+		return INSTPROXY_E_INVALID_ARG;
+
+	struct instproxy_app_info_browse browse;
+	plist_t options = client_options ? plist_copy(client_options) : instproxy_client_options_new();
+	instproxy_error_t res;
+
+	instproxy_client_options_set_return_attributes(options, "CFBundleIdentifier", "CFBundleVersion", "StaticDiskUsage", "DynamicDiskUsage", NULL);
+
+	browse.app_info_cb = app_info_cb;
+	browse.user_data = user_data;
+	res = instproxy_browse_chunks(client, options, instproxy_browse_app_info_chunk, &browse);
+	instproxy_client_options_free(options);
+
+	return res;
+}
+
+/**
+ * Internally used function that parses a status message of an operation.
+ *
+ * @param dict The status message received from the device.
+ * @param progress The progress to update. Fields not present in the message
+ *        keep their previous values.
+ */
+static void instproxy_parse_status(plist_t dict, instproxy_progress_t *progress)
+{
+	char *str = NULL;
+
+	plist_t err = plist_dict_get_item(dict, "Error");
+	if (err && (plist_get_node_type(err) == PLIST_STRING)) {
+		plist_get_string_val(err, &str);
+		g_strlcpy(progress->error, str ? str : "", sizeof(progress->error));
+		free(str);
+		str = NULL;
+		progress->complete = 1;
+		progress->result = INSTPROXY_E_OP_FAILED;
+	}
+
+	plist_t status = plist_dict_get_item(dict, "Status");
+	if (status && (plist_get_node_type(status) == PLIST_STRING)) {
+		plist_get_string_val(status, &str);
+		if (str) {
+			g_strlcpy(progress->status, str, sizeof(progress->status));
+			if (!strcmp(str, "Complete") && !progress->complete) {
+				progress->complete = 1;
+				progress->result = INSTPROXY_E_SUCCESS;
+				progress->percent = 100;
+			}
+			free(str);
+		}
+	}
+
+	plist_t npercent = plist_dict_get_item(dict, "PercentComplete");
+	if (npercent && (plist_get_node_type(npercent) == PLIST_UINT)) {
+		uint64_t val = 0;
+		plist_get_uint_val(npercent, &val);
+		progress->percent = (val > 100) ? 100 : (int)val;
+	}
+}
+
+/**
+ * Internally used function that resets a progress struct.
+ */
+static void instproxy_progress_init(instproxy_progress_t *progress)
+{
+	memset(progress, 0, sizeof(instproxy_progress_t));
+	progress->percent = -1;
+	progress->result = INSTPROXY_E_UNKNOWN_ERROR;
+}
+
 /**
  * Internally used function that will synchronously receive messages from
  * the specified installation_proxy until it completes or an error occurs.
@@ -275,9 +492,12 @@ leave_unlock:
 static instproxy_error_t instproxy_perform_operation(instproxy_client_t client, instproxy_status_cb_t status_cb, const char *operation, void *user_data)
 {
 	instproxy_error_t res = INSTPROXY_E_UNKNOWN_ERROR;
+	instproxy_progress_t progress;
 	int ok = 1;
 	plist_t dict = NULL;
 
+	instproxy_progress_init(&progress);
+
 	do {
 		instproxy_lock(client);
 		res = instproxy_error(property_list_service_receive_plist_with_timeout(client->parent, &dict, 30000));
@@ -291,44 +511,18 @@ static instproxy_error_t instproxy_perform_operation(instproxy_client_t client,
 			if (status_cb) {
 				status_cb(operation, dict, user_data);
 			}
-			/* check for 'Error', so we can abort cleanly */
-			plist_t err = plist_dict_get_item(dict, "Error");
-			if (err) {
-#ifndef STRIP_DEBUG_CODE
-				char *err_msg = NULL;
-				plist_get_string_val(err, &err_msg);
-				if (err_msg) {
-					debug_info("(%s): ERROR: %s", operation, err_msg);
-					free(err_msg);
-				}
-#endif
-				ok = 0;
-				res = INSTPROXY_E_OP_FAILED;
+			instproxy_parse_status(dict, &progress);
+			if (progress.error[0]) {
+				debug_info("(%s): ERROR: %s", operation, progress.error);
+			} else if (progress.percent >= 0) {
+				debug_info("(%s): %s (%d%%)", operation, progress.status, progress.percent);
+			} else {
+				debug_info("(%s): %s", operation, progress.status);
 			}
-			/* get 'Status' */
-			plist_t status = plist_dict_get_item(dict, "Status");
-			if (status) {
-				char *status_msg = NULL;
-				plist_get_string_val(status, &status_msg);
-				if (status_msg) {
-					if (!strcmp(status_msg, "Complete")) {
-						ok = 0;
-						res = INSTPROXY_E_SUCCESS;
-					}
-#ifndef STRIP_DEBUG_CODE
-					plist_t npercent = plist_dict_get_item(dict, "PercentComplete");
-					if (npercent) {
-						uint64_t val = 0;
-						int percent;
-						plist_get_uint_val(npercent, &val);
-						percent = val;
-						debug_info("(%s): %s (%d%%)", operation, status_msg, percent);
-					} else {
-						debug_info("(%s): %s", operation, status_msg);
-					}
-#endif
-					free(status_msg);
-				}
+			/* stop on 'Error' or when the 'Status' is 'Complete' */
+			if (progress.complete) {
+				ok = 0;
+				res = progress.result;
 			}
 			plist_free(dict);
 			dict = NULL;
@@ -372,7 +566,9 @@ static gpointer instproxy_status_updater(gpointer arg)
  * Internally used helper function that creates a status updater thread which
  * will call the passed callback function when status updates occur.
  * If status_cb is NULL no thread will be created, but the operation will
- * run synchronously until it completes or an error occurs.
+ * run synchronously until it completes or an error occurs. In
+ * INSTPROXY_STATUS_POLL mode neither happens; the caller reads the status
+ * with instproxy_read_status.
  *
  * @param client The connected installation proxy client
  * @param status_cb Pointer to a callback function or NULL
@@ -386,7 +582,14 @@ static gpointer instproxy_status_updater(gpointer arg)
 static instproxy_error_t instproxy_create_status_updater(instproxy_client_t client, instproxy_status_cb_t status_cb, const char *operation, void *user_data)
 {
 	instproxy_error_t res = INSTPROXY_E_UNKNOWN_ERROR;
-	if (status_cb) {
+	if (client->status_mode == INSTPROXY_STATUS_POLL) {
+		/* status updates are read by the caller with instproxy_read_status */
+		instproxy_lock(client);
+		client->operation_active = 1;
+		instproxy_progress_init(&client->progress);
+		instproxy_unlock(client);
+		res = INSTPROXY_E_SUCCESS;
+	} else if (status_cb) {
 		/* async mode */
 		struct instproxy_status_data *data = (struct instproxy_status_data*)malloc(sizeof(struct instproxy_status_data));
 		if (data) {
@@ -426,7 +629,7 @@ static instproxy_error_t instproxy_install_or_upgrade(instproxy_client_t client,
 	if (!client || !client->parent || !pkg_path) {
 		return INSTPROXY_E_INVALID_ARG;
 	}
-	if (client->status_updater) {
+	if (client->status_updater || client->operation_active) {
 		return INSTPROXY_E_OP_IN_PROGRESS;
 	}
 
@@ -524,7 +727,7 @@ instproxy_error_t instproxy_uninstall(instproxy_client_t client, const char *app
 		return INSTPROXY_E_INVALID_ARG;
 	}
 
-	if (client->status_updater) {
+	if (client->status_updater || client->operation_active) {
 		return INSTPROXY_E_OP_IN_PROGRESS;
 	}
 
@@ -615,7 +818,7 @@ instproxy_error_t instproxy_archive(instproxy_client_t client, const char *appid
 	if (!client || !client->parent || !appid)
 		return INSTPROXY_E_INVALID_ARG;
 
-	if (client->status_updater) {
+	if (client->status_updater || client->operation_active) {
 		return INSTPROXY_E_OP_IN_PROGRESS;
 	}
 
@@ -655,7 +858,7 @@ instproxy_error_t instproxy_restore(instproxy_client_t client, const char *appid
 	if (!client || !client->parent || !appid)
 		return INSTPROXY_E_INVALID_ARG;
 
-	if (client->status_updater) {
+	if (client->status_updater || client->operation_active) {
 		return INSTPROXY_E_OP_IN_PROGRESS;
 	}
 
@@ -695,7 +898,7 @@ instproxy_error_t instproxy_remove_archive(instproxy_client_t client, const char
 	if (!client || !client->parent || !appid)
 		return INSTPROXY_E_INVALID_ARG;
 
-	if (client->status_updater) {
+	if (client->status_updater || client->operation_active) {
 		return INSTPROXY_E_OP_IN_PROGRESS;
 	}
 
@@ -710,6 +913,762 @@ instproxy_error_t instproxy_remove_archive(instproxy_client_t client, const char
 	return instproxy_create_status_updater(client, status_cb, "RemoveArchive", user_data);
 }
 
+/**
+ * Sets how status updates of operations are delivered.
+ *
+ * In INSTPROXY_STATUS_CALLBACK mode (the default) operations either run
+ * synchronously or, if a status callback is given, on a thread per
+ * operation. In INSTPROXY_STATUS_POLL mode operations return as soon as
+ * the request was sent and no thread is created; the status callback is
+ * ignored. The caller waits for updates on the descriptor returned by
+ * instproxy_get_status_fd, e.g. together with many other clients, and
+ * reads them with instproxy_read_status.
+ *
+ * @param client The connected installation_proxy client
+ * @param mode INSTPROXY_STATUS_CALLBACK or INSTPROXY_STATUS_POLL
+ *
+ * @return INSTPROXY_E_SUCCESS on success, INSTPROXY_E_INVALID_ARG when client
+ *     is NULL or mode is invalid, or INSTPROXY_E_OP_IN_PROGRESS while an
+ *     operation is running.
+ */
+instproxy_error_t instproxy_set_status_mode(instproxy_client_t client, enum instproxy_status_mode mode)
+{
+	if (!client || (mode != INSTPROXY_STATUS_CALLBACK && mode != INSTPROXY_STATUS_POLL))
+		return INSTPROXY_E_INVALID_ARG;
+	if (client->status_updater || client->operation_active)
+		return INSTPROXY_E_OP_IN_PROGRESS;
+
+	client->status_mode = mode;
+	return INSTPROXY_E_SUCCESS;
+}
+
+/**
+ * Returns a file descriptor that becomes readable when a status update of
+ * the running operation arrives. Only for INSTPROXY_STATUS_POLL mode.
+ *
+ * @note Data already buffered for an SSL connection does not make the
+ *     descriptor readable; instproxy_status_pending reports it.
+ *
+ * @param client The connected installation_proxy client
+ *
+ * @return The file descriptor, or -1 if client is NULL.
+ */
+int instproxy_get_status_fd(instproxy_client_t client)
+{
+	if (!client || !client->parent)
+		return -1;
+	return idevice_connection_get_fd(client->parent->connection);
+}
+
+/**
+ * Checks whether a status update can be read without waiting on the file
+ * descriptor returned by instproxy_get_status_fd.
+ *
+ * @param client The connected installation_proxy client
+ *
+ * @return 1 if data is buffered, 0 otherwise.
+ */
+int instproxy_status_pending(instproxy_client_t client)
+{
+	if (!client || !client->parent)
+		return 0;
+	return (idevice_connection_get_pending(client->parent->connection) > 0);
+}
+
+/**
+ * Reads and parses the next status update of the running operation. Call
+ * this when the descriptor from instproxy_get_status_fd is readable.
+ *
+ * @param client The connected installation_proxy client in
+ *     INSTPROXY_STATUS_POLL mode.
+ * @param progress Filled with the progress of the operation so far. Once
+ *     its complete field is set the operation is over and result holds its
+ *     outcome.
+ *
+ * @return INSTPROXY_E_SUCCESS on success, INSTPROXY_E_INVALID_ARG when a
+ *     parameter is NULL or no operation is running, or an error if no
+ *     status could be received. In the latter case the operation is
+ *     considered finished.
+ */
+instproxy_error_t instproxy_read_status(instproxy_client_t client, instproxy_progress_t *progress)
+{
+	if (!client || !client->parent || !progress)
+		return INSTPROXY_E_INVALID_ARG;
+
+	instproxy_error_t res;
+	plist_t dict = NULL;
+
+	instproxy_lock(client);
+	if (!client->operation_active) {
+		instproxy_unlock(client);
+		return INSTPROXY_E_INVALID_ARG;
+	}
+
+	res = instproxy_error(property_list_service_receive_plist_with_timeout(client->parent, &dict, 30000));
+	if (res == INSTPROXY_E_SUCCESS && dict) {
+		instproxy_parse_status(dict, &client->progress);
+	} else {
+		debug_info("could not receive status, error %d", res);
+		if (res == INSTPROXY_E_SUCCESS)
+			res = INSTPROXY_E_PLIST_ERROR;
+		client->progress.complete = 1;
+		client->progress.result = res;
+	}
+	if (dict)
+		plist_free(dict);
+
+	if (client->progress.complete)
+		client->operation_active = 0;
+	memcpy(progress, &client->progress, sizeof(instproxy_progress_t));
+	instproxy_unlock(client);
+
+	return res;
+}
+
+struct instproxy_aggregator_entry {
+	instproxy_client_t client;
+	instproxy_progress_t progress;
+};
+
+/**
+ * Creates a progress aggregator that follows the operations of many
+ * installation_proxy clients from the calling thread, without a thread per
+ * operation.
+ *
+ * @param progress_cb Called for every status update with the parsed
+ *     progress, or NULL.
+ * @param user_data Pointer passed to progress_cb.
+ * @param aggregator Pointer that will be set to the new aggregator.
+ *
+ * @return INSTPROXY_E_SUCCESS on success, or INSTPROXY_E_INVALID_ARG when
+ *     aggregator is NULL.
+ */
+instproxy_error_t instproxy_aggregator_new(instproxy_progress_cb_t progress_cb, void *user_data, instproxy_aggregator_t *aggregator)
+{
+	if (!aggregator)
+		return INSTPROXY_E_INVALID_ARG;
+
+	instproxy_aggregator_t aggregator_loc = (instproxy_aggregator_t) malloc(sizeof(struct instproxy_aggregator_private));
+	aggregator_loc->entries = NULL;
+	aggregator_loc->progress_cb = progress_cb;
+	aggregator_loc->user_data = user_data;
+
+	*aggregator = aggregator_loc;
+	return INSTPROXY_E_SUCCESS;
+}
+
+/**
+ * Frees a progress aggregator. The clients are not freed.
+ *
+ * @param aggregator The aggregator to free.
+ *
+ * @return INSTPROXY_E_SUCCESS on success, or INSTPROXY_E_INVALID_ARG when
+ *     aggregator is NULL.
+ */
+instproxy_error_t instproxy_aggregator_free(instproxy_aggregator_t aggregator)
+{
+	GSList *node;
+
+	if (!aggregator)
+		return INSTPROXY_E_INVALID_ARG;
+
+	for (node = aggregator->entries; node; node = node->next) {
+		free(node->data);
+	}
+	g_slist_free(aggregator->entries);
+	free(aggregator);
+
+	return INSTPROXY_E_SUCCESS;
+}
+
+/**
+ * Adds a client to a progress aggregator. The client has to be in
+ * INSTPROXY_STATUS_POLL mode and have an operation started.
+ *
+ * @param aggregator The progress aggregator
+ * @param client The client whose operation to follow.
+ *
+ * @return INSTPROXY_E_SUCCESS on success, or INSTPROXY_E_INVALID_ARG when a
+ *     parameter is NULL or the client has no running operation in
+ *     INSTPROXY_STATUS_POLL mode.
+ */
+instproxy_error_t instproxy_aggregator_add(instproxy_aggregator_t aggregator, instproxy_client_t client)
+{
+	if (!aggregator || !client || (client->status_mode != INSTPROXY_STATUS_POLL) || !client->operation_active)
+		return INSTPROXY_E_INVALID_ARG;
+
+	struct instproxy_aggregator_entry *entry = (struct instproxy_aggregator_entry*)malloc(sizeof(struct instproxy_aggregator_entry));
+	entry->client = client;
+	instproxy_progress_init(&entry->progress);
+	aggregator->entries = g_slist_append(aggregator->entries, entry);
+
+	return INSTPROXY_E_SUCCESS;
+}
+
+/**
+ * Waits for status updates of the followed operations and processes all
+ * that arrived completely, calling the progress callback for each. Updates
+ * that only arrived partly are left for a later call.
+ *
+ * @param aggregator The progress aggregator
+ * @param timeout Milliseconds to wait for an update, or -1 to wait until one
+ *     arrives.
+ * @param running Set to the number of operations still running, or NULL.
+ *
+ * @return INSTPROXY_E_SUCCESS on success, INSTPROXY_E_INVALID_ARG when
+ *     aggregator is NULL, or INSTPROXY_E_UNKNOWN_ERROR if waiting failed.
+ */
+instproxy_error_t instproxy_aggregator_poll(instproxy_aggregator_t aggregator, int timeout, uint32_t *running)
+{
+	if (!aggregator)
+		return INSTPROXY_E_INVALID_ARG;
+
+	struct pollfd *fds = NULL;
+	struct instproxy_aggregator_entry **polled = NULL;
+	guint count = g_slist_length(aggregator->entries);
+	guint nfds = 0;
+	guint i;
+	GSList *node;
+	int res;
+
+	fds = (struct pollfd*)malloc(sizeof(struct pollfd) * (count + 1));
+	polled = (struct instproxy_aggregator_entry**)malloc(sizeof(struct instproxy_aggregator_entry*) * (count + 1));
+	for (node = aggregator->entries; node; node = node->next) {
+		struct instproxy_aggregator_entry *entry = (struct instproxy_aggregator_entry*)node->data;
+		if (entry->progress.complete)
+			continue;
+		fds[nfds].fd = instproxy_get_status_fd(entry->client);
+		fds[nfds].events = POLLIN;
+		fds[nfds].revents = 0;
+		polled[nfds] = entry;
+		if (property_list_service_frame_ready(entry->client->parent)) {
+			/* already complete, do not wait */
+			timeout = 0;
+		}
+		nfds++;
+	}
+
+	res = 0;
+	if (nfds > 0) {
+		do {
+			res = poll(fds, nfds, timeout);
+		} while (res < 0 && errno == EINTR);
+	}
+
+	if (res < 0) {
+		debug_info("poll failed: %s", strerror(errno));
+		free(fds);
+		free(polled);
+		return INSTPROXY_E_UNKNOWN_ERROR;
+	}
+
+	for (i = 0; i < nfds; i++) {
+		struct instproxy_aggregator_entry *entry = polled[i];
+		/* a readable descriptor might only hold part of an update; only
+		 * read complete ones so a slow device does not block the others.
+		 * A closed connection counts as complete to collect the error. */
+		while (!entry->progress.complete && property_list_service_frame_ready(entry->client->parent)) {
+			if (instproxy_read_status(entry->client, &entry->progress) == INSTPROXY_E_INVALID_ARG)
+				break;
+			if (aggregator->progress_cb) {
+				aggregator->progress_cb(entry->client, &entry->progress, aggregator->user_data);
+			}
+		}
+	}
+	free(fds);
+	free(polled);
+
+	if (running) {
+		instproxy_progress_summary_t summary;
+		instproxy_aggregator_get_summary(aggregator, &summary);
+		*running = summary.running;
+	}
+
+	return INSTPROXY_E_SUCCESS;
+}
+
+/**
+ * Summarizes the progress of all operations followed by an aggregator.
+ *
+ * @param aggregator The progress aggregator
+ * @param summary Filled with the summary.
+ *
+ * @return INSTPROXY_E_SUCCESS on success, or INSTPROXY_E_INVALID_ARG when a
+ *     parameter is NULL.
+ */
+instproxy_error_t instproxy_aggregator_get_summary(instproxy_aggregator_t aggregator, instproxy_progress_summary_t *summary)
+{
+	GSList *node;
+	uint32_t percent_sum = 0;
+
+	if (!aggregator || !summary)
+		return INSTPROXY_E_INVALID_ARG;
+
+	memset(summary, 0, sizeof(instproxy_progress_summary_t));
+	for (node = aggregator->entries; node; node = node->next) {
+		struct instproxy_aggregator_entry *entry = (struct instproxy_aggregator_entry*)node->data;
+		summary->operations++;
+		if (!entry->progress.complete) {
+			summary->running++;
+			if (entry->progress.percent > 0)
+				percent_sum += entry->progress.percent;
+		} else {
+			percent_sum += 100;
+			if (entry->progress.result == INSTPROXY_E_SUCCESS)
+				summary->succeeded++;
+			else
+				summary->failed++;
+		}
+	}
+	summary->percent = summary->operations ? (int)(percent_sum / summary->operations) : 100;
+
+	return INSTPROXY_E_SUCCESS;
+}
+
+/**
+ * Internally used function that persists the reported snapshot of an
+ * inventory.
+ */
+static void instproxy_inventory_save(instproxy_inventory_t inventory)
+{
+	char *data = NULL;
+	uint32_t size = 0;
+
+	if (!inventory->uuid)
+		return;
+
+	plist_to_bin(inventory->reported, &data, &size);
+	if (data) {
+		gnutls_datum_t datum = { (unsigned char*)data, size };
+		userpref_set_app_inventory(inventory->uuid, datum);
+		free(data);
+	}
+}
+
+/**
+ * Creates an application inventory for a device. The inventory keeps a
+ * snapshot of the installed applications, keyed by bundle identifier with
+ * their version, and reports what changed between snapshots.
+ *
+ * @param uuid The UUID of the device. When given, the last reported
+ *     snapshot is stored on disk and restored here, so changes are also
+ *     detected across restarts. May be NULL.
+ * @param inventory Pointer that will be set to the new inventory.
+ *
+ * @return INSTPROXY_E_SUCCESS on success, or INSTPROXY_E_INVALID_ARG when
+ *     inventory is NULL.
+ */
+instproxy_error_t instproxy_inventory_new(const char *uuid, instproxy_inventory_t *inventory)
+{
+	if (!inventory)
+		return INSTPROXY_E_INVALID_ARG;
+
+	/* initialize GThreads if not already initialized */
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+
+	instproxy_inventory_t inventory_loc = (instproxy_inventory_t) malloc(sizeof(struct instproxy_inventory_private));
+	inventory_loc->uuid = uuid ? strdup(uuid) : NULL;
+	inventory_loc->mutex = g_mutex_new();
+	inventory_loc->current = NULL;
+	inventory_loc->reported = NULL;
+	inventory_loc->refresher = NULL;
+	inventory_loc->refresh_cond = g_cond_new();
+	inventory_loc->refresh_stop = 0;
+	inventory_loc->refresh_interval = 0;
+	inventory_loc->device = NULL;
+	inventory_loc->changed_cb = NULL;
+	inventory_loc->user_data = NULL;
+
+	if (uuid) {
+		gnutls_datum_t datum = { NULL, 0 };
+		if (userpref_get_app_inventory(uuid, &datum) == USERPREF_E_SUCCESS) {
+			plist_from_bin((const char*)datum.data, datum.size, &inventory_loc->reported);
+			g_free(datum.data);
+			if (inventory_loc->reported && (plist_get_node_type(inventory_loc->reported) != PLIST_DICT)) {
+				plist_free(inventory_loc->reported);
+				inventory_loc->reported = NULL;
+			}
+		}
+	}
+	if (!inventory_loc->reported) {
+		inventory_loc->reported = plist_new_dict();
+	}
+
+	*inventory = inventory_loc;
+	return INSTPROXY_E_SUCCESS;
+}
+
+/**
+ * Frees an application inventory, stopping the background refresh first.
+ *
+ * @param inventory The inventory to free.
+ *
+ * @return INSTPROXY_E_SUCCESS on success, or INSTPROXY_E_INVALID_ARG when
+ *     inventory is NULL.
+ */
+instproxy_error_t instproxy_inventory_free(instproxy_inventory_t inventory)
+{
+	if (!inventory)
+		return INSTPROXY_E_INVALID_ARG;
+
+	instproxy_inventory_stop_refresh(inventory);
+
+	if (inventory->current)
+		plist_free(inventory->current);
+	if (inventory->reported)
+		plist_free(inventory->reported);
+	if (inventory->uuid)
+		free(inventory->uuid);
+	g_cond_free(inventory->refresh_cond);
+	g_mutex_free(inventory->mutex);
+	free(inventory);
+
+	return INSTPROXY_E_SUCCESS;
+}
+
+/**
+ * Internally used browse callback adding app info to a snapshot.
+ */
+static void instproxy_inventory_add_apps(const instproxy_app_info_t *apps, uint32_t count, void *user_data)
+{
+	plist_t snapshot = (plist_t)user_data;
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		if (apps[i].bundle_id) {
+			plist_dict_insert_item(snapshot, apps[i].bundle_id, plist_new_string(apps[i].version ? apps[i].version : ""));
+		}
+	}
+}
+
+/**
+ * Internally used function that checks whether two snapshots differ.
+ */
+static int instproxy_inventory_differs(plist_t a, plist_t b)
+{
+	plist_dict_iter iter = NULL;
+	char *key = NULL;
+	plist_t item = NULL;
+	int differs = 0;
+
+	if (!a || !b)
+		return (a != b);
+	if (plist_dict_get_size(a) != plist_dict_get_size(b))
+		return 1;
+
+	plist_dict_new_iter(a, &iter);
+	if (!iter)
+		return 1;
+	do {
+		key = NULL;
+		item = NULL;
+		plist_dict_next_item(a, iter, &key, &item);
+		if (key && item) {
+			plist_t other = plist_dict_get_item(b, key);
+			if (!other || !plist_compare_node_value(item, other))
+				differs = 1;
+		}
+		free(key);
+	} while (item && !differs);
+	free(iter);
+
+	return differs;
+}
+
+/**
+ * Browses the applications installed on the device of client and makes the
+ * result the current snapshot of the inventory. Only the bundle identifier,
+ * version and size of each application are requested from the device.
+ *
+ * @param inventory The application inventory
+ * @param client The connected installation_proxy client
+ *
+ * @return INSTPROXY_E_SUCCESS on success, INSTPROXY_E_INVALID_ARG when a
+ *     parameter is NULL, or an error if browsing failed. The snapshot is
+ *     left unchanged on error.
+ */
+instproxy_error_t instproxy_inventory_refresh(instproxy_inventory_t inventory, instproxy_client_t client)
+{
+	if (!inventory || !client)
+		return INSTPROXY_E_INVALID_ARG;
+
+	plist_t snapshot = plist_new_dict();
+	instproxy_error_t res = instproxy_browse_app_info(client, NULL, instproxy_inventory_add_apps, snapshot);
+	if (res != INSTPROXY_E_SUCCESS) {
+		plist_free(snapshot);
+		return res;
+	}
+
+	g_mutex_lock(inventory->mutex);
+	if (inventory->current)
+		plist_free(inventory->current);
+	inventory->current = snapshot;
+	g_mutex_unlock(inventory->mutex);
+
+	return INSTPROXY_E_SUCCESS;
+}
+
+/**
+ * Internally used function appending a change to an array.
+ */
+static void instproxy_inventory_append_change(GArray *changes, enum instproxy_inventory_change_type type, const char *bundle_id, plist_t old_version, plist_t new_version)
+{
+	instproxy_inventory_change_t change;
+
+	change.type = type;
+	change.bundle_id = strdup(bundle_id);
+	change.old_version = NULL;
+	change.new_version = NULL;
+	if (old_version)
+		plist_get_string_val(old_version, &change.old_version);
+	if (new_version)
+		plist_get_string_val(new_version, &change.new_version);
+	g_array_append_val(changes, change);
+}
+
+/**
+ * Returns what changed between the snapshot reported by the previous call
+ * and the current snapshot, then makes the current snapshot the reported
+ * one. Without a previous snapshot every application is reported as
+ * installed.
+ *
+ * @param inventory The application inventory
+ * @param changes Pointer that will be set to an array of changes, or NULL if
+ *     nothing changed. Free it with instproxy_inventory_changes_free.
+ * @param count Pointer that will be set to the number of changes.
+ *
+ * @return INSTPROXY_E_SUCCESS on success, or INSTPROXY_E_INVALID_ARG when a
+ *     parameter is NULL or no snapshot was taken yet.
+ */
+instproxy_error_t instproxy_inventory_get_changes(instproxy_inventory_t inventory, instproxy_inventory_change_t **changes, uint32_t *count)
+{
+	if (!inventory || !changes || !count)
+		return INSTPROXY_E_INVALID_ARG;
+
+	plist_dict_iter iter = NULL;
+	char *key = NULL;
+	plist_t item = NULL;
+	GArray *list = g_array_new(FALSE, FALSE, sizeof(instproxy_inventory_change_t));
+
+	g_mutex_lock(inventory->mutex);
+	if (!inventory->current) {
+		g_mutex_unlock(inventory->mutex);
+		g_array_free(list, TRUE);
+		return INSTPROXY_E_INVALID_ARG;
+	}
+
+	/* removed or changed since the last report */
+	plist_dict_new_iter(inventory->reported, &iter);
+	if (iter) {
+		do {
+			key = NULL;
+			item = NULL;
+			plist_dict_next_item(inventory->reported, iter, &key, &item);
+			if (key && item) {
+				plist_t now = plist_dict_get_item(inventory->current, key);
+				if (!now) {
+					instproxy_inventory_append_change(list, INSTPROXY_APP_REMOVED, key, item, NULL);
+				} else if (!plist_compare_node_value(item, now)) {
+					instproxy_inventory_append_change(list, INSTPROXY_APP_UPGRADED, key, item, now);
+				}
+			}
+			free(key);
+		} while (item);
+		free(iter);
+	}
+
+	/* new since the last report */
+	iter = NULL;
+	plist_dict_new_iter(inventory->current, &iter);
+	if (iter) {
+		do {
+			key = NULL;
+			item = NULL;
+			plist_dict_next_item(inventory->current, iter, &key, &item);
+			if (key && item && !plist_dict_get_item(inventory->reported, key)) {
+				instproxy_inventory_append_change(list, INSTPROXY_APP_INSTALLED, key, NULL, item);
+			}
+			free(key);
+		} while (item);
+		free(iter);
+	}
+
+	if (list->len > 0) {
+		plist_free(inventory->reported);
+		inventory->reported = plist_copy(inventory->current);
+		instproxy_inventory_save(inventory);
+	}
+	g_mutex_unlock(inventory->mutex);
+
+	*count = list->len;
+	if (list->len > 0) {
+		*changes = (instproxy_inventory_change_t*)g_array_free(list, FALSE);
+	} else {
+		*changes = NULL;
+		g_array_free(list, TRUE);
+	}
+
+	return INSTPROXY_E_SUCCESS;
+}
+
+/**
+ * Frees an array of changes returned by instproxy_inventory_get_changes.
+ *
+ * @param changes The array to free, may be NULL.
+ * @param count The number of changes in the array.
+ */
+void instproxy_inventory_changes_free(instproxy_inventory_change_t *changes, uint32_t count)
+{
+	uint32_t i;
+
+	if (!changes)
+		return;
+
+	for (i = 0; i < count; i++) {
+		free(changes[i].bundle_id);
+		free(changes[i].old_version);
+		free(changes[i].new_version);
+	}
+	g_free(changes);
+}
+
+/**
+ * Internally used function that connects to installation_proxy on the
+ * device of the inventory and refreshes the snapshot.
+ */
+static instproxy_error_t instproxy_inventory_refresh_device(instproxy_inventory_t inventory)
+{
+	lockdownd_client_t lockdown = NULL;
+	instproxy_client_t client = NULL;
+	uint16_t port = 0;
+	instproxy_error_t res;
+
+	if (lockdownd_client_new_with_handshake(inventory->device, &lockdown, "libimobiledevice") != LOCKDOWN_E_SUCCESS) {
+		return INSTPROXY_E_CONN_FAILED;
+	}
+	if ((lockdownd_start_service(lockdown, "com.apple.mobile.installation_proxy", &port) != LOCKDOWN_E_SUCCESS) || !port) {
+		lockdownd_client_free(lockdown);
+		return INSTPROXY_E_CONN_FAILED;
+	}
+	lockdownd_client_free(lockdown);
+
+	res = instproxy_client_new(inventory->device, port, &client);
+	if (res != INSTPROXY_E_SUCCESS)
+		return res;
+	res = instproxy_inventory_refresh(inventory, client);
+	instproxy_client_free(client);
+
+	return res;
+}
+
+/**
+ * Internally used thread function refreshing an inventory periodically.
+ */
+static gpointer instproxy_inventory_refresher(gpointer arg)
+{
+	instproxy_inventory_t inventory = (instproxy_inventory_t)arg;
+
+	g_mutex_lock(inventory->mutex);
+	while (!inventory->refresh_stop) {
+		plist_t before = inventory->current ? plist_copy(inventory->current) : NULL;
+		g_mutex_unlock(inventory->mutex);
+
+		if (instproxy_inventory_refresh_device(inventory) == INSTPROXY_E_SUCCESS) {
+			g_mutex_lock(inventory->mutex);
+			int changed = instproxy_inventory_differs(before, inventory->current);
+			g_mutex_unlock(inventory->mutex);
+			if (changed && inventory->changed_cb) {
+				inventory->changed_cb(inventory, inventory->user_data);
+			}
+		} else {
+			debug_info("refreshing the application inventory failed");
+		}
+		if (before)
+			plist_free(before);
+
+		GTimeVal until;
+		g_get_current_time(&until);
+		g_time_val_add(&until, (glong)inventory->refresh_interval * G_USEC_PER_SEC);
+		g_mutex_lock(inventory->mutex);
+		while (!inventory->refresh_stop) {
+			if (!g_cond_timed_wait(inventory->refresh_cond, inventory->mutex, &until))
+				break;
+		}
+	}
+	g_mutex_unlock(inventory->mutex);
+
+	return NULL;
+}
+
+/**
+ * Starts refreshing the inventory in the background. A thread connects to
+ * the device right away and then every interval seconds, and calls
+ * changed_cb whenever the installed applications differ from the previous
+ * refresh. The changes themselves are fetched with
+ * instproxy_inventory_get_changes.
+ *
+ * @param inventory The application inventory
+ * @param device The device to refresh from. It has to stay valid until the
+ *     refresh is stopped.
+ * @param interval Seconds between refreshes.
+ * @param changed_cb Called from the refresh thread when something changed,
+ *     or NULL.
+ * @param user_data Pointer passed to changed_cb.
+ *
+ * @return INSTPROXY_E_SUCCESS on success, INSTPROXY_E_INVALID_ARG when a
+ *     parameter is invalid, INSTPROXY_E_OP_IN_PROGRESS if a refresh is
+ *     already running, or INSTPROXY_E_UNKNOWN_ERROR if the thread could not
+ *     be created.
+ */
+instproxy_error_t instproxy_inventory_start_refresh(instproxy_inventory_t inventory, idevice_t device, unsigned int interval, instproxy_inventory_cb_t changed_cb, void *user_data)
+{
+	if (!inventory || !device || (interval == 0))
+		return INSTPROXY_E_INVALID_ARG;
+	if (inventory->refresher)
+		return INSTPROXY_E_OP_IN_PROGRESS;
+
+	inventory->device = device;
+	inventory->refresh_interval = interval;
+	inventory->changed_cb = changed_cb;
+	inventory->user_data = user_data;
+	inventory->refresh_stop = 0;
+
+	inventory->refresher = g_thread_create(instproxy_inventory_refresher, inventory, TRUE, NULL);
+	if (!inventory->refresher)
+		return INSTPROXY_E_UNKNOWN_ERROR;
+
+	return INSTPROXY_E_SUCCESS;
+}
+
+/**
+ * Stops the background refresh of an inventory, waiting for a refresh in
+ * progress to finish.
+ *
+ * @param inventory The application inventory
+ *
+ * @return INSTPROXY_E_SUCCESS on success, or INSTPROXY_E_INVALID_ARG when
+ *     inventory is NULL.
+ */
+instproxy_error_t instproxy_inventory_stop_refresh(instproxy_inventory_t inventory)
+{
+	if (!inventory)
+		return INSTPROXY_E_INVALID_ARG;
+	if (!inventory->refresher)
+		return INSTPROXY_E_SUCCESS;
+
+	g_mutex_lock(inventory->mutex);
+	inventory->refresh_stop = 1;
+	g_cond_signal(inventory->refresh_cond);
+	g_mutex_unlock(inventory->mutex);
+
+	g_thread_join(inventory->refresher);
+	inventory->refresher = NULL;
+	inventory->device = NULL;
+
+	return INSTPROXY_E_SUCCESS;
+}
+
 /**
  * Create a new client_options plist.
  *
@@ -763,6 +1722,34 @@ void instproxy_client_options_add(plist_t client_options, ...)
 	va_end(args);
 }
 
+/**
+ * Set the attributes the device should return for each application when
+ * browsing, replacing any set before. Requesting only what is needed makes
+ * listing large numbers of applications considerably cheaper.
+ *
+ * @param client_options The client options to modify.
+ * @param ... Attribute names like "CFBundleIdentifier", NULL
+ */
+void instproxy_client_options_set_return_attributes(plist_t client_options, ...)
+{
+	if (!client_options)
+		return;
+	plist_t attributes = plist_new_array();
+	va_list args;
+	va_start(args, client_options);
+	char *arg = va_arg(args, char*);
+	while (arg) {
+		plist_array_append_item(attributes, plist_new_string(arg));
+		arg = va_arg(args, char*);
+	}
+	va_end(args);
+
+	if (plist_dict_get_item(client_options, "ReturnAttributes")) {
+		plist_dict_remove_item(client_options, "ReturnAttributes");
+	}
+	plist_dict_insert_item(client_options, "ReturnAttributes", attributes);
+}
+
 /**
  * Free client_options plist.
  *
@@ -30,6 +30,29 @@ struct instproxy_client_private {
 	property_list_service_client_t parent;
 	GMutex *mutex;
 	GThread *status_updater;
+	enum instproxy_status_mode status_mode;
+	int operation_active;
+	instproxy_progress_t progress;
+};
+
+struct instproxy_aggregator_private {
+	GSList *entries;
+	instproxy_progress_cb_t progress_cb;
+	void *user_data;
+};
+
+struct instproxy_inventory_private {
+	char *uuid;
+	GMutex *mutex;
+	plist_t current;
+	plist_t reported;
+	GThread *refresher;
+	GCond *refresh_cond;
+	int refresh_stop;
+	unsigned int refresh_interval;
+	idevice_t device;
+	instproxy_inventory_cb_t changed_cb;
+	void *user_data;
 };
 
 #endif
@@ -21,6 +21,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 #include <glib.h>
 #include <libtasn1.h>
 #include <gnutls/x509.h>
@@ -35,6 +36,41 @@
 #define RESULT_SUCCESS 0
 #define RESULT_FAILURE 1
 
+/** Default lifetime of a cached pair validation in seconds. */
+#define HANDSHAKE_CACHE_DEFAULT_TTL 3600
+
+static unsigned int handshake_cache_ttl = HANDSHAKE_CACHE_DEFAULT_TTL;
+
+/** Shared lockdownd client of a device, see lockdownd_client_new_shared.
+ * While the handshake runs the entry is a placeholder that other callers
+ * for the same device wait on. */
+struct lockdownd_shared_entry {
+	lockdownd_client_t client;
+	GCond *ready;
+	int pending;
+	int waiters;
+	lockdownd_error_t error;
+};
+
+/** Shared lockdownd client entries by device uuid. */
+static GHashTable *shared_clients = NULL;
+static GStaticMutex shared_clients_mutex = G_STATIC_MUTEX_INIT;
+
+/**
+ * Internally used function that frees a shared client entry.
+ */
+static void lockdownd_shared_entry_free(struct lockdownd_shared_entry *entry)
+{
+	g_cond_free(entry->ready);
+	free(entry);
+}
+
+/** Name under which the global domain is kept in the value cache. */
+#define VALUE_CACHE_GLOBAL_DOMAIN "Global"
+
+/** Protects the value caches of all clients. */
+static GStaticMutex value_cache_mutex = G_STATIC_MUTEX_INIT;
+
 const ASN1_ARRAY_TYPE pkcs1_asn1_tab[] = {
 	{"PKCS1", 536872976, 0},
 	{0, 1073741836, 0},
@@ -121,6 +157,52 @@ static void plist_dict_add_label(plist_t plist, const char *label)
 	}
 }
 
+/**
+ * Locks a lockdownd client, used for thread safety.
+ *
+ * @param client lockdownd client to lock
+ */
+static void lockdownd_lock(lockdownd_client_t client)
+{
+	g_mutex_lock(client->mutex);
+}
+
+/**
+ * Unlocks a lockdownd client, used for thread safety.
+ *
+ * @param client lockdownd client to unlock
+ */
+static void lockdownd_unlock(lockdownd_client_t client)
+{
+	g_mutex_unlock(client->mutex);
+}
+
+/**
+ * Sends a request to lockdownd and receives the reply while holding the
+ * client lock, so requests issued from different threads on the same
+ * client do not interleave.
+ *
+ * @param client The lockdown client
+ * @param request The request plist to send
+ * @param reply Pointer that will be set to the reply plist
+ *
+ * @return LOCKDOWN_E_SUCCESS on success, or an error code from sending or
+ *  receiving otherwise
+ */
+static lockdownd_error_t lockdownd_request(lockdownd_client_t client, plist_t request, plist_t *reply)
+{
+	lockdownd_error_t ret;
+
+	lockdownd_lock(client);
+	ret = lockdownd_send(client, request);
+	if (ret == LOCKDOWN_E_SUCCESS) {
+		ret = lockdownd_receive(client, reply);
+	}
+	lockdownd_unlock(client);
+
+	return ret;
+}
+
 /**
  * Closes the lockdownd session by sending the StopSession request.
  *
@@ -189,6 +271,20 @@ lockdownd_error_t lockdownd_client_free(lockdownd_client_t client)
 		return LOCKDOWN_E_INVALID_ARG;
 	lockdownd_error_t ret = LOCKDOWN_E_UNKNOWN_ERROR;
 
+	if (client->shared_refs > 0) {
+		g_static_mutex_lock(&shared_clients_mutex);
+		if (--client->shared_refs > 0) {
+			g_static_mutex_unlock(&shared_clients_mutex);
+			return LOCKDOWN_E_SUCCESS;
+		}
+		struct lockdownd_shared_entry *entry = (struct lockdownd_shared_entry*)g_hash_table_lookup(shared_clients, client->uuid);
+		if (entry && (entry->client == client)) {
+			g_hash_table_remove(shared_clients, client->uuid);
+			lockdownd_shared_entry_free(entry);
+		}
+		g_static_mutex_unlock(&shared_clients_mutex);
+	}
+
 	if (client->session_id)
 		lockdownd_stop_session(client, client->session_id);
 
@@ -206,6 +302,15 @@ lockdownd_error_t lockdownd_client_free(lockdownd_client_t client)
 	if (client->label) {
 		free(client->label);
 	}
+	if (client->mutex) {
+		g_mutex_free(client->mutex);
+	}
+	if (client->value_cache) {
+		plist_free(client->value_cache);
+	}
+	if (client->build_version) {
+		free(client->build_version);
+	}
 
 	free(client);
 	return ret;
@@ -228,6 +333,27 @@ void lockdownd_client_set_label(lockdownd_client_t client, const char *label)
 	}
 }
 
+/**
+ * Sets the plist encoding used for requests to lockdownd.
+ * By default the encoding from the internal service encoding table is used.
+ *
+ * @param client The lockdown client
+ * @param encoding IDEVICE_PLIST_ENCODING_XML or IDEVICE_PLIST_ENCODING_BINARY
+ *
+ * @return LOCKDOWN_E_SUCCESS on success, LOCKDOWN_E_INVALID_ARG when client
+ *  is NULL or encoding is invalid
+ */
+lockdownd_error_t lockdownd_client_set_plist_encoding(lockdownd_client_t client, enum idevice_plist_encoding encoding)
+{
+	if (!client)
+		return LOCKDOWN_E_INVALID_ARG;
+
+	if (property_list_service_set_encoding(client->parent, encoding) != PROPERTY_LIST_SERVICE_E_SUCCESS)
+		return LOCKDOWN_E_INVALID_ARG;
+
+	return LOCKDOWN_E_SUCCESS;
+}
+
 /**
  * Receives a plist from lockdownd.
  *
@@ -275,7 +401,7 @@ lockdownd_error_t lockdownd_send(lockdownd_client_t client, plist_t plist)
 	lockdownd_error_t ret = LOCKDOWN_E_SUCCESS;
 	idevice_error_t err;
 
-	err = property_list_service_send_xml_plist(client->parent, plist);
+	err = property_list_service_send_plist(client->parent, plist);
 	if (err != PROPERTY_LIST_SERVICE_E_SUCCESS) {
 		ret = LOCKDOWN_E_UNKNOWN_ERROR;
 	}
@@ -330,7 +456,8 @@ lockdownd_error_t lockdownd_query_type(lockdownd_client_t client, char **type)
 }
 
 /**
- * Retrieves a preferences plist using an optional domain and/or key name.
+ * Internally used function that queries a value from lockdownd, bypassing
+ * the value cache.
  *
  * @param client An initialized lockdownd client.
  * @param domain The domain to query on or NULL for global domain
@@ -339,7 +466,7 @@ lockdownd_error_t lockdownd_query_type(lockdownd_client_t client, char **type)
  *
  * @return LOCKDOWN_E_SUCCESS on success, NP_E_INVALID_ARG when client is NULL
  */
-lockdownd_error_t lockdownd_get_value(lockdownd_client_t client, const char *domain, const char *key, plist_t *value)
+static lockdownd_error_t lockdownd_query_value(lockdownd_client_t client, const char *domain, const char *key, plist_t *value)
 {
 	if (!client)
 		return LOCKDOWN_E_INVALID_ARG;
@@ -358,17 +485,13 @@ lockdownd_error_t lockdownd_get_value(lockdownd_client_t client, const char *dom
 	}
 	plist_dict_insert_item(dict,"Request", plist_new_string("GetValue"));
 
-	/* send to device */
-	ret = lockdownd_send(client, dict);
+	/* send to device and get its answer */
+	plist_t reply = NULL;
+	ret = lockdownd_request(client, dict, &reply);
 
 	plist_free(dict);
-	dict = NULL;
-
-	if (ret != LOCKDOWN_E_SUCCESS)
-		return ret;
+	dict = reply;
 
-	/* Now get device's answer */
-	ret = lockdownd_receive(client, &dict);
 	if (ret != LOCKDOWN_E_SUCCESS)
 		return ret;
 
@@ -392,6 +515,407 @@ lockdownd_error_t lockdownd_get_value(lockdownd_client_t client, const char *dom
 	return ret;
 }
 
+/**
+ * Internally used function that writes the value cache of the client to
+ * disk if it is persistent.
+ *
+ * @param client The lockdownd client
+ */
+static void lockdownd_value_cache_save(lockdownd_client_t client)
+{
+	plist_t dict = NULL;
+	char *data = NULL;
+	uint32_t size = 0;
+
+	if (client->value_cache_mode != LOCKDOWN_VALUE_CACHE_PERSISTENT || !client->uuid || !client->build_version)
+		return;
+
+	g_static_mutex_lock(&value_cache_mutex);
+	if (client->value_cache) {
+		dict = plist_new_dict();
+		plist_dict_insert_item(dict, "BuildVersion", plist_new_string(client->build_version));
+		plist_dict_insert_item(dict, "Domains", plist_copy(client->value_cache));
+	}
+	g_static_mutex_unlock(&value_cache_mutex);
+
+	if (!dict)
+		return;
+
+	plist_to_bin(dict, &data, &size);
+	plist_free(dict);
+	if (data) {
+		gnutls_datum_t datum = { (unsigned char*)data, size };
+		userpref_set_value_cache(client->uuid, datum);
+		free(data);
+	}
+}
+
+/**
+ * Internally used function that loads a persisted value cache for the
+ * device of the client. It is only used if it was written for the same
+ * BuildVersion the device is running now.
+ *
+ * @param client The lockdownd client
+ */
+static void lockdownd_value_cache_load(lockdownd_client_t client)
+{
+	gnutls_datum_t datum = { NULL, 0 };
+	plist_t dict = NULL;
+
+	if (!client->uuid || !client->build_version)
+		return;
+
+	if (userpref_get_value_cache(client->uuid, &datum) != USERPREF_E_SUCCESS)
+		return;
+
+	plist_from_bin((const char*)datum.data, datum.size, &dict);
+	g_free(datum.data);
+	if (!dict)
+		return;
+
+	plist_t build_node = plist_dict_get_item(dict, "BuildVersion");
+	plist_t domains = plist_dict_get_item(dict, "Domains");
+	char *build_version = NULL;
+	if (build_node && (plist_get_node_type(build_node) == PLIST_STRING)) {
+		plist_get_string_val(build_node, &build_version);
+	}
+	if (build_version && domains && (plist_get_node_type(domains) == PLIST_DICT) && !strcmp(build_version, client->build_version)) {
+		debug_info("using persisted values for %s (%s)", client->uuid, build_version);
+		g_static_mutex_lock(&value_cache_mutex);
+		if (client->value_cache)
+			plist_free(client->value_cache);
+		client->value_cache = plist_copy(domains);
+		g_static_mutex_unlock(&value_cache_mutex);
+	}
+	free(build_version);
+	plist_free(dict);
+}
+
+/**
+ * Internally used function that looks up a value in the cached domain.
+ *
+ * @note Must be called with value_cache_mutex held.
+ *
+ * @param client The lockdownd client
+ * @param domain The domain to look up or NULL for global domain
+ * @param key The key to look up or NULL for the whole domain
+ * @param value Set to a copy of the cached value on a hit
+ *
+ * @return 1 if the value was found, 0 otherwise
+ */
+static int lockdownd_value_cache_lookup(lockdownd_client_t client, const char *domain, const char *key, plist_t *value)
+{
+	plist_t domain_node;
+	plist_t value_node;
+
+	if (!client->value_cache)
+		return 0;
+
+	domain_node = plist_dict_get_item(client->value_cache, domain ? domain : VALUE_CACHE_GLOBAL_DOMAIN);
+	if (!domain_node)
+		return 0;
+
+	value_node = key ? plist_dict_get_item(domain_node, key) : domain_node;
+	if (!value_node)
+		return 0;
+
+	*value = plist_copy(value_node);
+	return 1;
+}
+
+/**
+ * Internally used function that drops a domain from the value cache after
+ * a value in it was changed.
+ *
+ * @param client The lockdownd client
+ * @param domain The changed domain or NULL for global domain
+ */
+static void lockdownd_value_cache_invalidate(lockdownd_client_t client, const char *domain)
+{
+	int removed = 0;
+
+	if (client->value_cache_mode == LOCKDOWN_VALUE_CACHE_OFF)
+		return;
+
+	g_static_mutex_lock(&value_cache_mutex);
+	if (client->value_cache && plist_dict_get_item(client->value_cache, domain ? domain : VALUE_CACHE_GLOBAL_DOMAIN)) {
+		plist_dict_remove_item(client->value_cache, domain ? domain : VALUE_CACHE_GLOBAL_DOMAIN);
+		removed = 1;
+	}
+	g_static_mutex_unlock(&value_cache_mutex);
+
+	if (removed)
+		lockdownd_value_cache_save(client);
+}
+
+/**
+ * Retrieves a preferences plist using an optional domain and/or key name.
+ *
+ * If the value cache is enabled for the client, the whole domain is
+ * fetched on first use and later lookups are served from memory.
+ *
+ * @see lockdownd_client_set_value_cache
+ *
+ * @param client An initialized lockdownd client.
+ * @param domain The domain to query on or NULL for global domain
+ * @param key The key name to request or NULL to query for all keys
+ * @param value A plist node representing the result value node
+ *
+ * @return LOCKDOWN_E_SUCCESS on success, NP_E_INVALID_ARG when client is NULL
+ */
+lockdownd_error_t lockdownd_get_value(lockdownd_client_t client, const char *domain, const char *key, plist_t *value)
+{
+	if (!client)
+		return LOCKDOWN_E_INVALID_ARG;
+
+	plist_t domain_values = NULL;
+	int found;
+
+	if (client->value_cache_mode == LOCKDOWN_VALUE_CACHE_OFF)
+		return lockdownd_query_value(client, domain, key, value);
+
+	g_static_mutex_lock(&value_cache_mutex);
+	found = lockdownd_value_cache_lookup(client, domain, key, value);
+	g_static_mutex_unlock(&value_cache_mutex);
+	if (found)
+		return LOCKDOWN_E_SUCCESS;
+
+	/* fetch the whole domain once, unless it is cached but lacks the key */
+	g_static_mutex_lock(&value_cache_mutex);
+	found = (client->value_cache && plist_dict_get_item(client->value_cache, domain ? domain : VALUE_CACHE_GLOBAL_DOMAIN));
+	g_static_mutex_unlock(&value_cache_mutex);
+
+	if (!found && (lockdownd_query_value(client, domain, NULL, &domain_values) == LOCKDOWN_E_SUCCESS) && domain_values) {
+		if (plist_get_node_type(domain_values) == PLIST_DICT) {
+			g_static_mutex_lock(&value_cache_mutex);
+			if (!client->value_cache)
+				client->value_cache = plist_new_dict();
+			if (!plist_dict_get_item(client->value_cache, domain ? domain : VALUE_CACHE_GLOBAL_DOMAIN)) {
+				plist_dict_insert_item(client->value_cache, domain ? domain : VALUE_CACHE_GLOBAL_DOMAIN, domain_values);
+				domain_values = NULL;
+			}
+			found = lockdownd_value_cache_lookup(client, domain, key, value);
+			g_static_mutex_unlock(&value_cache_mutex);
+			lockdownd_value_cache_save(client);
+		}
+		if (domain_values)
+			plist_free(domain_values);
+		if (found)
+			return LOCKDOWN_E_SUCCESS;
+	}
+
+	/* not part of the domain listing, ask for the key itself */
+	return lockdownd_query_value(client, domain, key, value);
+}
+
+/**
+ * Enables or disables caching of values retrieved with lockdownd_get_value.
+ *
+ * With caching enabled, the first lookup in a domain fetches all values of
+ * the domain, and later lookups in it are served from memory. A domain is
+ * dropped from the cache when a value in it is changed with
+ * lockdownd_set_value or lockdownd_remove_value on this client.
+ *
+ * A persistent cache is additionally stored on disk per device and reused
+ * by later clients as long as the device reports the same BuildVersion.
+ * It is meant for static properties like UniqueDeviceID or ProductType;
+ * values changed on the device itself are not noticed.
+ *
+ * @param client The lockdownd client
+ * @param mode LOCKDOWN_VALUE_CACHE_OFF, LOCKDOWN_VALUE_CACHE_MEMORY or
+ *  LOCKDOWN_VALUE_CACHE_PERSISTENT
+ *
+ * @return LOCKDOWN_E_SUCCESS on success, LOCKDOWN_E_INVALID_ARG when client
+ *  is NULL or mode is invalid, or an error code if the BuildVersion needed
+ *  for a persistent cache could not be retrieved.
+ */
+lockdownd_error_t lockdownd_client_set_value_cache(lockdownd_client_t client, enum lockdownd_value_cache_mode mode)
+{
+	if (!client)
+		return LOCKDOWN_E_INVALID_ARG;
+
+	lockdownd_error_t ret = LOCKDOWN_E_SUCCESS;
+
+	switch (mode) {
+	case LOCKDOWN_VALUE_CACHE_OFF:
+		g_static_mutex_lock(&value_cache_mutex);
+		client->value_cache_mode = mode;
+		if (client->value_cache) {
+			plist_free(client->value_cache);
+			client->value_cache = NULL;
+		}
+		g_static_mutex_unlock(&value_cache_mutex);
+		break;
+	case LOCKDOWN_VALUE_CACHE_MEMORY:
+		client->value_cache_mode = mode;
+		break;
+	case LOCKDOWN_VALUE_CACHE_PERSISTENT:
+		if (!client->uuid) {
+			ret = lockdownd_get_device_uuid(client, &client->uuid);
+			if (ret != LOCKDOWN_E_SUCCESS)
+				break;
+		}
+		if (!client->build_version) {
+			plist_t node = NULL;
+			ret = lockdownd_query_value(client, NULL, "BuildVersion", &node);
+			if (ret == LOCKDOWN_E_SUCCESS && node && (plist_get_node_type(node) == PLIST_STRING)) {
+				plist_get_string_val(node, &client->build_version);
+			}
+			if (node)
+				plist_free(node);
+			if (ret != LOCKDOWN_E_SUCCESS)
+				break;
+			if (!client->build_version) {
+				ret = LOCKDOWN_E_PLIST_ERROR;
+				break;
+			}
+		}
+		lockdownd_value_cache_load(client);
+		client->value_cache_mode = mode;
+		break;
+	default:
+		ret = LOCKDOWN_E_INVALID_ARG;
+		break;
+	}
+
+	return ret;
+}
+
+/**
+ * Internally used function that makes a client unusable after its stream
+ * got out of sync, so later requests fail instead of reading replies meant
+ * for earlier ones.
+ *
+ * @param client The lockdown client
+ */
+static void lockdownd_invalidate(lockdownd_client_t client)
+{
+	debug_info("connection out of sync, closing it");
+	if (client->parent) {
+		property_list_service_client_free(client->parent);
+		client->parent = NULL;
+	}
+}
+
+/**
+ * Internally used function that reads and discards replies to requests
+ * sent ahead. If that fails the client is invalidated.
+ *
+ * @param client The lockdown client
+ * @param count The number of replies to discard
+ */
+static void lockdownd_discard_replies(lockdownd_client_t client, uint32_t count)
+{
+	while (count > 0) {
+		plist_t dict = NULL;
+		if (lockdownd_receive(client, &dict) != LOCKDOWN_E_SUCCESS) {
+			if (dict)
+				plist_free(dict);
+			lockdownd_invalidate(client);
+			return;
+		}
+		plist_free(dict);
+		count--;
+	}
+}
+
+/**
+ * Retrieves several preferences values at once. All GetValue requests are
+ * written back-to-back before the replies are read in order, so the whole
+ * batch costs a single round trip to the device.
+ *
+ * @param client An initialized lockdownd client.
+ * @param pairs Array of domain/key pairs to query. A NULL domain queries the
+ *  global domain, a NULL key queries all keys of the domain.
+ * @param count Number of entries in pairs.
+ * @param values Array of count plists that will be set to a copy of the
+ *  value for each pair, or NULL if the device did not return a value for
+ *  that pair. The caller is responsible for freeing the values.
+ *
+ * @return LOCKDOWN_E_SUCCESS when all replies were received,
+ *  LOCKDOWN_E_INVALID_ARG when client, pairs or values is NULL, or an
+ *  error code from sending or receiving otherwise. After a failed receive
+ *  the remaining replies are read and discarded; if that is not possible
+ *  the connection is closed and the client has to be freed.
+ */
+lockdownd_error_t lockdownd_get_values(lockdownd_client_t client, const struct lockdownd_value_request *pairs, uint32_t count, plist_t *values)
+{
+	if (!client || !pairs || !values)
+		return LOCKDOWN_E_INVALID_ARG;
+
+	lockdownd_error_t ret = LOCKDOWN_E_SUCCESS;
+	plist_t *requests = NULL;
+	uint32_t i;
+
+	if (count == 0)
+		return LOCKDOWN_E_SUCCESS;
+
+	if (client->value_cache_mode != LOCKDOWN_VALUE_CACHE_OFF) {
+		/* each domain is fetched once and then served from the cache */
+		for (i = 0; i < count; i++) {
+			values[i] = NULL;
+		}
+		for (i = 0; (ret == LOCKDOWN_E_SUCCESS) && (i < count); i++) {
+			ret = lockdownd_get_value(client, pairs[i].domain, pairs[i].key, &values[i]);
+		}
+		return ret;
+	}
+
+	requests = (plist_t*)malloc(sizeof(plist_t) * count);
+	for (i = 0; i < count; i++) {
+		values[i] = NULL;
+		requests[i] = plist_new_dict();
+		plist_dict_add_label(requests[i], client->label);
+		if (pairs[i].domain) {
+			plist_dict_insert_item(requests[i], "Domain", plist_new_string(pairs[i].domain));
+		}
+		if (pairs[i].key) {
+			plist_dict_insert_item(requests[i], "Key", plist_new_string(pairs[i].key));
+		}
+		plist_dict_insert_item(requests[i], "Request", plist_new_string("GetValue"));
+	}
+
+	lockdownd_lock(client);
+
+	if (property_list_service_send_plists(client->parent, requests, count) != PROPERTY_LIST_SERVICE_E_SUCCESS) {
+		/* it is unknown how many requests made it to the device */
+		ret = LOCKDOWN_E_MUX_ERROR;
+		lockdownd_invalidate(client);
+	}
+
+	/* replies arrive in request order */
+	for (i = 0; (ret == LOCKDOWN_E_SUCCESS) && (i < count); i++) {
+		plist_t dict = NULL;
+		ret = lockdownd_receive(client, &dict);
+		if (ret != LOCKDOWN_E_SUCCESS) {
+			if (dict)
+				plist_free(dict);
+			/* keep later requests from reading these replies */
+			lockdownd_discard_replies(client, count - i - 1);
+			break;
+		}
+
+		if (lockdown_check_result(dict, "GetValue") == RESULT_SUCCESS) {
+			plist_t value_node = plist_dict_get_item(dict, "Value");
+			if (value_node) {
+				values[i] = plist_copy(value_node);
+			}
+		} else {
+			debug_info("no value for %s/%s", pairs[i].domain ? pairs[i].domain : "(global)", pairs[i].key ? pairs[i].key : "(all)");
+		}
+		plist_free(dict);
+	}
+
+	lockdownd_unlock(client);
+
+	for (i = 0; i < count; i++) {
+		plist_free(requests[i]);
+	}
+	free(requests);
+
+	return ret;
+}
+
 /**
  * Sets a preferences value using a plist and optional by domain and/or key name.
  *
@@ -423,23 +947,20 @@ lockdownd_error_t lockdownd_set_value(lockdownd_client_t client, const char *dom
 	plist_dict_insert_item(dict,"Request", plist_new_string("SetValue"));
 	plist_dict_insert_item(dict,"Value", value);
 
-	/* send to device */
-	ret = lockdownd_send(client, dict);
+	/* send to device and get its answer */
+	plist_t reply = NULL;
+	ret = lockdownd_request(client, dict, &reply);
 
 	plist_free(dict);
-	dict = NULL;
+	dict = reply;
 
-	if (ret != LOCKDOWN_E_SUCCESS)
-		return ret;
-
-	/* Now get device's answer */
-	ret = lockdownd_receive(client, &dict);
 	if (ret != LOCKDOWN_E_SUCCESS)
 		return ret;
 
 	if (lockdown_check_result(dict, "SetValue") == RESULT_SUCCESS) {
 		debug_info("success");
 		ret = LOCKDOWN_E_SUCCESS;
+		lockdownd_value_cache_invalidate(client, domain);
 	}
 
 	if (ret != LOCKDOWN_E_SUCCESS) {
@@ -481,23 +1002,20 @@ lockdownd_error_t lockdownd_remove_value(lockdownd_client_t client, const char *
 	}
 	plist_dict_insert_item(dict,"Request", plist_new_string("RemoveValue"));
 
-	/* send to device */
-	ret = lockdownd_send(client, dict);
+	/* send to device and get its answer */
+	plist_t reply = NULL;
+	ret = lockdownd_request(client, dict, &reply);
 
 	plist_free(dict);
-	dict = NULL;
+	dict = reply;
 
-	if (ret != LOCKDOWN_E_SUCCESS)
-		return ret;
-
-	/* Now get device's answer */
-	ret = lockdownd_receive(client, &dict);
 	if (ret != LOCKDOWN_E_SUCCESS)
 		return ret;
 
 	if (lockdown_check_result(dict, "RemoveValue") == RESULT_SUCCESS) {
 		debug_info("success");
 		ret = LOCKDOWN_E_SUCCESS;
+		lockdownd_value_cache_invalidate(client, domain);
 	}
 
 	if (ret != LOCKDOWN_E_SUCCESS) {
@@ -607,6 +1125,10 @@ lockdownd_error_t lockdownd_client_new(idevice_t device, lockdownd_client_t *cli
 	if (!client)
 		return LOCKDOWN_E_INVALID_ARG;
 
+	/* makes sure thread environment is available */
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+
 	lockdownd_error_t ret = LOCKDOWN_E_SUCCESS;
 
 	property_list_service_client_t plistclient = NULL;
@@ -614,6 +1136,7 @@ lockdownd_error_t lockdownd_client_new(idevice_t device, lockdownd_client_t *cli
 		debug_info("could not connect to lockdownd (device %s)", device->uuid);
 		return LOCKDOWN_E_MUX_ERROR;
 	}
+	property_list_service_set_encoding(plistclient, property_list_service_get_service_encoding("com.apple.mobile.lockdown"));
 
 	lockdownd_client_t client_loc = (lockdownd_client_t) malloc(sizeof(struct lockdownd_client_private));
 	client_loc->parent = plistclient;
@@ -621,6 +1144,11 @@ lockdownd_error_t lockdownd_client_new(idevice_t device, lockdownd_client_t *cli
 	client_loc->session_id = NULL;
 	client_loc->uuid = NULL;
 	client_loc->label = NULL;
+	client_loc->mutex = g_mutex_new();
+	client_loc->shared_refs = 0;
+	client_loc->value_cache_mode = LOCKDOWN_VALUE_CACHE_OFF;
+	client_loc->value_cache = NULL;
+	client_loc->build_version = NULL;
 	if (label != NULL)
 		client_loc->label = strdup(label);
 
@@ -634,17 +1162,100 @@ lockdownd_error_t lockdownd_client_new(idevice_t device, lockdownd_client_t *cli
 }
 
 /**
- * Creates a new lockdownd client for the device and starts initial handshake.
- * The handshake consists out of query_type, validate_pair, pair and
- * start_session calls. It uses the internal pairing record management.
- *
- * @param device The device to create a lockdownd client for
- * @param client The pointer to the location of the new lockdownd_client
- * @param label The label to use for communication. Usually the program name.
- *  Pass NULL to disable sending the label in requests to lockdownd.
+ * Sets how long a successful pair validation is remembered per device.
+ * While a cached validation is valid, lockdownd_client_new_with_handshake
+ * skips the QueryType and ValidatePair requests and starts the session
+ * right away. If that fails, the full handshake is performed.
  *
- * @return LOCKDOWN_E_SUCCESS on success, NP_E_INVALID_ARG when client is NULL,
- *  LOCKDOWN_E_INVALID_CONF if configuration data is wrong
+ * @param seconds Lifetime of cached validations in seconds, or 0 to
+ *  always perform the full handshake.
+ */
+void lockdownd_set_handshake_cache_ttl(unsigned int seconds)
+{
+	handshake_cache_ttl = seconds;
+}
+
+/**
+ * Makes sure the host keys and certificates used for pairing exist.
+ * Generating them takes a few seconds, so calling this on startup keeps
+ * the first pairing from stalling.
+ *
+ * @param wait If 0, generation is started in a background thread and this
+ *  function returns immediately. Otherwise it blocks until the keys are
+ *  available, joining a previously started background generation.
+ *
+ * @return LOCKDOWN_E_SUCCESS on success, LOCKDOWN_E_SSL_ERROR if the keys
+ *  could not be generated or LOCKDOWN_E_UNKNOWN_ERROR if the background
+ *  thread could not be started.
+ */
+lockdownd_error_t lockdownd_prepare_host_keys(int wait)
+{
+	userpref_error_t uerr;
+
+	if (wait)
+		uerr = userpref_wait_key_generation();
+	else
+		uerr = userpref_start_key_generation();
+
+	switch (uerr) {
+	case USERPREF_E_SUCCESS:
+		return LOCKDOWN_E_SUCCESS;
+	case USERPREF_E_SSL_ERROR:
+		return LOCKDOWN_E_SSL_ERROR;
+	case USERPREF_E_INVALID_CONF:
+		return LOCKDOWN_E_INVALID_CONF;
+	default:
+		break;
+	}
+	return LOCKDOWN_E_UNKNOWN_ERROR;
+}
+
+/**
+ * Internally used function that tries to start a session right away when
+ * pairing of the client's device was recently validated with host_id.
+ *
+ * @param client The lockdown client
+ * @param host_id The HostID to start the session with
+ *
+ * @return 1 if a session was started, 0 if the full handshake is needed.
+ */
+static int lockdownd_fast_handshake(lockdownd_client_t client, const char *host_id)
+{
+	time_t validated;
+	time_t now;
+
+	if (!handshake_cache_ttl || !client->uuid || !host_id || !userpref_has_device_public_key(client->uuid))
+		return 0;
+
+	validated = userpref_get_validated_handshake(client->uuid, host_id);
+	now = time(NULL);
+	if (!validated || (now < validated) || (now - validated >= (time_t)handshake_cache_ttl))
+		return 0;
+
+	debug_info("pairing validated %d seconds ago, starting session", (int)(now - validated));
+	if (lockdownd_start_session(client, host_id, NULL, NULL) == LOCKDOWN_E_SUCCESS)
+		return 1;
+
+	debug_info("fast handshake failed, falling back to full handshake");
+	userpref_set_validated_handshake(client->uuid, NULL, 0);
+	return 0;
+}
+
+/**
+ * Creates a new lockdownd client for the device and starts initial handshake.
+ * The handshake consists out of query_type, validate_pair, pair and
+ * start_session calls. It uses the internal pairing record management.
+ * If pairing was validated recently, only start_session is performed.
+ *
+ * @see lockdownd_set_handshake_cache_ttl
+ *
+ * @param device The device to create a lockdownd client for
+ * @param client The pointer to the location of the new lockdownd_client
+ * @param label The label to use for communication. Usually the program name.
+ *  Pass NULL to disable sending the label in requests to lockdownd.
+ *
+ * @return LOCKDOWN_E_SUCCESS on success, NP_E_INVALID_ARG when client is NULL,
+ *  LOCKDOWN_E_INVALID_CONF if configuration data is wrong
  */
 lockdownd_error_t lockdownd_client_new_with_handshake(idevice_t device, lockdownd_client_t *client, const char *label)
 {
@@ -656,13 +1267,36 @@ lockdownd_error_t lockdownd_client_new_with_handshake(idevice_t device, lockdown
 	char *host_id = NULL;
 	char *type = NULL;
 
-
 	ret = lockdownd_client_new(device, &client_loc, label);
+	if (LOCKDOWN_E_SUCCESS != ret)
+		return ret;
+
+	idevice_get_uuid(device, &client_loc->uuid);
+	debug_info("device uuid: %s", client_loc->uuid);
+
+	userpref_get_host_id(&host_id);
+
+	if (lockdownd_fast_handshake(client_loc, host_id)) {
+		free(host_id);
+		*client = client_loc;
+		return LOCKDOWN_E_SUCCESS;
+	}
+
+	if (client_loc->session_id || client_loc->ssl_enabled) {
+		/* a failed session start leaves the connection in an unknown state */
+		lockdownd_client_free(client_loc);
+		client_loc = NULL;
+		ret = lockdownd_client_new(device, &client_loc, label);
+		if (LOCKDOWN_E_SUCCESS != ret) {
+			free(host_id);
+			return ret;
+		}
+		idevice_get_uuid(device, &client_loc->uuid);
+	}
 
 	/* perform handshake */
 	if (LOCKDOWN_E_SUCCESS != lockdownd_query_type(client_loc, &type)) {
 		debug_info("QueryType failed in the lockdownd client.");
-		ret = LOCKDOWN_E_NOT_ENOUGH_DATA;
 	} else {
 		if (strcmp("com.apple.mobile.lockdown", type)) {
 			debug_info("Warning QueryType request returned \"%s\".", type);
@@ -671,13 +1305,11 @@ lockdownd_error_t lockdownd_client_new_with_handshake(idevice_t device, lockdown
 			free(type);
 	}
 
-	ret = idevice_get_uuid(device, &client_loc->uuid);
-	if (LOCKDOWN_E_SUCCESS != ret) {
+	if (!client_loc->uuid) {
 		debug_info("failed to get device uuid.");
+		ret = LOCKDOWN_E_UNKNOWN_ERROR;
 	}
-	debug_info("device uuid: %s", client_loc->uuid);
 
-	userpref_get_host_id(&host_id);
 	if (LOCKDOWN_E_SUCCESS == ret && !host_id) {
 		ret = LOCKDOWN_E_INVALID_CONF;
 	}
@@ -700,14 +1332,16 @@ lockdownd_error_t lockdownd_client_new_with_handshake(idevice_t device, lockdown
 		ret = lockdownd_start_session(client_loc, host_id, NULL, NULL);
 		if (LOCKDOWN_E_SUCCESS != ret) {
 			debug_info("Session opening failed.");
+		} else if (handshake_cache_ttl && client_loc->uuid) {
+			userpref_set_validated_handshake(client_loc->uuid, host_id, time(NULL));
 		}
+	}
 
-		if (host_id) {
-			free(host_id);
-			host_id = NULL;
-		}
+	if (host_id) {
+		free(host_id);
+		host_id = NULL;
 	}
-	
+
 	if (LOCKDOWN_E_SUCCESS == ret) {
 		*client = client_loc;
 	} else {
@@ -717,6 +1351,214 @@ lockdownd_error_t lockdownd_client_new_with_handshake(idevice_t device, lockdown
 	return ret;
 }
 
+/**
+ * Returns a lockdownd client with a running session for the device that is
+ * shared by all callers in this process. The first call performs the
+ * handshake like lockdownd_client_new_with_handshake, later calls for the
+ * same device return the same client.
+ *
+ * lockdownd_start_service, lockdownd_get_value, lockdownd_set_value and
+ * lockdownd_remove_value can be called on the shared client from multiple
+ * threads at the same time. Each caller has to release its reference with
+ * lockdownd_client_free; the session is closed when the last reference is
+ * released.
+ *
+ * @param device The device to get the shared lockdownd client for
+ * @param client The pointer to the location of the shared lockdownd_client
+ * @param label The label to use if a new client has to be created.
+ *
+ * @return LOCKDOWN_E_SUCCESS on success, NP_E_INVALID_ARG when device or
+ *  client is NULL, or an error code from lockdownd_client_new_with_handshake.
+ */
+lockdownd_error_t lockdownd_client_new_shared(idevice_t device, lockdownd_client_t *client, const char *label)
+{
+	if (!device || !client)
+		return LOCKDOWN_E_INVALID_ARG;
+
+	lockdownd_error_t ret = LOCKDOWN_E_SUCCESS;
+	lockdownd_client_t client_loc = NULL;
+
+	/* makes sure thread environment is available */
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+
+	struct lockdownd_shared_entry *entry = NULL;
+
+	g_static_mutex_lock(&shared_clients_mutex);
+	if (!shared_clients) {
+		shared_clients = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	}
+	entry = (struct lockdownd_shared_entry*)g_hash_table_lookup(shared_clients, device->uuid);
+	if (entry && !entry->pending) {
+		client_loc = entry->client;
+		client_loc->shared_refs++;
+	} else if (entry) {
+		/* another thread is doing the handshake for this device; its
+		 * result includes a reference for every waiter */
+		entry->waiters++;
+		while (entry->pending) {
+			g_cond_wait(entry->ready, g_static_mutex_get_mutex(&shared_clients_mutex));
+		}
+		entry->waiters--;
+		client_loc = entry->client;
+		ret = entry->error;
+		if (!client_loc && (entry->waiters == 0)) {
+			/* failed, and the entry was already taken out of the table */
+			lockdownd_shared_entry_free(entry);
+		}
+	} else {
+		/* add a placeholder, then do the handshake without the global
+		 * lock so handshakes with other devices are not held up */
+		entry = (struct lockdownd_shared_entry*)malloc(sizeof(struct lockdownd_shared_entry));
+		entry->client = NULL;
+		entry->ready = g_cond_new();
+		entry->pending = 1;
+		entry->waiters = 0;
+		entry->error = LOCKDOWN_E_UNKNOWN_ERROR;
+		g_hash_table_insert(shared_clients, g_strdup(device->uuid), entry);
+		g_static_mutex_unlock(&shared_clients_mutex);
+
+		ret = lockdownd_client_new_with_handshake(device, &client_loc, label);
+
+		g_static_mutex_lock(&shared_clients_mutex);
+		entry->pending = 0;
+		entry->error = ret;
+		if (LOCKDOWN_E_SUCCESS == ret) {
+			entry->client = client_loc;
+			client_loc->shared_refs = 1 + entry->waiters;
+		} else {
+			client_loc = NULL;
+			g_hash_table_remove(shared_clients, device->uuid);
+		}
+		if (entry->waiters > 0) {
+			g_cond_broadcast(entry->ready);
+		} else if (!client_loc) {
+			lockdownd_shared_entry_free(entry);
+		}
+	}
+	g_static_mutex_unlock(&shared_clients_mutex);
+
+	if (LOCKDOWN_E_SUCCESS == ret) {
+		*client = client_loc;
+	}
+	return ret;
+}
+
+/** Default number of concurrent handshakes in lockdownd_handshake_all. */
+#define HANDSHAKE_ALL_DEFAULT_THREADS 8
+
+static void lockdownd_handshake_worker(gpointer data, gpointer user_data)
+{
+	struct lockdownd_handshake_result *result = (struct lockdownd_handshake_result*)data;
+	const char *label = (const char*)user_data;
+
+	if (idevice_new(&result->device, result->uuid) != IDEVICE_E_SUCCESS) {
+		result->device = NULL;
+		result->error = LOCKDOWN_E_MUX_ERROR;
+		return;
+	}
+
+	result->error = lockdownd_client_new_with_handshake(result->device, &result->client, label);
+	if (result->error != LOCKDOWN_E_SUCCESS) {
+		debug_info("handshake with %s failed: %d", result->uuid, result->error);
+		result->client = NULL;
+		idevice_free(result->device);
+		result->device = NULL;
+	}
+}
+
+/**
+ * Connects to several devices and performs the lockdown handshake with
+ * each of them concurrently, so bringing up many devices takes about as
+ * long as the slowest device instead of the sum of all of them.
+ *
+ * The host keys and HostID are prepared once before the handshakes start,
+ * so the workers do not compete for generating them.
+ *
+ * @param uuids The UUIDs of the devices, e.g. from idevice_get_device_list.
+ * @param count The number of entries in uuids.
+ * @param label The label to use for communication. Usually the program name.
+ * @param max_threads The maximum number of concurrent handshakes, or 0 for
+ *  a default.
+ * @param results Set to an array of count results in the order of uuids.
+ *  Each result holds either a connected device and lockdownd client with a
+ *  running session or the error that occured. Free it with
+ *  lockdownd_handshake_results_free.
+ *
+ * @return LOCKDOWN_E_SUCCESS if all handshakes were run, regardless of
+ *  their individual outcome, LOCKDOWN_E_INVALID_ARG when uuids or results
+ *  is NULL, or another error code if the handshakes could not be started.
+ */
+lockdownd_error_t lockdownd_handshake_all(char **uuids, int count, const char *label, int max_threads, struct lockdownd_handshake_result **results)
+{
+	struct lockdownd_handshake_result *results_loc = NULL;
+	GThreadPool *pool = NULL;
+	char *host_id = NULL;
+	lockdownd_error_t ret;
+	int i;
+
+	if (!uuids || !results || count < 0)
+		return LOCKDOWN_E_INVALID_ARG;
+
+	/* makes sure thread environment is available */
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+
+	ret = lockdownd_prepare_host_keys(1);
+	if (ret != LOCKDOWN_E_SUCCESS)
+		return ret;
+	userpref_get_host_id(&host_id);
+	free(host_id);
+
+	if (max_threads <= 0)
+		max_threads = HANDSHAKE_ALL_DEFAULT_THREADS;
+
+	results_loc = (struct lockdownd_handshake_result*)calloc(count ? count : 1, sizeof(struct lockdownd_handshake_result));
+
+	pool = g_thread_pool_new(lockdownd_handshake_worker, (gpointer)label, max_threads, FALSE, NULL);
+	if (!pool) {
+		free(results_loc);
+		return LOCKDOWN_E_UNKNOWN_ERROR;
+	}
+
+	for (i = 0; i < count; i++) {
+		results_loc[i].uuid = strdup(uuids[i]);
+		results_loc[i].error = LOCKDOWN_E_UNKNOWN_ERROR;
+		g_thread_pool_push(pool, &results_loc[i], NULL);
+	}
+
+	/* waits until all queued handshakes are done */
+	g_thread_pool_free(pool, FALSE, TRUE);
+
+	*results = results_loc;
+	return LOCKDOWN_E_SUCCESS;
+}
+
+/**
+ * Frees results returned by lockdownd_handshake_all, including the
+ * lockdownd clients and devices that were not taken over by setting them
+ * to NULL.
+ *
+ * @param results The results to free.
+ * @param count The number of results.
+ */
+void lockdownd_handshake_results_free(struct lockdownd_handshake_result *results, int count)
+{
+	int i;
+
+	if (!results)
+		return;
+
+	for (i = 0; i < count; i++) {
+		if (results[i].client)
+			lockdownd_client_free(results[i].client);
+		if (results[i].device)
+			idevice_free(results[i].device);
+		free(results[i].uuid);
+	}
+	free(results);
+}
+
 /**
  * Returns a new plist from the supplied lockdownd pair record. The caller is
  * responsible for freeing the plist.
@@ -1051,31 +1893,63 @@ lockdownd_error_t lockdownd_goodbye(lockdownd_client_t client)
 }
 
 /**
- * Generates the device certificate from the public key as well as the host
- * and root certificates.
+ * Internally used function that computes the name under which the device
+ * certificate for a public key is cached. It covers the root certificate
+ * as well, so certificates signed by a replaced root are not reused.
  *
- * @param public_key The public key of the device to use for generation.
- * @param odevice_cert Holds the generated device certificate.
- * @param ohost_cert Holds the generated host certificate.
- * @param oroot_cert Holds the generated root certificate.
+ * @param signer The root signer the certificate is signed with.
+ * @param public_key The public key of the device.
  *
- * @return LOCKDOWN_E_SUCCESS on success, NP_E_INVALID_ARG when a parameter is NULL,
- *  LOCKDOWN_E_INVALID_CONF if the internal configuration system failed,
- *  LOCKDOWN_E_SSL_ERROR if the certificates could not be generated
+ * @return The fingerprint as hex string which has to be freed with g_free,
+ *  or NULL on error.
  */
-lockdownd_error_t lockdownd_gen_pair_cert(gnutls_datum_t public_key, gnutls_datum_t * odevice_cert,
-									   gnutls_datum_t * ohost_cert, gnutls_datum_t * oroot_cert)
+static char *lockdownd_device_cert_fingerprint(userpref_root_signer_t signer, gnutls_datum_t public_key)
 {
-	if (!public_key.data || !odevice_cert || !ohost_cert || !oroot_cert)
-		return LOCKDOWN_E_INVALID_ARG;
-	lockdownd_error_t ret = LOCKDOWN_E_UNKNOWN_ERROR;
-	userpref_error_t uret = USERPREF_E_UNKNOWN_ERROR;
+	unsigned char digest[20];
+	size_t digest_size = sizeof(digest);
+	gnutls_datum_t input;
+	char *fingerprint = NULL;
+	size_t root_len = strlen(signer->fingerprint);
+	size_t i;
+
+	input.size = root_len + public_key.size;
+	input.data = g_malloc(input.size);
+	memcpy(input.data, signer->fingerprint, root_len);
+	memcpy(input.data + root_len, public_key.data, public_key.size);
+
+	if (gnutls_fingerprint(GNUTLS_DIG_SHA1, &input, digest, &digest_size) == GNUTLS_E_SUCCESS) {
+		fingerprint = g_malloc(digest_size * 2 + 1);
+		for (i = 0; i < digest_size; i++) {
+			g_snprintf(fingerprint + i * 2, 3, "%02x", digest[i]);
+		}
+	}
+	g_free(input.data);
+
+	return fingerprint;
+}
+
+/**
+ * Internally used function that signs a new device certificate for the
+ * public key of the device.
+ *
+ * @param signer The root signer to sign the certificate with.
+ * @param public_key The PEM encoded public key of the device.
+ * @param dev_pem Holds the PEM encoded device certificate on success. Free
+ *  it with gnutls_free.
+ *
+ * @return LOCKDOWN_E_SUCCESS on success, LOCKDOWN_E_SSL_ERROR if the key
+ *  could not be decoded or the certificate could not be signed.
+ */
+static lockdownd_error_t lockdownd_sign_device_cert(userpref_root_signer_t signer, gnutls_datum_t public_key, gnutls_datum_t *dev_pem)
+{
+	lockdownd_error_t ret = LOCKDOWN_E_SSL_ERROR;
 
 	gnutls_datum_t modulus = { NULL, 0 };
 	gnutls_datum_t exponent = { NULL, 0 };
+	int decoded = 0;
 
 	/* now decode the PEM encoded key */
-	gnutls_datum_t der_pub_key;
+	gnutls_datum_t der_pub_key = { NULL, 0 };
 	if (GNUTLS_E_SUCCESS == gnutls_pem_base64_decode_alloc("RSA PUBLIC KEY", &public_key, &der_pub_key)) {
 
 		/* initalize asn.1 parser */
@@ -1097,7 +1971,7 @@ lockdownd_error_t lockdownd_gen_pair_cert(gnutls_datum_t public_key, gnutls_datu
 				ret1 = asn1_read_value(asn1_pub_key, "modulus", modulus.data, (int*)&modulus.size);
 				ret2 = asn1_read_value(asn1_pub_key, "publicExponent", exponent.data, (int*)&exponent.size);
 				if (ASN1_SUCCESS == ret1 && ASN1_SUCCESS == ret2)
-					ret = LOCKDOWN_E_SUCCESS;
+					decoded = 1;
 			}
 			if (asn1_pub_key)
 				asn1_delete_structure(&asn1_pub_key);
@@ -1106,99 +1980,44 @@ lockdownd_error_t lockdownd_gen_pair_cert(gnutls_datum_t public_key, gnutls_datu
 			asn1_delete_structure(&pkcs1);
 	}
 
-	/* now generate certificates */
-	if (LOCKDOWN_E_SUCCESS == ret && 0 != modulus.size && 0 != exponent.size) {
+	/* now generate the certificate */
+	if (decoded && 0 != modulus.size && 0 != exponent.size) {
 
-		gnutls_global_init();
 		gnutls_datum_t essentially_null = { (unsigned char*)strdup("abababababababab"), strlen("abababababababab") };
 
-		gnutls_x509_privkey_t fake_privkey, root_privkey, host_privkey;
-		gnutls_x509_crt_t dev_cert, root_cert, host_cert;
+		gnutls_x509_privkey_t fake_privkey;
+		gnutls_x509_crt_t dev_cert;
 
 		gnutls_x509_privkey_init(&fake_privkey);
 		gnutls_x509_crt_init(&dev_cert);
-		gnutls_x509_crt_init(&root_cert);
-		gnutls_x509_crt_init(&host_cert);
 
 		if (GNUTLS_E_SUCCESS ==
 			gnutls_x509_privkey_import_rsa_raw(fake_privkey, &modulus, &exponent, &essentially_null, &essentially_null,
 											   &essentially_null, &essentially_null)) {
 
-			gnutls_x509_privkey_init(&root_privkey);
-			gnutls_x509_privkey_init(&host_privkey);
-
-			uret = userpref_get_keys_and_certs(root_privkey, root_cert, host_privkey, host_cert);
-
-			if (USERPREF_E_SUCCESS == uret) {
-				/* generate device certificate */
-				gnutls_x509_crt_set_key(dev_cert, fake_privkey);
-				gnutls_x509_crt_set_serial(dev_cert, "\x00", 1);
-				gnutls_x509_crt_set_version(dev_cert, 3);
-				gnutls_x509_crt_set_ca_status(dev_cert, 0);
-				gnutls_x509_crt_set_activation_time(dev_cert, time(NULL));
-				gnutls_x509_crt_set_expiration_time(dev_cert, time(NULL) + (60 * 60 * 24 * 365 * 10));
-				gnutls_x509_crt_sign(dev_cert, root_cert, root_privkey);
-
-				if (LOCKDOWN_E_SUCCESS == ret) {
-					/* if everything went well, export in PEM format */
-					size_t export_size = 0;
-					gnutls_datum_t dev_pem = { NULL, 0 };
-					gnutls_x509_crt_export(dev_cert, GNUTLS_X509_FMT_PEM, NULL, &export_size);
-					dev_pem.data = gnutls_malloc(export_size);
-					gnutls_x509_crt_export(dev_cert, GNUTLS_X509_FMT_PEM, dev_pem.data, &export_size);
-					dev_pem.size = export_size;
-
-					gnutls_datum_t pem_root_cert = { NULL, 0 };
-					gnutls_datum_t pem_host_cert = { NULL, 0 };
-
-					uret = userpref_get_certs_as_pem(&pem_root_cert, &pem_host_cert);
-
-					if (USERPREF_E_SUCCESS == uret) {
-						/* copy buffer for output */
-						odevice_cert->data = malloc(dev_pem.size);
-						memcpy(odevice_cert->data, dev_pem.data, dev_pem.size);
-						odevice_cert->size = dev_pem.size;
-
-						ohost_cert->data = malloc(pem_host_cert.size);
-						memcpy(ohost_cert->data, pem_host_cert.data, pem_host_cert.size);
-						ohost_cert->size = pem_host_cert.size;
-
-						oroot_cert->data = malloc(pem_root_cert.size);
-						memcpy(oroot_cert->data, pem_root_cert.data, pem_root_cert.size);
-						oroot_cert->size = pem_root_cert.size;
-
-						g_free(pem_root_cert.data);
-						g_free(pem_host_cert.data);
-
-						if (dev_pem.data)
-							gnutls_free(dev_pem.data);
-					}
-				}
-			}
-
-			switch(uret) {
-			case USERPREF_E_INVALID_ARG:
-				ret = LOCKDOWN_E_INVALID_ARG;
-				break;
-			case USERPREF_E_INVALID_CONF:
-				ret = LOCKDOWN_E_INVALID_CONF;
-				break;
-			case USERPREF_E_SSL_ERROR:
-				ret = LOCKDOWN_E_SSL_ERROR;
-			default:
-				break;
+			/* generate device certificate */
+			gnutls_x509_crt_set_key(dev_cert, fake_privkey);
+			gnutls_x509_crt_set_serial(dev_cert, "\x00", 1);
+			gnutls_x509_crt_set_version(dev_cert, 3);
+			gnutls_x509_crt_set_ca_status(dev_cert, 0);
+			gnutls_x509_crt_set_activation_time(dev_cert, time(NULL));
+			gnutls_x509_crt_set_expiration_time(dev_cert, time(NULL) + (60 * 60 * 24 * 365 * 10));
+
+			if (GNUTLS_E_SUCCESS == gnutls_x509_crt_sign(dev_cert, signer->root_crt, signer->root_privkey)) {
+				/* if everything went well, export in PEM format */
+				size_t export_size = 0;
+				gnutls_x509_crt_export(dev_cert, GNUTLS_X509_FMT_PEM, NULL, &export_size);
+				dev_pem->data = gnutls_malloc(export_size);
+				gnutls_x509_crt_export(dev_cert, GNUTLS_X509_FMT_PEM, dev_pem->data, &export_size);
+				dev_pem->size = export_size;
+				ret = LOCKDOWN_E_SUCCESS;
 			}
 		}
 
 		if (essentially_null.data)
 			free(essentially_null.data);
 		gnutls_x509_crt_deinit(dev_cert);
-		gnutls_x509_crt_deinit(root_cert);
-		gnutls_x509_crt_deinit(host_cert);
 		gnutls_x509_privkey_deinit(fake_privkey);
-		gnutls_x509_privkey_deinit(root_privkey);
-		gnutls_x509_privkey_deinit(host_privkey);
-
 	}
 
 	gnutls_free(modulus.data);
@@ -1209,6 +2028,87 @@ lockdownd_error_t lockdownd_gen_pair_cert(gnutls_datum_t public_key, gnutls_datu
 	return ret;
 }
 
+/**
+ * Generates the device certificate from the public key as well as the host
+ * and root certificates.
+ *
+ * The root key and certificates are loaded once per process, and signed
+ * device certificates are cached by a fingerprint of the device public key
+ * and the root certificate, so pairing the same device again does not
+ * sign a new certificate.
+ *
+ * @param public_key The public key of the device to use for generation.
+ * @param odevice_cert Holds the generated device certificate.
+ * @param ohost_cert Holds the generated host certificate.
+ * @param oroot_cert Holds the generated root certificate.
+ *
+ * @return LOCKDOWN_E_SUCCESS on success, NP_E_INVALID_ARG when a parameter is NULL,
+ *  LOCKDOWN_E_INVALID_CONF if the internal configuration system failed,
+ *  LOCKDOWN_E_SSL_ERROR if the certificates could not be generated
+ */
+lockdownd_error_t lockdownd_gen_pair_cert(gnutls_datum_t public_key, gnutls_datum_t * odevice_cert,
+									   gnutls_datum_t * ohost_cert, gnutls_datum_t * oroot_cert)
+{
+	if (!public_key.data || !odevice_cert || !ohost_cert || !oroot_cert)
+		return LOCKDOWN_E_INVALID_ARG;
+	lockdownd_error_t ret = LOCKDOWN_E_UNKNOWN_ERROR;
+	userpref_error_t uret = USERPREF_E_UNKNOWN_ERROR;
+	userpref_root_signer_t signer = NULL;
+	char *fingerprint = NULL;
+	gnutls_datum_t dev_pem = { NULL, 0 };
+
+	uret = userpref_root_signer_get(&signer);
+	switch(uret) {
+	case USERPREF_E_SUCCESS:
+		break;
+	case USERPREF_E_INVALID_ARG:
+		return LOCKDOWN_E_INVALID_ARG;
+	case USERPREF_E_INVALID_CONF:
+		return LOCKDOWN_E_INVALID_CONF;
+	case USERPREF_E_SSL_ERROR:
+		return LOCKDOWN_E_SSL_ERROR;
+	default:
+		return LOCKDOWN_E_UNKNOWN_ERROR;
+	}
+
+	fingerprint = lockdownd_device_cert_fingerprint(signer, public_key);
+	if (fingerprint && (userpref_get_device_certificate(fingerprint, &dev_pem) == USERPREF_E_SUCCESS)) {
+		debug_info("reusing device certificate %s", fingerprint);
+		ret = LOCKDOWN_E_SUCCESS;
+	} else {
+		gnutls_datum_t signed_pem = { NULL, 0 };
+		ret = lockdownd_sign_device_cert(signer, public_key, &signed_pem);
+		if (ret == LOCKDOWN_E_SUCCESS) {
+			if (fingerprint)
+				userpref_set_device_certificate(fingerprint, signed_pem);
+			dev_pem.data = (unsigned char*)g_memdup(signed_pem.data, signed_pem.size);
+			dev_pem.size = signed_pem.size;
+		}
+		gnutls_free(signed_pem.data);
+	}
+
+	if (ret == LOCKDOWN_E_SUCCESS) {
+		/* copy buffer for output */
+		odevice_cert->data = malloc(dev_pem.size);
+		memcpy(odevice_cert->data, dev_pem.data, dev_pem.size);
+		odevice_cert->size = dev_pem.size;
+
+		ohost_cert->data = malloc(signer->pem_host_cert.size);
+		memcpy(ohost_cert->data, signer->pem_host_cert.data, signer->pem_host_cert.size);
+		ohost_cert->size = signer->pem_host_cert.size;
+
+		oroot_cert->data = malloc(signer->pem_root_cert.size);
+		memcpy(oroot_cert->data, signer->pem_root_cert.data, signer->pem_root_cert.size);
+		oroot_cert->size = signer->pem_root_cert.size;
+	}
+
+	g_free(dev_pem.data);
+	g_free(fingerprint);
+	userpref_root_signer_release(signer);
+
+	return ret;
+}
+
 /**
  * Opens a session with lockdownd and switches to SSL mode if device wants it.
  *
@@ -1308,6 +2208,66 @@ lockdownd_error_t lockdownd_start_session(lockdownd_client_t client, const char
 	return ret;
 }
 
+/**
+ * Internally used function that builds a StartService request.
+ *
+ * @param client The lockdownd client
+ * @param service The name of the service to start
+ *
+ * @return The request plist. Free it with plist_free.
+ */
+static plist_t lockdownd_start_service_request(lockdownd_client_t client, const char *service)
+{
+	plist_t dict = plist_new_dict();
+	plist_dict_add_label(dict, client->label);
+	plist_dict_insert_item(dict,"Request", plist_new_string("StartService"));
+	plist_dict_insert_item(dict,"Service", plist_new_string(service));
+	return dict;
+}
+
+/**
+ * Internally used function that reads the port from a StartService reply.
+ *
+ * @param dict The reply from lockdownd
+ * @param port Set to the port number the service was started on
+ *
+ * @return LOCKDOWN_E_SUCCESS on success, LOCKDOWN_E_INVALID_SERVICE if the
+ *  service is not known by the device, LOCKDOWN_E_START_SERVICE_FAILED if
+ *  the service could not be started or LOCKDOWN_E_UNKNOWN_ERROR if the reply
+ *  holds no valid port.
+ */
+static lockdownd_error_t lockdownd_parse_start_service_reply(plist_t dict, uint16_t *port)
+{
+	lockdownd_error_t ret = LOCKDOWN_E_UNKNOWN_ERROR;
+
+	if (lockdown_check_result(dict, "StartService") == RESULT_SUCCESS) {
+		plist_t port_value_node = plist_dict_get_item(dict, "Port");
+
+		if (port_value_node && (plist_get_node_type(port_value_node) == PLIST_UINT)) {
+			uint64_t port_value = 0;
+			plist_get_uint_val(port_value_node, &port_value);
+
+			if (port_value) {
+				*port = (uint16_t)port_value;
+				ret = LOCKDOWN_E_SUCCESS;
+			}
+		}
+	} else {
+		ret = LOCKDOWN_E_START_SERVICE_FAILED;
+		plist_t error_node = plist_dict_get_item(dict, "Error");
+		if (error_node && PLIST_STRING == plist_get_node_type(error_node)) {
+			char *error = NULL;
+			plist_get_string_val(error_node, &error);
+			if (!strcmp(error, "InvalidService")) {
+				ret = LOCKDOWN_E_INVALID_SERVICE;
+			}
+			free(error);
+		}
+	}
+
+	return ret;
+}
+
 /**
  * Requests to start a service and retrieve it's port on success.
  *
@@ -1333,26 +2293,18 @@ lockdownd_error_t lockdownd_start_service(lockdownd_client_t client, const char
 		return LOCKDOWN_E_NO_RUNNING_SESSION;
 
 	plist_t dict = NULL;
-	uint16_t port_loc = 0;
 	lockdownd_error_t ret = LOCKDOWN_E_UNKNOWN_ERROR;
 
 	free(host_id);
 	host_id = NULL;
 
-	dict = plist_new_dict();
-	plist_dict_add_label(dict, client->label);
-	plist_dict_insert_item(dict,"Request", plist_new_string("StartService"));
-	plist_dict_insert_item(dict,"Service", plist_new_string(service));
+	dict = lockdownd_start_service_request(client, service);
 
-	/* send to device */
-	ret = lockdownd_send(client, dict);
+	/* send to device and get its answer */
+	plist_t reply = NULL;
+	ret = lockdownd_request(client, dict, &reply);
 	plist_free(dict);
-	dict = NULL;
-
-	if (LOCKDOWN_E_SUCCESS != ret)
-		return ret;
-
-	ret = lockdownd_receive(client, &dict);
+	dict = reply;
 
 	if (LOCKDOWN_E_SUCCESS != ret)
 		return ret;
@@ -1360,36 +2312,191 @@ lockdownd_error_t lockdownd_start_service(lockdownd_client_t client, const char
 	if (!dict)
 		return LOCKDOWN_E_PLIST_ERROR;
 
-	ret = LOCKDOWN_E_UNKNOWN_ERROR;
-	if (lockdown_check_result(dict, "StartService") == RESULT_SUCCESS) {
-		plist_t port_value_node = plist_dict_get_item(dict, "Port");
+	ret = lockdownd_parse_start_service_reply(dict, port);
 
-		if (port_value_node && (plist_get_node_type(port_value_node) == PLIST_UINT)) {
-			uint64_t port_value = 0;
-			plist_get_uint_val(port_value_node, &port_value);
+	plist_free(dict);
+	dict = NULL;
+	return ret;
+}
 
-			if (port_value) {
-				port_loc = port_value;
-				ret = LOCKDOWN_E_SUCCESS;
-			}
-			if (port && ret == LOCKDOWN_E_SUCCESS)
-				*port = port_loc;
+/**
+ * Requests to start several services at once. All StartService requests
+ * are sent back-to-back before the replies are read, so starting n
+ * services costs about one round trip instead of n.
+ *
+ * @param client The lockdownd client
+ * @param services The names of the services to start
+ * @param count The number of services
+ * @param ports Set to the port number of each service, or 0 if it could
+ *  not be started
+ *
+ * @return LOCKDOWN_E_SUCCESS if all services were started,
+ *  LOCKDOWN_E_INVALID_ARG if a parameter is NULL, or the error of the first
+ *  service that could not be started. Services the device refused do not
+ *  affect the others. If a reply could not be received, the remaining
+ *  replies are read and discarded and their ports stay 0; if that is not
+ *  possible the connection is closed and the client has to be freed.
+ */
+lockdownd_error_t lockdownd_start_services(lockdownd_client_t client, const char **services, uint32_t count, uint16_t *ports)
+{
+	if (!client || !services || !ports)
+		return LOCKDOWN_E_INVALID_ARG;
+
+	lockdownd_error_t ret = LOCKDOWN_E_SUCCESS;
+	plist_t *requests = NULL;
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		if (!services[i])
+			return LOCKDOWN_E_INVALID_ARG;
+		ports[i] = 0;
+	}
+	if (count == 0)
+		return LOCKDOWN_E_SUCCESS;
+	if (!client->session_id)
+		return LOCKDOWN_E_NO_RUNNING_SESSION;
+
+	requests = (plist_t*)malloc(sizeof(plist_t) * count);
+	for (i = 0; i < count; i++) {
+		requests[i] = lockdownd_start_service_request(client, services[i]);
+	}
+
+	lockdownd_lock(client);
+
+	if (property_list_service_send_plists(client->parent, requests, count) != PROPERTY_LIST_SERVICE_E_SUCCESS) {
+		/* it is unknown how many requests made it to the device */
+		ret = LOCKDOWN_E_MUX_ERROR;
+		lockdownd_invalidate(client);
+	}
+
+	/* replies arrive in request order */
+	for (i = 0; (ret != LOCKDOWN_E_MUX_ERROR) && (i < count); i++) {
+		plist_t dict = NULL;
+		lockdownd_error_t lret = lockdownd_receive(client, &dict);
+		if (lret == LOCKDOWN_E_SUCCESS && !dict)
+			lret = LOCKDOWN_E_PLIST_ERROR;
+		if (lret != LOCKDOWN_E_SUCCESS) {
+			/* a late reply must not be taken for the next service's */
+			debug_info("could not receive reply for service %s: %d", services[i], lret);
+			if (dict)
+				plist_free(dict);
+			if (ret == LOCKDOWN_E_SUCCESS)
+				ret = lret;
+			lockdownd_discard_replies(client, count - i - 1);
+			break;
 		}
-	} else {
-		ret = LOCKDOWN_E_START_SERVICE_FAILED;
-		plist_t error_node = plist_dict_get_item(dict, "Error");
-		if (error_node && PLIST_STRING == plist_get_node_type(error_node)) {
-			char *error = NULL;
-			plist_get_string_val(error_node, &error);
-			if (!strcmp(error, "InvalidService")) {
-				ret = LOCKDOWN_E_INVALID_SERVICE;
-			}
-			free(error);
+		lret = lockdownd_parse_start_service_reply(dict, &ports[i]);
+		if (lret != LOCKDOWN_E_SUCCESS) {
+			debug_info("could not start service %s: %d", services[i], lret);
+			if (ret == LOCKDOWN_E_SUCCESS)
+				ret = lret;
 		}
+		plist_free(dict);
 	}
 
-	plist_free(dict);
-	dict = NULL;
+	lockdownd_unlock(client);
+
+	for (i = 0; i < count; i++) {
+		plist_free(requests[i]);
+	}
+	free(requests);
+
+	return ret;
+}
+
+struct lockdownd_service_connect {
+	idevice_t device;
+	struct lockdownd_service *service;
+};
+
+static gpointer lockdownd_service_connect_worker(gpointer data)
+{
+	struct lockdownd_service_connect *connect = (struct lockdownd_service_connect*)data;
+	struct lockdownd_service *service = connect->service;
+
+	service->client_error = service->client_new(connect->device, service->port, &service->client);
+	if (service->client_error != 0) {
+		debug_info("could not connect to service %s: %d", service->name, service->client_error);
+		service->client = NULL;
+	}
+	return NULL;
+}
+
+/**
+ * Starts several services with lockdownd_start_services and then creates
+ * the service clients concurrently, so their connection set-up (including
+ * SSL handshakes) overlaps.
+ *
+ * @param client The lockdownd client
+ * @param device The device to connect the service clients to
+ * @param services The services to start. For each, name and client_new
+ *  have to be set; port, client, error and client_error are filled in.
+ *  If client_new is NULL only the service is started.
+ * @param count The number of services
+ *
+ * @return LOCKDOWN_E_SUCCESS if all services were started, or an error code
+ *  from lockdownd_start_services. Check client_error and client of each
+ *  service for the result of creating its client.
+ */
+lockdownd_error_t lockdownd_start_service_clients(lockdownd_client_t client, idevice_t device, struct lockdownd_service *services, uint32_t count)
+{
+	if (!client || !device || !services)
+		return LOCKDOWN_E_INVALID_ARG;
+
+	lockdownd_error_t ret;
+	const char **names = NULL;
+	uint16_t *ports = NULL;
+	struct lockdownd_service_connect *connects = NULL;
+	GThread **threads = NULL;
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		services[i].port = 0;
+		services[i].client = NULL;
+		services[i].error = LOCKDOWN_E_UNKNOWN_ERROR;
+		services[i].client_error = 0;
+	}
+	if (count == 0)
+		return LOCKDOWN_E_SUCCESS;
+
+	names = (const char**)malloc(sizeof(char*) * count);
+	ports = (uint16_t*)malloc(sizeof(uint16_t) * count);
+	for (i = 0; i < count; i++) {
+		names[i] = services[i].name;
+	}
+
+	ret = lockdownd_start_services(client, names, count, ports);
+	for (i = 0; i < count; i++) {
+		services[i].port = ports[i];
+		services[i].error = ports[i] ? LOCKDOWN_E_SUCCESS : ((ret != LOCKDOWN_E_SUCCESS) ? ret : LOCKDOWN_E_START_SERVICE_FAILED);
+	}
+	free(names);
+	free(ports);
+
+	/* makes sure thread environment is available */
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+
+	connects = (struct lockdownd_service_connect*)calloc(count, sizeof(struct lockdownd_service_connect));
+	threads = (GThread**)calloc(count, sizeof(GThread*));
+	for (i = 0; i < count; i++) {
+		if (!services[i].port || !services[i].client_new)
+			continue;
+		connects[i].device = device;
+		connects[i].service = &services[i];
+		threads[i] = g_thread_create(lockdownd_service_connect_worker, &connects[i], TRUE, NULL);
+		if (!threads[i]) {
+			/* no thread available, connect right here */
+			lockdownd_service_connect_worker(&connects[i]);
+		}
+	}
+	for (i = 0; i < count; i++) {
+		if (threads[i])
+			g_thread_join(threads[i]);
+	}
+	free(threads);
+	free(connects);
+
 	return ret;
 }
 
@@ -23,6 +23,7 @@
 #define LOCKDOWND_H
 
 #include <gnutls/gnutls.h>
+#include <glib.h>
 
 #include "libimobiledevice/lockdown.h"
 #include "property_list_service.h"
@@ -33,6 +34,11 @@ struct lockdownd_client_private {
 	char *session_id;
 	char *uuid;
 	char *label;
+	GMutex *mutex;
+	int shared_refs;
+	enum lockdownd_value_cache_mode value_cache_mode;
+	plist_t value_cache;
+	char *build_version;
 };
 
 lockdownd_error_t lockdownd_get_device_public_key(lockdownd_client_t client, gnutls_datum_t * public_key);
@@ -101,6 +101,7 @@ mobile_image_mounter_error_t mobile_image_mounter_new(idevice_t device, uint16_t
 	if (property_list_service_client_new(device, port, &plistclient) != PROPERTY_LIST_SERVICE_E_SUCCESS) {
 		return MOBILE_IMAGE_MOUNTER_E_CONN_FAILED;
 	}
+	property_list_service_set_encoding(plistclient, property_list_service_get_service_encoding("com.apple.mobile.mobile_image_mounter"));
 
 	mobile_image_mounter_client_t client_loc = (mobile_image_mounter_client_t) malloc(sizeof(struct mobile_image_mounter_client_private));
 	client_loc->parent = plistclient;
@@ -135,6 +136,26 @@ mobile_image_mounter_error_t mobile_image_mounter_free(mobile_image_mounter_clie
 	return MOBILE_IMAGE_MOUNTER_E_SUCCESS;
 }
 
+/**
+ * Sets the plist encoding used for requests to the mobile_image_mounter
+ * service. By default the encoding from the internal service encoding table
+ * is used.
+ *
+ * @param client The mobile_image_mounter client to configure.
+ * @param encoding IDEVICE_PLIST_ENCODING_XML or IDEVICE_PLIST_ENCODING_BINARY
+ *
+ * @return MOBILE_IMAGE_MOUNTER_E_SUCCESS on success, or
+ *    MOBILE_IMAGE_MOUNTER_E_INVALID_ARG when client is NULL or encoding is
+ *    invalid.
+ */
+mobile_image_mounter_error_t mobile_image_mounter_set_plist_encoding(mobile_image_mounter_client_t client, enum idevice_plist_encoding encoding)
+{
+	if (!client || !client->parent)
+		return MOBILE_IMAGE_MOUNTER_E_INVALID_ARG;
+
+	return mobile_image_mounter_error(property_list_service_set_encoding(client->parent, encoding));
+}
+
 /**
  * Tells if the image of ImageType is already mounted.
  *
@@ -159,11 +180,11 @@ mobile_image_mounter_error_t mobile_image_mounter_lookup_image(mobile_image_moun
 	plist_dict_insert_item(dict,"Command", plist_new_string("LookupImage"));
 	plist_dict_insert_item(dict,"ImageType", plist_new_string(image_type));
 
-	mobile_image_mounter_error_t res = mobile_image_mounter_error(property_list_service_send_xml_plist(client->parent, dict));
+	mobile_image_mounter_error_t res = mobile_image_mounter_error(property_list_service_send_plist(client->parent, dict));
 	plist_free(dict);
 
 	if (res != MOBILE_IMAGE_MOUNTER_E_SUCCESS) {
-		debug_info("%s: Error sending XML plist to device!", __func__);
+		debug_info("%s: Error sending plist to device!", __func__);
 		goto leave_unlock;
 	}
 
@@ -211,11 +232,11 @@ mobile_image_mounter_error_t mobile_image_mounter_mount_image(mobile_image_mount
 	plist_dict_insert_item(dict, "ImageSignature", plist_new_data(image_signature, signature_length));
 	plist_dict_insert_item(dict, "ImageType", plist_new_string(image_type));
 
-	mobile_image_mounter_error_t res = mobile_image_mounter_error(property_list_service_send_xml_plist(client->parent, dict));
+	mobile_image_mounter_error_t res = mobile_image_mounter_error(property_list_service_send_plist(client->parent, dict));
 	plist_free(dict);
 
 	if (res != MOBILE_IMAGE_MOUNTER_E_SUCCESS) {
-		debug_info("%s: Error sending XML plist to device!", __func__);
+		debug_info("%s: Error sending plist to device!", __func__);
 		goto leave_unlock;
 	}
 
@@ -250,11 +271,11 @@ mobile_image_mounter_error_t mobile_image_mounter_hangup(mobile_image_mounter_cl
 	plist_t dict = plist_new_dict();
 	plist_dict_insert_item(dict, "Command", plist_new_string("Hangup"));
 
-	mobile_image_mounter_error_t res = mobile_image_mounter_error(property_list_service_send_xml_plist(client->parent, dict));
+	mobile_image_mounter_error_t res = mobile_image_mounter_error(property_list_service_send_plist(client->parent, dict));
 	plist_free(dict);
 
 	if (res != MOBILE_IMAGE_MOUNTER_E_SUCCESS) {
-		debug_info("%s: Error sending XML plist to device!", __func__);
+		debug_info("%s: Error sending plist to device!", __func__);
 		goto leave_unlock;
 	}
 
@@ -22,18 +22,29 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
+#include <poll.h>
 #include <plist/plist.h>
 
 #include "notification_proxy.h"
 #include "property_list_service.h"
+#include "idevice.h"
 #include "debug.h"
 
+/** Milliseconds to wait for the rest of a notification once it started arriving. */
+#define NP_RECEIVE_TIMEOUT 5000
+
+/** Milliseconds after which the hub looks again at a partly received notification. */
+#define NP_HUB_PARTIAL_INTERVAL 10
+
 struct np_thread {
 	np_client_t client;
 	np_notify_cb_t cbfunc;
 	void *user_data;
 };
 
+static void np_stop_notifier(np_client_t client);
+
 /**
  * Locks a notification_proxy client, used for thread safety.
  *
@@ -107,6 +118,7 @@ np_error_t np_client_new(idevice_t device, uint16_t port, np_client_t *client)
 	if (property_list_service_client_new(device, port, &plistclient) != PROPERTY_LIST_SERVICE_E_SUCCESS) {
 		return NP_E_CONN_FAILED;
 	}
+	property_list_service_set_encoding(plistclient, property_list_service_get_service_encoding("com.apple.mobile.notification_proxy"));
 
 	np_client_t client_loc = (np_client_t) malloc(sizeof(struct np_client_private));
 	client_loc->parent = plistclient;
@@ -114,6 +126,18 @@ np_error_t np_client_new(idevice_t device, uint16_t port, np_client_t *client)
 	client_loc->mutex = g_mutex_new();
 
 	client_loc->notifier = NULL;
+	client_loc->wakeup_pipe[0] = -1;
+	client_loc->wakeup_pipe[1] = -1;
+	client_loc->hub = NULL;
+
+	client_loc->queue_mutex = g_mutex_new();
+	client_loc->queue_cond = g_cond_new();
+	client_loc->queue = g_queue_new();
+	client_loc->queue_capacity = 0;
+	client_loc->queue_policy = NP_QUEUE_DROP_OLDEST;
+	client_loc->queue_closing = 0;
+	client_loc->dispatcher = NULL;
+	memset(&client_loc->queue_stats, 0, sizeof(np_queue_stats_t));
 
 	*client = client_loc;
 	return NP_E_SUCCESS;
@@ -132,15 +156,23 @@ np_error_t np_client_free(np_client_t client)
 	if (!client)
 		return NP_E_INVALID_ARG;
 
+	/* stop the notifier before the connection it waits on goes away */
+	if (client->hub) {
+		np_hub_remove_client(client->hub, client);
+	}
+	np_stop_notifier(client);
 	property_list_service_client_free(client->parent);
 	client->parent = NULL;
-	if (client->notifier) {
-		debug_info("joining np callback");
-		g_thread_join(client->notifier);
+	if (client->wakeup_pipe[0] >= 0) {
+		close(client->wakeup_pipe[0]);
+		close(client->wakeup_pipe[1]);
 	}
 	if (client->mutex) {
 		g_mutex_free(client->mutex);
 	}
+	g_queue_free(client->queue);
+	g_cond_free(client->queue_cond);
+	g_mutex_free(client->queue_mutex);
 	free(client);
 
 	return NP_E_SUCCESS;
@@ -165,17 +197,17 @@ np_error_t np_post_notification(np_client_t client, const char *notification)
 	plist_dict_insert_item(dict,"Command", plist_new_string("PostNotification"));
 	plist_dict_insert_item(dict,"Name", plist_new_string(notification));
 
-	np_error_t res = np_error(property_list_service_send_xml_plist(client->parent, dict));
+	np_error_t res = np_error(property_list_service_send_plist(client->parent, dict));
 	plist_free(dict);
 
 	dict = plist_new_dict();
 	plist_dict_insert_item(dict,"Command", plist_new_string("Shutdown"));
 
-	res = np_error(property_list_service_send_xml_plist(client->parent, dict));
+	res = np_error(property_list_service_send_plist(client->parent, dict));
 	plist_free(dict);
 
 	if (res != NP_E_SUCCESS) {
-		debug_info("Error sending XML plist to device!");
+		debug_info("Error sending plist to device!");
 	}
 
 	np_unlock(client);
@@ -202,9 +234,9 @@ np_error_t np_observe_notification( np_client_t client, const char *notification
 	plist_dict_insert_item(dict,"Command", plist_new_string("ObserveNotification"));
 	plist_dict_insert_item(dict,"Name", plist_new_string(notification));
 
-	np_error_t res = np_error(property_list_service_send_xml_plist(client->parent, dict));
+	np_error_t res = np_error(property_list_service_send_plist(client->parent, dict));
 	if (res != NP_E_SUCCESS) {
-		debug_info("Error sending XML plist to device!");
+		debug_info("Error sending plist to device!");
 	}
 	plist_free(dict);
 
@@ -255,8 +287,9 @@ np_error_t np_observe_notifications(np_client_t client, const char **notificatio
  * @param notification Pointer to a buffer that will be allocated and filled
  *  with the notification that has been received.
  *
- * @return 0 if a notification has been received or nothing has been received,
- *         or a negative value if an error occured.
+ * @return 0 if a notification has been received, -2 if a message that is
+ *         not a notification, e.g. an unknown command, has been received,
+ *         -3 if nothing could be received, or -1 if the proxy died.
  *
  * @note You probably want to check out np_set_notify_callback
  * @see np_set_notify_callback
@@ -271,10 +304,10 @@ static int np_get_notification(np_client_t client, char **notification)
 
 	np_lock(client);
 
-	property_list_service_receive_plist_with_timeout(client->parent, &dict, 500);
+	property_list_service_receive_plist_with_timeout(client->parent, &dict, NP_RECEIVE_TIMEOUT);
 	if (!dict) {
 		debug_info("NotificationProxy: no notification received!");
-		res = 0;
+		res = -3;
 	} else {
 		char *cmd_value = NULL;
 		plist_t cmd_value_node = plist_dict_get_item(dict, "Command");
@@ -301,8 +334,9 @@ static int np_get_notification(np_client_t client, char **notification)
 			debug_info("ERROR: NotificationProxy died!");
 			res = -1;
 		} else if (cmd_value) {
+			/* skip it, the connection is still usable */
 			debug_info("unknown NotificationProxy command '%s' received!", cmd_value);
-			res = -1;
+			res = -2;
 		} else {
 			res = -2;
 		}
@@ -318,25 +352,174 @@ static int np_get_notification(np_client_t client, char **notification)
 	return res;
 }
 
+static gint np_queue_compare(gconstpointer a, gconstpointer b)
+{
+	return strcmp((const char*)a, (const char*)b);
+}
+
+/**
+ * Internally used function that hands a notification from the reader to
+ * the dispatcher thread, applying the overflow policy of the client.
+ *
+ * @param client The NP client
+ * @param notification The notification. The queue takes ownership of it.
+ */
+static void np_queue_push(np_client_t client, char *notification)
+{
+	g_mutex_lock(client->queue_mutex);
+	client->queue_stats.received++;
+
+	if (client->queue_policy == NP_QUEUE_COALESCE) {
+		if (g_queue_find_custom(client->queue, notification, np_queue_compare)) {
+			/* an identical notification is still waiting for the callback */
+			client->queue_stats.coalesced++;
+			g_mutex_unlock(client->queue_mutex);
+			free(notification);
+			return;
+		}
+	}
+
+	while (g_queue_get_length(client->queue) >= client->queue_capacity) {
+		if (client->queue_policy == NP_QUEUE_BLOCK) {
+			if (client->queue_closing) {
+				client->queue_stats.dropped++;
+				g_mutex_unlock(client->queue_mutex);
+				free(notification);
+				return;
+			}
+			g_cond_wait(client->queue_cond, client->queue_mutex);
+		} else {
+			free(g_queue_pop_head(client->queue));
+			client->queue_stats.dropped++;
+		}
+	}
+
+	g_queue_push_tail(client->queue, notification);
+	if (g_queue_get_length(client->queue) > client->queue_stats.max_depth) {
+		client->queue_stats.max_depth = g_queue_get_length(client->queue);
+	}
+	g_cond_broadcast(client->queue_cond);
+	g_mutex_unlock(client->queue_mutex);
+}
+
 /**
- * Internally used thread function.
+ * Internally used thread function that runs the callback for queued
+ * notifications, so a slow callback does not stall reading from the device.
+ */
+gpointer np_dispatcher(gpointer arg)
+{
+	struct np_thread *npt = (struct np_thread*)arg;
+	np_client_t client = npt->client;
+	char *notification;
+
+	while (1) {
+		g_mutex_lock(client->queue_mutex);
+		while (g_queue_is_empty(client->queue) && !client->queue_closing) {
+			g_cond_wait(client->queue_cond, client->queue_mutex);
+		}
+		if (client->queue_closing) {
+			g_mutex_unlock(client->queue_mutex);
+			break;
+		}
+		notification = (char*)g_queue_pop_head(client->queue);
+		client->queue_stats.delivered++;
+		/* there is space again for a blocked reader */
+		g_cond_broadcast(client->queue_cond);
+		g_mutex_unlock(client->queue_mutex);
+
+		npt->cbfunc(notification, npt->user_data);
+		free(notification);
+	}
+	free(npt);
+
+	return NULL;
+}
+
+/**
+ * Internally used function that waits until data arrives on the connection
+ * of the client or the notifier is asked to stop.
+ *
+ * @param client The NP client
+ * @param timeout Milliseconds to wait, or -1 to wait forever.
+ *
+ * @return 1 if data can be received, 0 on timeout, or -1 if the notifier
+ *         should stop.
+ */
+static int np_wait_for_data(np_client_t client, int timeout)
+{
+	struct pollfd fds[2];
+	int res;
+
+	if (idevice_connection_get_pending(client->parent->connection) > 0)
+		return 1;
+
+	fds[0].fd = idevice_connection_get_fd(client->parent->connection);
+	fds[0].events = POLLIN;
+	fds[0].revents = 0;
+	fds[1].fd = client->wakeup_pipe[0];
+	fds[1].events = POLLIN;
+	fds[1].revents = 0;
+
+	do {
+		res = poll(fds, 2, timeout);
+	} while (res < 0 && errno == EINTR);
+
+	if (res < 0) {
+		debug_info("poll failed: %s", strerror(errno));
+		return -1;
+	}
+	if (fds[1].revents) {
+		debug_info("notifier asked to stop");
+		return -1;
+	}
+	if (fds[0].revents & POLLIN)
+		return 1;
+	if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+		debug_info("connection closed");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Internally used thread function. It sleeps in poll() until the device
+ * sends something, then dispatches every notification that is queued on
+ * the connection before waiting again.
  */
 gpointer np_notifier( gpointer arg )
 {
 	char *notification = NULL;
 	struct np_thread *npt = (struct np_thread*)arg;
+	int timeout;
+	int res;
 
 	if (!npt) return NULL;
 
 	debug_info("starting callback.");
-	while (npt->client->parent) {
-		np_get_notification(npt->client, &notification);
+	timeout = -1;
+	while (1) {
+		res = np_wait_for_data(npt->client, timeout);
+		if (res < 0)
+			break;
+		if (res == 0) {
+			/* drained, block until the next notification */
+			timeout = -1;
+			continue;
+		}
+		res = np_get_notification(npt->client, &notification);
+		if (res == -1 || res == -3)
+			break;
 		if (notification) {
-			npt->cbfunc(notification, npt->user_data);
-			free(notification);
+			if (npt->client->dispatcher) {
+				np_queue_push(npt->client, notification);
+			} else {
+				npt->cbfunc(notification, npt->user_data);
+				free(notification);
+			}
 			notification = NULL;
 		}
-		sleep(1);
+		/* check for further queued notifications without blocking */
+		timeout = 0;
 	}
 	if (npt) {
 		free(npt);
@@ -345,11 +528,64 @@ gpointer np_notifier( gpointer arg )
 	return NULL;
 }
 
+/**
+ * Internally used function that stops the notifier thread of the client,
+ * if there is one, and waits for it to finish.
+ *
+ * @param client The NP client
+ */
+static void np_stop_notifier(np_client_t client)
+{
+	GThread *notifier;
+	GThread *dispatcher;
+	char c = 0;
+
+	np_lock(client);
+	notifier = client->notifier;
+	client->notifier = NULL;
+	np_unlock(client);
+
+	if (!notifier)
+		return;
+
+	debug_info("joining np callback");
+	if (write(client->wakeup_pipe[1], &c, 1) != 1) {
+		debug_info("could not wake up notifier: %s", strerror(errno));
+	}
+
+	/* release a reader blocked on a full queue and stop the dispatcher */
+	g_mutex_lock(client->queue_mutex);
+	client->queue_closing = 1;
+	g_cond_broadcast(client->queue_cond);
+	g_mutex_unlock(client->queue_mutex);
+
+	g_thread_join(notifier);
+
+	dispatcher = client->dispatcher;
+	if (dispatcher) {
+		g_thread_join(dispatcher);
+		client->dispatcher = NULL;
+	}
+
+	/* notifications that were not delivered anymore are discarded */
+	g_mutex_lock(client->queue_mutex);
+	while (!g_queue_is_empty(client->queue)) {
+		free(g_queue_pop_head(client->queue));
+	}
+	client->queue_closing = 0;
+	g_mutex_unlock(client->queue_mutex);
+
+	/* consume the wake-up so the pipe can be reused */
+	if (read(client->wakeup_pipe[0], &c, 1) != 1) {
+		debug_info("could not reset wake-up pipe: %s", strerror(errno));
+	}
+}
+
 /**
  * This function allows an application to define a callback function that will
  * be called when a notification has been received.
- * It will start a thread that polls for notifications and calls the callback
- * function if a notification has been received.
+ * It will start a thread that waits for notifications and calls the callback
+ * function as soon as a notification has been received.
  *
  * @param client the NP client
  * @param notify_cb pointer to a callback function or NULL to de-register a
@@ -361,8 +597,9 @@ gpointer np_notifier( gpointer arg )
  *       any previously set callback function will be removed automatically.
  *
  * @return NP_E_SUCCESS when the callback was successfully registered,
- *         NP_E_INVALID_ARG when client is NULL, or NP_E_UNKNOWN_ERROR when
- *         the callback thread could no be created.
+ *         NP_E_INVALID_ARG when client is NULL or added to a notification
+ *         hub, or NP_E_UNKNOWN_ERROR when the callback thread could no be
+ *         created.
  */
 np_error_t np_set_notify_callback( np_client_t client, np_notify_cb_t notify_cb, void *user_data )
 {
@@ -371,26 +608,59 @@ np_error_t np_set_notify_callback( np_client_t client, np_notify_cb_t notify_cb,
 
 	np_error_t res = NP_E_UNKNOWN_ERROR;
 
-	np_lock(client);
+	if (client->hub) {
+		debug_info("client is managed by a notification hub");
+		return NP_E_INVALID_ARG;
+	}
+
+	/* the notifier takes the lock itself, so it is stopped without holding it */
 	if (client->notifier) {
 		debug_info("callback already set, removing\n");
-		property_list_service_client_t parent = client->parent;
-		client->parent = NULL;
-		g_thread_join(client->notifier);
-		client->notifier = NULL;
-		client->parent = parent;
+		np_stop_notifier(client);
 	}
 
+	np_lock(client);
 	if (notify_cb) {
+		if (client->wakeup_pipe[0] < 0 && pipe(client->wakeup_pipe) != 0) {
+			debug_info("could not create wake-up pipe: %s", strerror(errno));
+			client->wakeup_pipe[0] = -1;
+			client->wakeup_pipe[1] = -1;
+			np_unlock(client);
+			return res;
+		}
+
 		struct np_thread *npt = (struct np_thread*)malloc(sizeof(struct np_thread));
 		if (npt) {
 			npt->client = client;
 			npt->cbfunc = notify_cb;
 			npt->user_data = user_data;
 
-			client->notifier = g_thread_create(np_notifier, npt, TRUE, NULL);
+			if (client->queue_capacity > 0) {
+				/* the dispatcher runs the callback, the notifier only reads */
+				struct np_thread *dpt = (struct np_thread*)malloc(sizeof(struct np_thread));
+				memcpy(dpt, npt, sizeof(struct np_thread));
+				client->dispatcher = g_thread_create(np_dispatcher, dpt, TRUE, NULL);
+				if (!client->dispatcher) {
+					free(dpt);
+				}
+			}
+
+			if (client->queue_capacity == 0 || client->dispatcher) {
+				client->notifier = g_thread_create(np_notifier, npt, TRUE, NULL);
+			}
 			if (client->notifier) {
 				res = NP_E_SUCCESS;
+			} else {
+				free(npt);
+				if (client->dispatcher) {
+					g_mutex_lock(client->queue_mutex);
+					client->queue_closing = 1;
+					g_cond_broadcast(client->queue_cond);
+					g_mutex_unlock(client->queue_mutex);
+					g_thread_join(client->dispatcher);
+					client->dispatcher = NULL;
+					client->queue_closing = 0;
+				}
 			}
 		}
 	} else {
@@ -400,3 +670,590 @@ np_error_t np_set_notify_callback( np_client_t client, np_notify_cb_t notify_cb,
 
 	return res;
 }
+
+/**
+ * Puts a bounded queue between reading notifications from the device and
+ * running the callback set with np_set_notify_callback. The callback then
+ * runs on its own thread, so a slow callback does not stall the device.
+ *
+ * @param client The NP client
+ * @param capacity The maximum number of queued notifications, or 0 to run
+ *        the callback on the reading thread (the default).
+ * @param policy What to do when a notification arrives while the queue is
+ *        full: NP_QUEUE_DROP_OLDEST, NP_QUEUE_COALESCE or NP_QUEUE_BLOCK.
+ *        With NP_QUEUE_COALESCE a notification is also dropped whenever an
+ *        identical one is still queued.
+ *
+ * @note This has to be called before np_set_notify_callback.
+ *
+ * @return NP_E_SUCCESS on success, or NP_E_INVALID_ARG when client is NULL,
+ *         policy is invalid or a callback is already set.
+ */
+np_error_t np_set_notify_queue(np_client_t client, uint32_t capacity, enum np_queue_policy policy)
+{
+	if (!client || client->notifier)
+		return NP_E_INVALID_ARG;
+
+	switch (policy) {
+	case NP_QUEUE_DROP_OLDEST:
+	case NP_QUEUE_COALESCE:
+	case NP_QUEUE_BLOCK:
+		break;
+	default:
+		return NP_E_INVALID_ARG;
+	}
+
+	g_mutex_lock(client->queue_mutex);
+	client->queue_capacity = capacity;
+	client->queue_policy = policy;
+	g_mutex_unlock(client->queue_mutex);
+
+	return NP_E_SUCCESS;
+}
+
+/**
+ * Gets the counters of the callback queue of a client.
+ *
+ * @param client The NP client
+ * @param stats Pointer to an np_queue_stats_t that will be filled.
+ *
+ * @return NP_E_SUCCESS on success, or NP_E_INVALID_ARG when client or stats
+ *         is NULL.
+ */
+np_error_t np_get_notify_queue_stats(np_client_t client, np_queue_stats_t *stats)
+{
+	if (!client || !stats)
+		return NP_E_INVALID_ARG;
+
+	g_mutex_lock(client->queue_mutex);
+	memcpy(stats, &client->queue_stats, sizeof(np_queue_stats_t));
+	g_mutex_unlock(client->queue_mutex);
+
+	return NP_E_SUCCESS;
+}
+
+/** A notification queued for the workers of a hub. */
+struct np_hub_event {
+	struct np_hub_client *entry;
+	np_hub_cb_t client_callback;
+	void *client_user_data;
+	np_hub_cb_t callback;
+	void *user_data;
+	char *notification;
+};
+
+static void np_hub_lock(np_hub_t hub)
+{
+	g_mutex_lock(hub->mutex);
+}
+
+static void np_hub_unlock(np_hub_t hub)
+{
+	g_mutex_unlock(hub->mutex);
+}
+
+/**
+ * Internally used function that wakes up the poller thread of a hub so it
+ * picks up changes to the set of clients.
+ *
+ * @param hub The notification hub
+ */
+static void np_hub_wakeup(np_hub_t hub)
+{
+	char c = 0;
+	if (write(hub->wakeup_pipe[1], &c, 1) != 1) {
+		debug_info("could not wake up hub: %s", strerror(errno));
+	}
+}
+
+/**
+ * Internally used function that looks up the entry of a client in a hub.
+ *
+ * @note Must be called with the hub locked.
+ */
+static struct np_hub_client *np_hub_find(np_hub_t hub, np_client_t client)
+{
+	GSList *node;
+	for (node = hub->clients; node; node = node->next) {
+		struct np_hub_client *entry = (struct np_hub_client*)node->data;
+		if (entry->client == client)
+			return entry;
+	}
+	return NULL;
+}
+
+/**
+ * Internally used worker function that runs the callbacks for one
+ * notification, or for the close of a connection if notification is NULL.
+ */
+static void np_hub_dispatch(gpointer data, gpointer user_data)
+{
+	np_hub_t hub = (np_hub_t)user_data;
+	struct np_hub_event *event = (struct np_hub_event*)data;
+
+	if (event->client_callback) {
+		event->client_callback(event->entry->client, event->notification, event->client_user_data);
+	}
+	if (event->callback) {
+		event->callback(event->entry->client, event->notification, event->user_data);
+	}
+	free(event->notification);
+
+	/* np_hub_remove_client waits for this before the client can go away */
+	np_hub_lock(hub);
+	event->entry->pending--;
+	if (event->entry->pending == 0)
+		g_cond_broadcast(hub->idle);
+	np_hub_unlock(hub);
+
+	free(event);
+}
+
+/**
+ * Internally used function that hands a notification of a client to the
+ * workers of the hub.
+ *
+ * @param hub The notification hub
+ * @param entry The hub entry of the client
+ * @param notification The notification, or NULL to report that the
+ *  connection of the client closed. Freed by the worker.
+ */
+static void np_hub_push(np_hub_t hub, struct np_hub_client *entry, char *notification)
+{
+	struct np_hub_event *event = (struct np_hub_event*)malloc(sizeof(struct np_hub_event));
+
+	np_hub_lock(hub);
+	event->entry = entry;
+	event->client_callback = entry->callback;
+	event->client_user_data = entry->user_data;
+	event->callback = hub->callback;
+	event->user_data = hub->user_data;
+	event->notification = notification;
+	entry->pending++;
+	np_hub_unlock(hub);
+
+	g_thread_pool_push(hub->workers, event, NULL);
+}
+
+/**
+ * Internally used function that marks a client of a hub as closed and
+ * reports it to the callbacks. The hub no longer polls the client.
+ */
+static void np_hub_close(np_hub_t hub, struct np_hub_client *entry)
+{
+	debug_info("connection of client %p closed", entry->client);
+	np_hub_lock(hub);
+	entry->closed = 1;
+	np_hub_unlock(hub);
+	np_hub_push(hub, entry, NULL);
+}
+
+/**
+ * Internally used function that reads all notifications of a hub client
+ * that arrived completely and hands them to the workers. Notifications that
+ * only arrived partly are left for later, so one slow connection does not
+ * hold up the others. The hub is not locked while reading; the entry is
+ * marked busy instead, which makes np_hub_remove_client wait for it.
+ *
+ * @note Must be called with the hub unlocked and entry->busy set, followed
+ *       by np_hub_release.
+ */
+static void np_hub_drain(np_hub_t hub, struct np_hub_client *entry)
+{
+	property_list_service_client_t parent = entry->client->parent;
+	char *notification = NULL;
+	struct pollfd pfd;
+	int res;
+
+	while (property_list_service_frame_ready(parent)) {
+		res = np_get_notification(entry->client, &notification);
+		if (res == -3) {
+			/* still ready with nothing to read means the connection is
+			 * gone, otherwise it was only a timeout */
+			if (property_list_service_frame_ready(parent))
+				np_hub_close(hub, entry);
+			return;
+		}
+		if (res == -1) {
+			np_hub_close(hub, entry);
+			return;
+		}
+		if (notification) {
+			np_hub_push(hub, entry, notification);
+			notification = NULL;
+		}
+	}
+
+	/* readable without a complete frame, look again shortly */
+	pfd.fd = idevice_connection_get_fd(parent->connection);
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	res = (poll(&pfd, 1, 0) > 0);
+	if (res && (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))) {
+		/* closed in the middle of a notification */
+		np_hub_close(hub, entry);
+		return;
+	}
+	res = res && (pfd.revents & POLLIN);
+	np_hub_lock(hub);
+	entry->partial = res;
+	np_hub_unlock(hub);
+}
+
+/**
+ * Internally used function that drops a reference to a hub entry and frees
+ * it with the last one. The list of clients and the poller hold references,
+ * so an entry is never freed while the poller still looks at it.
+ *
+ * @note Must be called with the hub locked.
+ */
+static void np_hub_entry_unref(struct np_hub_client *entry)
+{
+	entry->refs--;
+	if (entry->refs == 0)
+		free(entry);
+}
+
+/**
+ * Internally used function that ends reading from a hub client and wakes
+ * up np_hub_remove_client if it waits for the client.
+ */
+static void np_hub_release(np_hub_t hub, struct np_hub_client *entry)
+{
+	np_hub_lock(hub);
+	entry->busy = 0;
+	if (entry->pending == 0)
+		g_cond_broadcast(hub->idle);
+	np_hub_unlock(hub);
+}
+
+/**
+ * Internally used thread function of a hub. It waits on the connections of
+ * all clients at once and reads notifications as they arrive.
+ */
+gpointer np_hub_poller(gpointer arg)
+{
+	np_hub_t hub = (np_hub_t)arg;
+	struct pollfd *fds = NULL;
+	struct np_hub_client **polled = NULL;
+	struct np_hub_client **partial = NULL;
+	struct np_hub_client **ready = NULL;
+	short *ready_events = NULL;
+	guint nfds = 0;
+	guint npartial = 0;
+	guint nready = 0;
+	guint i;
+
+	while (1) {
+		GSList *node;
+		guint length;
+		int timeout = -1;
+		int res;
+
+		/* collect the connections to wait on */
+		np_hub_lock(hub);
+		if (hub->quit) {
+			np_hub_unlock(hub);
+			break;
+		}
+		length = g_slist_length(hub->clients) + 1;
+		fds = (struct pollfd*)realloc(fds, sizeof(struct pollfd) * length);
+		polled = (struct np_hub_client**)realloc(polled, sizeof(struct np_hub_client*) * length);
+		partial = (struct np_hub_client**)realloc(partial, sizeof(struct np_hub_client*) * length);
+		ready = (struct np_hub_client**)realloc(ready, sizeof(struct np_hub_client*) * length);
+		ready_events = (short*)realloc(ready_events, sizeof(short) * length);
+		nfds = 1;
+		npartial = 0;
+		nready = 0;
+		fds[0].fd = hub->wakeup_pipe[0];
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		polled[0] = NULL;
+		for (node = hub->clients; node; node = node->next) {
+			struct np_hub_client *entry = (struct np_hub_client*)node->data;
+			if (entry->closed)
+				continue;
+			if (idevice_connection_get_pending(entry->client->parent->connection) > 0) {
+				/* data already buffered by SSL */
+				entry->busy = 1;
+				ready_events[nready] = POLLIN;
+				ready[nready++] = entry;
+				continue;
+			}
+			/* held until after poll(), so the address cannot be reused */
+			entry->refs++;
+			if (entry->partial) {
+				/* readable until the frame is complete, check it later */
+				partial[npartial++] = entry;
+				timeout = NP_HUB_PARTIAL_INTERVAL;
+				continue;
+			}
+			fds[nfds].fd = idevice_connection_get_fd(entry->client->parent->connection);
+			fds[nfds].events = POLLIN;
+			fds[nfds].revents = 0;
+			polled[nfds] = entry;
+			nfds++;
+		}
+		np_hub_unlock(hub);
+
+		if (nready == 0) {
+			do {
+				res = poll(fds, nfds, timeout);
+			} while (res < 0 && errno == EINTR);
+			if (res < 0) {
+				debug_info("poll failed: %s", strerror(errno));
+				np_hub_lock(hub);
+				for (i = 1; i < nfds; i++)
+					np_hub_entry_unref(polled[i]);
+				for (i = 0; i < npartial; i++)
+					np_hub_entry_unref(partial[i]);
+				np_hub_unlock(hub);
+				break;
+			}
+
+			if (fds[0].revents & POLLIN) {
+				char buf[64];
+				/* consume wake-ups, the client set is rebuilt anyway */
+				if (read(hub->wakeup_pipe[0], buf, sizeof(buf)) < 0) {
+					debug_info("could not read wake-up pipe: %s", strerror(errno));
+				}
+			}
+		}
+
+		np_hub_lock(hub);
+		for (i = 1; i < nfds; i++) {
+			struct np_hub_client *entry = polled[i];
+			/* the client might have been removed meanwhile */
+			if (fds[i].revents && !entry->removed && !entry->closed) {
+				entry->busy = 1;
+				ready_events[nready] = fds[i].revents;
+				ready[nready++] = entry;
+			}
+			np_hub_entry_unref(entry);
+		}
+		for (i = 0; i < npartial; i++) {
+			struct np_hub_client *entry = partial[i];
+			if (!entry->removed && !entry->closed && !entry->busy) {
+				entry->busy = 1;
+				entry->partial = 0;
+				ready_events[nready] = POLLIN;
+				ready[nready++] = entry;
+			}
+			np_hub_entry_unref(entry);
+		}
+		np_hub_unlock(hub);
+
+		/* read without holding the hub lock */
+		for (i = 0; i < nready; i++) {
+			if (ready_events[i] & POLLIN) {
+				np_hub_drain(hub, ready[i]);
+			} else {
+				np_hub_close(hub, ready[i]);
+			}
+			np_hub_release(hub, ready[i]);
+		}
+	}
+
+	free(fds);
+	free(polled);
+	free(partial);
+	free(ready);
+	free(ready_events);
+
+	return NULL;
+}
+
+/**
+ * Creates a notification hub. A hub waits for notifications of any number
+ * of notification_proxy clients with a single thread and runs their
+ * callbacks on a fixed number of worker threads, so the number of threads
+ * does not grow with the number of devices.
+ *
+ * @param workers The number of threads running callbacks. Notifications of
+ *  one client are delivered in order only if this is 1.
+ * @param hub Pointer that will be set to the new hub.
+ *
+ * @return NP_E_SUCCESS on success, NP_E_INVALID_ARG when hub is NULL or
+ *  workers is less than 1, or NP_E_UNKNOWN_ERROR when the threads could
+ *  not be created.
+ */
+np_error_t np_hub_new(int workers, np_hub_t *hub)
+{
+	if (!hub || workers < 1)
+		return NP_E_INVALID_ARG;
+
+	/* makes sure thread environment is available */
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+
+	np_hub_t hub_loc = (np_hub_t) malloc(sizeof(struct np_hub_private));
+	hub_loc->clients = NULL;
+	hub_loc->callback = NULL;
+	hub_loc->user_data = NULL;
+	hub_loc->quit = 0;
+	hub_loc->poller = NULL;
+	hub_loc->workers = NULL;
+
+	if (pipe(hub_loc->wakeup_pipe) != 0) {
+		debug_info("could not create wake-up pipe: %s", strerror(errno));
+		free(hub_loc);
+		return NP_E_UNKNOWN_ERROR;
+	}
+	hub_loc->mutex = g_mutex_new();
+	hub_loc->idle = g_cond_new();
+
+	hub_loc->workers = g_thread_pool_new(np_hub_dispatch, hub_loc, workers, TRUE, NULL);
+	if (hub_loc->workers) {
+		hub_loc->poller = g_thread_create(np_hub_poller, hub_loc, TRUE, NULL);
+	}
+	if (!hub_loc->poller) {
+		np_hub_free(hub_loc);
+		return NP_E_UNKNOWN_ERROR;
+	}
+
+	*hub = hub_loc;
+	return NP_E_SUCCESS;
+}
+
+/**
+ * Stops a notification hub and frees it. Clients still added to the hub
+ * are removed from it but not freed. Callbacks for notifications that were
+ * already received are run before this function returns.
+ *
+ * @param hub The hub to free.
+ *
+ * @return NP_E_SUCCESS on success, or NP_E_INVALID_ARG when hub is NULL.
+ */
+np_error_t np_hub_free(np_hub_t hub)
+{
+	GSList *node;
+
+	if (!hub)
+		return NP_E_INVALID_ARG;
+
+	if (hub->poller) {
+		np_hub_lock(hub);
+		hub->quit = 1;
+		np_hub_unlock(hub);
+		np_hub_wakeup(hub);
+		g_thread_join(hub->poller);
+	}
+	if (hub->workers) {
+		g_thread_pool_free(hub->workers, FALSE, TRUE);
+	}
+
+	for (node = hub->clients; node; node = node->next) {
+		struct np_hub_client *entry = (struct np_hub_client*)node->data;
+		entry->client->hub = NULL;
+		np_hub_entry_unref(entry);
+	}
+	g_slist_free(hub->clients);
+
+	close(hub->wakeup_pipe[0]);
+	close(hub->wakeup_pipe[1]);
+	g_cond_free(hub->idle);
+	g_mutex_free(hub->mutex);
+	free(hub);
+
+	return NP_E_SUCCESS;
+}
+
+/**
+ * Sets a callback that is run for notifications of all clients of the hub,
+ * after the callback of the client itself.
+ *
+ * @param hub The notification hub
+ * @param callback The callback or NULL to remove it.
+ * @param user_data Pointer passed to the callback.
+ *
+ * @return NP_E_SUCCESS on success, or NP_E_INVALID_ARG when hub is NULL.
+ */
+np_error_t np_hub_set_callback(np_hub_t hub, np_hub_cb_t callback, void *user_data)
+{
+	if (!hub)
+		return NP_E_INVALID_ARG;
+
+	np_hub_lock(hub);
+	hub->callback = callback;
+	hub->user_data = user_data;
+	np_hub_unlock(hub);
+
+	return NP_E_SUCCESS;
+}
+
+/**
+ * Adds a notification_proxy client to a hub. The hub receives the
+ * notifications the client observes; use np_observe_notification as usual.
+ *
+ * @param hub The notification hub
+ * @param client The client to add. It must not have a callback set with
+ *  np_set_notify_callback.
+ * @param callback The callback to run for notifications of this client, or
+ *  NULL to only run the callback of the hub.
+ * @param user_data Pointer passed to callback.
+ *
+ * @return NP_E_SUCCESS on success, or NP_E_INVALID_ARG when hub or client is
+ *  NULL, the client has its own callback or already belongs to a hub.
+ */
+np_error_t np_hub_add_client(np_hub_t hub, np_client_t client, np_hub_cb_t callback, void *user_data)
+{
+	if (!hub || !client || client->hub || client->notifier)
+		return NP_E_INVALID_ARG;
+
+	struct np_hub_client *entry = (struct np_hub_client*)malloc(sizeof(struct np_hub_client));
+	entry->client = client;
+	entry->callback = callback;
+	entry->user_data = user_data;
+	entry->closed = 0;
+	entry->busy = 0;
+	entry->partial = 0;
+	entry->pending = 0;
+	entry->removed = 0;
+	entry->refs = 1;
+
+	np_hub_lock(hub);
+	client->hub = hub;
+	hub->clients = g_slist_prepend(hub->clients, entry);
+	np_hub_unlock(hub);
+	np_hub_wakeup(hub);
+
+	return NP_E_SUCCESS;
+}
+
+/**
+ * Removes a notification_proxy client from a hub. Once this function
+ * returns, the hub no longer reads from the client and all callbacks for
+ * it have finished, so the client can be freed. Waits for a read from the
+ * client that is in progress, and must therefore not be called from a hub
+ * callback for the same client.
+ *
+ * @param hub The notification hub
+ * @param client The client to remove.
+ *
+ * @return NP_E_SUCCESS on success, or NP_E_INVALID_ARG when hub or client is
+ *  NULL or the client does not belong to the hub.
+ */
+np_error_t np_hub_remove_client(np_hub_t hub, np_client_t client)
+{
+	struct np_hub_client *entry;
+
+	if (!hub || !client || client->hub != hub)
+		return NP_E_INVALID_ARG;
+
+	np_hub_lock(hub);
+	entry = np_hub_find(hub, client);
+	if (entry) {
+		hub->clients = g_slist_remove(hub->clients, entry);
+		entry->removed = 1;
+		/* queued events and the poller still refer to the client */
+		while (entry->busy || entry->pending > 0) {
+			g_cond_wait(hub->idle, hub->mutex);
+		}
+		np_hub_entry_unref(entry);
+	}
+	client->hub = NULL;
+	np_hub_unlock(hub);
+	np_hub_wakeup(hub);
+
+	return NP_E_SUCCESS;
+}
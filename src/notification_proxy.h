@@ -30,8 +30,44 @@ struct np_client_private {
 	property_list_service_client_t parent;
 	GMutex *mutex;
 	GThread *notifier;
+	int wakeup_pipe[2];
+	np_hub_t hub;
+	GMutex *queue_mutex;
+	GCond *queue_cond;
+	GQueue *queue;
+	uint32_t queue_capacity;
+	enum np_queue_policy queue_policy;
+	int queue_closing;
+	GThread *dispatcher;
+	np_queue_stats_t queue_stats;
+};
+
+struct np_hub_client {
+	np_client_t client;
+	np_hub_cb_t callback;
+	void *user_data;
+	int closed;
+	int busy;         /* the poller is reading from the client */
+	int partial;      /* part of a notification arrived, the rest is awaited */
+	int removed;      /* removed from the hub, freed with the last reference */
+	uint32_t pending; /* events queued or running on the workers */
+	uint32_t refs;    /* held by the list of clients and the poller */
+};
+
+struct np_hub_private {
+	GMutex *mutex;
+	GCond *idle;      /* signalled when a client becomes neither busy nor pending */
+	GSList *clients;
+	np_hub_cb_t callback;
+	void *user_data;
+	GThread *poller;
+	GThreadPool *workers;
+	int wakeup_pipe[2];
+	int quit;
 };
 
 gpointer np_notifier(gpointer arg);
+gpointer np_dispatcher(gpointer arg);
+gpointer np_hub_poller(gpointer arg);
 
 #endif
@@ -20,12 +20,36 @@
  */
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
 #include <glib.h>
 
 #include "property_list_service.h"
 #include "idevice.h"
 #include "debug.h"
 
+/**
+ * Preferred plist encoding per service. Binary plists are smaller and
+ * cheaper to generate and parse, so they are used for every service that
+ * is known to accept them; all other services keep using XML.
+ * Services based on device_link_service always use binary plists and are
+ * therefore not listed here.
+ */
+static const struct {
+	const char *service;
+	enum idevice_plist_encoding encoding;
+} service_encodings[] = {
+	{ "com.apple.mobile.lockdown", IDEVICE_PLIST_ENCODING_XML },
+	{ "com.apple.mobile.notification_proxy", IDEVICE_PLIST_ENCODING_BINARY },
+	{ "com.apple.springboardservices", IDEVICE_PLIST_ENCODING_BINARY },
+	{ "com.apple.mobile.installation_proxy", IDEVICE_PLIST_ENCODING_XML },
+	{ "com.apple.mobile.file_relay", IDEVICE_PLIST_ENCODING_XML },
+	{ "com.apple.mobile.mobile_image_mounter", IDEVICE_PLIST_ENCODING_XML },
+	{ NULL, IDEVICE_PLIST_ENCODING_XML }
+};
+
 /**
  * Convert an idevice_error_t value to an property_list_service_error_t value.
  * Used internally to get correct error codes.
@@ -50,6 +74,142 @@ static property_list_service_error_t idevice_to_property_list_service_error(idev
 	return PROPERTY_LIST_SERVICE_E_UNKNOWN_ERROR;
 }
 
+/** Smallest capacity a message buffer is allocated with. */
+#define BUFFER_MIN_CAPACITY 4096
+
+/** Buffers above this capacity are candidates for shrinking. */
+#define BUFFER_SHRINK_THRESHOLD (256 * 1024)
+
+/** Number of messages after which the high-water mark is evaluated. */
+#define BUFFER_SHRINK_WINDOW 64
+
+/** Plists up to this size are sent together with their length header. */
+#define SEND_COALESCE_MAX (64 * 1024)
+
+/** Number of bytes requested per read while receiving or draining a frame. */
+#define RECEIVE_CHUNK_SIZE (64 * 1024)
+
+/** Over-limit frames larger than this are not drained; the length is
+ * considered corrupt and the connection is closed instead. */
+#define DRAIN_FRAME_MAX (64 * 1024 * 1024)
+
+/** Size of the stack buffer used for draining. */
+#define DRAIN_CHUNK_SIZE 4096
+
+/** Buffered bytes after which a frame counts as ready even if incomplete. */
+#define FRAME_READY_MAX (64 * 1024)
+
+/**
+ * Makes sure the given message buffer can hold at least size bytes.
+ * The buffer contents are not preserved when the buffer has to grow.
+ *
+ * @param buffer The message buffer to grow.
+ * @param size The number of bytes required.
+ *
+ * @return Pointer to the buffer data, or NULL if memory allocation failed.
+ */
+static char *buffer_reserve(struct property_list_service_buffer *buffer, uint32_t size)
+{
+	if (buffer->data && buffer->capacity >= size) {
+		return buffer->data;
+	}
+
+	uint32_t capacity = (buffer->capacity > 0) ? buffer->capacity : BUFFER_MIN_CAPACITY;
+	while (capacity < size) {
+		if (capacity > (G_MAXUINT32 / 2)) {
+			capacity = size;
+			break;
+		}
+		capacity *= 2;
+	}
+
+	free(buffer->data);
+	buffer->data = (char*)malloc(capacity);
+	buffer->capacity = (buffer->data) ? capacity : 0;
+	return buffer->data;
+}
+
+/**
+ * Grows the given message buffer to hold at least size bytes while
+ * preserving its contents.
+ *
+ * @param buffer The message buffer to grow.
+ * @param size The number of bytes required.
+ * @param limit Upper bound for the new capacity; must be >= size.
+ *
+ * @return Pointer to the buffer data, or NULL if memory allocation failed.
+ *     The original buffer is left untouched on failure.
+ */
+static char *buffer_grow(struct property_list_service_buffer *buffer, uint32_t size, uint32_t limit)
+{
+	if (buffer->data && buffer->capacity >= size) {
+		return buffer->data;
+	}
+
+	uint32_t capacity = (buffer->capacity > 0) ? buffer->capacity : BUFFER_MIN_CAPACITY;
+	while (capacity < size) {
+		if (capacity > (G_MAXUINT32 / 2)) {
+			capacity = size;
+			break;
+		}
+		capacity *= 2;
+	}
+	if (capacity > limit) {
+		capacity = limit;
+	}
+
+	char *data = (char*)realloc(buffer->data, capacity);
+	if (!data) {
+		return NULL;
+	}
+	buffer->data = data;
+	buffer->capacity = capacity;
+	return data;
+}
+
+/**
+ * Marks the end of a message that used size bytes of the given buffer.
+ * After every BUFFER_SHRINK_WINDOW messages, a large buffer that was never
+ * filled more than a quarter during that window is shrunk down to the
+ * high-water mark, so a single big message does not pin memory forever.
+ *
+ * @param buffer The message buffer that was used.
+ * @param size The number of bytes the message used.
+ */
+static void buffer_release(struct property_list_service_buffer *buffer, uint32_t size)
+{
+	if (size > buffer->high_water) {
+		buffer->high_water = size;
+	}
+	if (++buffer->messages < BUFFER_SHRINK_WINDOW) {
+		return;
+	}
+
+	if ((buffer->capacity > BUFFER_SHRINK_THRESHOLD) && (buffer->high_water < buffer->capacity / 4)) {
+		uint32_t capacity = BUFFER_MIN_CAPACITY;
+		while (capacity < buffer->high_water) {
+			capacity *= 2;
+		}
+		debug_info("shrinking buffer from %d to %d bytes", buffer->capacity, capacity);
+		free(buffer->data);
+		buffer->data = (char*)malloc(capacity);
+		buffer->capacity = (buffer->data) ? capacity : 0;
+	}
+	buffer->high_water = 0;
+	buffer->messages = 0;
+}
+
+/**
+ * Frees the memory held by the given message buffer.
+ *
+ * @param buffer The message buffer to free.
+ */
+static void buffer_free(struct property_list_service_buffer *buffer)
+{
+	free(buffer->data);
+	memset(buffer, '\0', sizeof(struct property_list_service_buffer));
+}
+
 /**
  * Creates a new property list service for the specified port.
  * 
@@ -76,7 +236,10 @@ property_list_service_error_t property_list_service_client_new(idevice_t device,
 
 	/* create client object */
 	property_list_service_client_t client_loc = (property_list_service_client_t)malloc(sizeof(struct property_list_service_client_private));
+	memset(client_loc, '\0', sizeof(struct property_list_service_client_private));
 	client_loc->connection = connection;
+	client_loc->encoding = IDEVICE_PLIST_ENCODING_XML;
+	client_loc->max_frame_size = PROPERTY_LIST_SERVICE_DEFAULT_MAX_FRAME_SIZE;
 
 	*client = client_loc;
 
@@ -97,11 +260,86 @@ property_list_service_error_t property_list_service_client_free(property_list_se
 	if (!client)
 		return PROPERTY_LIST_SERVICE_E_INVALID_ARG;
 
-	property_list_service_error_t err = idevice_to_property_list_service_error(idevice_disconnect(client->connection));
+	property_list_service_error_t err = PROPERTY_LIST_SERVICE_E_SUCCESS;
+	if (client->connection)
+		err = idevice_to_property_list_service_error(idevice_disconnect(client->connection));
+	free(client->view_copy);
+	buffer_free(&client->send_buffer);
+	buffer_free(&client->recv_buffer);
 	free(client);
 	return err;
 }
 
+/**
+ * Looks up the preferred plist encoding for the given service.
+ *
+ * @param service The name of the service, as passed to
+ *     lockdownd_start_service.
+ *
+ * @return The encoding to use for the service, IDEVICE_PLIST_ENCODING_XML
+ *     if the service is not known.
+ */
+enum idevice_plist_encoding property_list_service_get_service_encoding(const char *service)
+{
+	int i = 0;
+
+	if (!service)
+		return IDEVICE_PLIST_ENCODING_XML;
+
+	while (service_encodings[i].service) {
+		if (!strcmp(service_encodings[i].service, service)) {
+			return service_encodings[i].encoding;
+		}
+		i++;
+	}
+	return IDEVICE_PLIST_ENCODING_XML;
+}
+
+/**
+ * Sets the encoding used by property_list_service_send_plist for the given
+ * property list service client.
+ *
+ * @param client The property list service client to configure.
+ * @param encoding IDEVICE_PLIST_ENCODING_XML or IDEVICE_PLIST_ENCODING_BINARY.
+ *
+ * @return PROPERTY_LIST_SERVICE_E_SUCCESS on success, or
+ *     PROPERTY_LIST_SERVICE_E_INVALID_ARG when client is NULL or encoding
+ *     is invalid.
+ */
+property_list_service_error_t property_list_service_set_encoding(property_list_service_client_t client, enum idevice_plist_encoding encoding)
+{
+	if (!client)
+		return PROPERTY_LIST_SERVICE_E_INVALID_ARG;
+
+	if ((encoding != IDEVICE_PLIST_ENCODING_XML) && (encoding != IDEVICE_PLIST_ENCODING_BINARY))
+		return PROPERTY_LIST_SERVICE_E_INVALID_ARG;
+
+	client->encoding = encoding;
+	return PROPERTY_LIST_SERVICE_E_SUCCESS;
+}
+
+/**
+ * Sets the maximum size of a plist frame the given client accepts.
+ * Frames announcing a larger size are read and discarded without being
+ * buffered, and the receive fails with
+ * PROPERTY_LIST_SERVICE_E_FRAME_TOO_LARGE. The connection stays usable.
+ *
+ * @param client The property list service client to configure.
+ * @param max_frame_size The maximum frame size in bytes, or 0 to restore
+ *     PROPERTY_LIST_SERVICE_DEFAULT_MAX_FRAME_SIZE.
+ *
+ * @return PROPERTY_LIST_SERVICE_E_SUCCESS on success, or
+ *     PROPERTY_LIST_SERVICE_E_INVALID_ARG when client is NULL.
+ */
+property_list_service_error_t property_list_service_set_max_frame_size(property_list_service_client_t client, uint32_t max_frame_size)
+{
+	if (!client)
+		return PROPERTY_LIST_SERVICE_E_INVALID_ARG;
+
+	client->max_frame_size = (max_frame_size > 0) ? max_frame_size : PROPERTY_LIST_SERVICE_DEFAULT_MAX_FRAME_SIZE;
+	return PROPERTY_LIST_SERVICE_E_SUCCESS;
+}
+
 /**
  * Sends a plist using the given property list service client.
  * Internally used generic plist send function.
@@ -120,9 +358,11 @@ static property_list_service_error_t internal_plist_send(property_list_service_c
 {
 	property_list_service_error_t res = PROPERTY_LIST_SERVICE_E_UNKNOWN_ERROR;
 	char *content = NULL;
+	char *frame = NULL;
 	uint32_t length = 0;
 	uint32_t nlen = 0;
-	int bytes = 0;
+	uint32_t sent = 0;
+	uint32_t bytes = 0;
 
 	if (!client || (client && !client->connection) || !plist) {
 		return PROPERTY_LIST_SERVICE_E_INVALID_ARG;
@@ -140,20 +380,32 @@ static property_list_service_error_t internal_plist_send(property_list_service_c
 
 	nlen = GUINT32_TO_BE(length);
 	debug_info("sending %d bytes", length);
-	idevice_connection_send(client->connection, (const char*)&nlen, sizeof(nlen), (uint32_t*)&bytes);
-	if (bytes == sizeof(nlen)) {
-		idevice_connection_send(client->connection, content, length, (uint32_t*)&bytes);
-		if (bytes > 0) {
-			debug_info("sent %d bytes", bytes);
-			debug_plist(plist);
-			if ((uint32_t)bytes == length) {
-				res = PROPERTY_LIST_SERVICE_E_SUCCESS;
-			} else {
-				debug_info("ERROR: Could not send all data (%d of %d)!", bytes, length);
-			}
+	if (length <= SEND_COALESCE_MAX) {
+		/* send length header and plist in one go to save a round trip
+		 * through the transport (and a separate SSL record) */
+		frame = buffer_reserve(&client->send_buffer, sizeof(nlen) + length);
+	}
+	if (frame) {
+		memcpy(frame, &nlen, sizeof(nlen));
+		memcpy(frame + sizeof(nlen), content, length);
+		idevice_connection_send(client->connection, frame, sizeof(nlen) + length, &sent);
+		buffer_release(&client->send_buffer, sizeof(nlen) + length);
+	} else {
+		idevice_connection_send(client->connection, (const char*)&nlen, sizeof(nlen), &sent);
+		if (sent == sizeof(nlen)) {
+			bytes = 0;
+			idevice_connection_send(client->connection, content, length, &bytes);
+			sent += bytes;
 		}
 	}
-	if (bytes <= 0) {
+	/* sent counts the length header as well as the plist */
+	if (sent == sizeof(nlen) + length) {
+		debug_info("sent %d bytes", length);
+		debug_plist(plist);
+		res = PROPERTY_LIST_SERVICE_E_SUCCESS;
+	} else if (sent > 0) {
+		debug_info("ERROR: Could not send all data (%d of %d)!", sent, (uint32_t)(sizeof(nlen) + length));
+	} else {
 		debug_info("ERROR: sending to device failed.");
 	}
 
@@ -162,6 +414,106 @@ static property_list_service_error_t internal_plist_send(property_list_service_c
 	return res;
 }
 
+/**
+ * Sends a plist using the encoding configured for the given client.
+ *
+ * @see property_list_service_set_encoding
+ *
+ * @param client The property list service client to use for sending.
+ * @param plist plist to send
+ *
+ * @return PROPERTY_LIST_SERVICE_E_SUCCESS on success,
+ *      PROPERTY_LIST_SERVICE_E_INVALID_ARG when client or plist is NULL,
+ *      PROPERTY_LIST_SERVICE_E_PLIST_ERROR when dict is not a valid plist,
+ *      or PROPERTY_LIST_SERVICE_E_UNKNOWN_ERROR when an unspecified error occurs.
+ */
+property_list_service_error_t property_list_service_send_plist(property_list_service_client_t client, plist_t plist)
+{
+	if (!client)
+		return PROPERTY_LIST_SERVICE_E_INVALID_ARG;
+
+	return internal_plist_send(client, plist, (client->encoding == IDEVICE_PLIST_ENCODING_BINARY));
+}
+
+/**
+ * Sends several plists back-to-back using the encoding configured for the
+ * given client. All frames are serialized into the client's send buffer
+ * and handed to the connection with a single send, so a batch of requests
+ * costs one transport write instead of one per request.
+ *
+ * @param client The property list service client to use for sending.
+ * @param plists Array of plists to send.
+ * @param count Number of plists in the array.
+ *
+ * @return PROPERTY_LIST_SERVICE_E_SUCCESS on success,
+ *      PROPERTY_LIST_SERVICE_E_INVALID_ARG when client, plists or one of
+ *      the plists is NULL, PROPERTY_LIST_SERVICE_E_PLIST_ERROR when one of
+ *      the plists could not be serialized, or
+ *      PROPERTY_LIST_SERVICE_E_UNKNOWN_ERROR when an unspecified error occurs.
+ */
+property_list_service_error_t property_list_service_send_plists(property_list_service_client_t client, plist_t *plists, uint32_t count)
+{
+	property_list_service_error_t res = PROPERTY_LIST_SERVICE_E_SUCCESS;
+	uint32_t total = 0;
+	uint32_t bytes = 0;
+	uint32_t i;
+
+	if (!client || !client->connection || !plists) {
+		return PROPERTY_LIST_SERVICE_E_INVALID_ARG;
+	}
+
+	for (i = 0; i < count; i++) {
+		char *content = NULL;
+		uint32_t length = 0;
+		uint32_t nlen = 0;
+		char *frame = NULL;
+
+		if (!plists[i]) {
+			res = PROPERTY_LIST_SERVICE_E_INVALID_ARG;
+			break;
+		}
+		if (client->encoding == IDEVICE_PLIST_ENCODING_BINARY) {
+			plist_to_bin(plists[i], &content, &length);
+		} else {
+			plist_to_xml(plists[i], &content, &length);
+		}
+		if (!content || length == 0) {
+			res = PROPERTY_LIST_SERVICE_E_PLIST_ERROR;
+			break;
+		}
+		if (length > G_MAXUINT32 - sizeof(nlen) - total) {
+			free(content);
+			res = PROPERTY_LIST_SERVICE_E_UNKNOWN_ERROR;
+			break;
+		}
+
+		frame = buffer_grow(&client->send_buffer, total + sizeof(nlen) + length, G_MAXUINT32);
+		if (!frame) {
+			free(content);
+			res = PROPERTY_LIST_SERVICE_E_UNKNOWN_ERROR;
+			break;
+		}
+		nlen = GUINT32_TO_BE(length);
+		memcpy(frame + total, &nlen, sizeof(nlen));
+		memcpy(frame + total + sizeof(nlen), content, length);
+		total += sizeof(nlen) + length;
+		free(content);
+		debug_plist(plists[i]);
+	}
+
+	if ((res == PROPERTY_LIST_SERVICE_E_SUCCESS) && (total > 0)) {
+		debug_info("sending %d plists in %d bytes", count, total);
+		idevice_connection_send(client->connection, client->send_buffer.data, total, &bytes);
+		if (bytes != total) {
+			debug_info("ERROR: Could not send all data (%d of %d)!", bytes, total);
+			res = PROPERTY_LIST_SERVICE_E_UNKNOWN_ERROR;
+		}
+	}
+	buffer_release(&client->send_buffer, total);
+
+	return res;
+}
+
 /**
  * Sends an XML plist.
  *
@@ -194,23 +546,287 @@ property_list_service_error_t property_list_service_send_binary_plist(property_l
 	return internal_plist_send(client, plist, 1);
 }
 
+/**
+ * Reads an unsigned big endian integer of the given size from a binary plist.
+ *
+ * @param ptr Pointer to the first byte of the integer.
+ * @param size Number of bytes the integer occupies (1 to 8).
+ *
+ * @return The integer value.
+ */
+static uint64_t bplist_read_uint(const unsigned char *ptr, uint8_t size)
+{
+	uint64_t value = 0;
+	uint8_t i;
+	for (i = 0; i < size; i++) {
+		value = (value << 8) | ptr[i];
+	}
+	return value;
+}
+
+/**
+ * Determines the element count of the binary plist object at the given
+ * offset, and where the object payload starts.
+ *
+ * @param bplist The binary plist data.
+ * @param length Size of the binary plist data.
+ * @param offset Offset of the object marker.
+ * @param count Set to the element count (bytes for data and strings).
+ * @param payload Set to the offset of the first payload byte.
+ *
+ * @return 1 on success, 0 if the object is malformed.
+ */
+static int bplist_object_size(const unsigned char *bplist, uint32_t length, uint64_t offset, uint64_t *count, uint64_t *payload)
+{
+	uint8_t info = bplist[offset] & 0x0F;
+
+	*payload = offset + 1;
+	if (info != 0x0F) {
+		*count = info;
+		return 1;
+	}
+
+	/* the size follows as an integer object */
+	if (*payload >= length || (bplist[*payload] & 0xF0) != 0x10)
+		return 0;
+	uint8_t size = 1 << (bplist[*payload] & 0x0F);
+	if (size > 8 || *payload + 1 + size > length)
+		return 0;
+	*count = bplist_read_uint(bplist + *payload + 1, size);
+	*payload += 1 + size;
+	return 1;
+}
+
+/**
+ * Counts how often an object is referenced by the arrays, sets and
+ * dictionaries of a binary plist, stopping at 2.
+ *
+ * @param bplist The binary plist data.
+ * @param length Size of the binary plist data.
+ * @param offset_table Offset of the offset table.
+ * @param offset_size Size of an offset table entry.
+ * @param ref_size Size of an object reference.
+ * @param num_objects Number of objects in the plist.
+ * @param ref The object to count the references of.
+ *
+ * @return 0, 1, or 2 for two or more references. Malformed containers
+ *         count as 2 so the object is not treated as referenced once.
+ */
+static int bplist_count_refs(const unsigned char *bplist, uint32_t length, uint64_t offset_table, uint8_t offset_size, uint8_t ref_size, uint64_t num_objects, uint64_t ref)
+{
+	/* the top object is referenced by the trailer */
+	int refs = (bplist_read_uint(bplist + length - 16, 8) == ref) ? 1 : 0;
+	uint64_t i;
+
+	for (i = 0; i < num_objects; i++) {
+		uint64_t offset = bplist_read_uint(bplist + offset_table + i * offset_size, offset_size);
+		uint64_t count = 0;
+		uint64_t payload = 0;
+		uint64_t j;
+		uint8_t type;
+
+		if (offset >= offset_table)
+			continue;
+		type = bplist[offset] & 0xF0;
+		if (type != 0xA0 && type != 0xC0 && type != 0xD0)
+			continue;
+		if (!bplist_object_size(bplist, length, offset, &count, &payload))
+			return 2;
+		/* dictionaries hold key and value references */
+		if (type == 0xD0) {
+			if (count > G_MAXUINT64 / 2)
+				return 2;
+			count *= 2;
+		}
+		if (payload > offset_table || count > (offset_table - payload) / ref_size)
+			return 2;
+		for (j = 0; j < count; j++) {
+			if (bplist_read_uint(bplist + payload + j * ref_size, ref_size) == ref && ++refs > 1)
+				return 2;
+		}
+	}
+
+	return refs;
+}
+
+/**
+ * Looks for a data object stored under the given key in any dictionary of
+ * a binary plist, without parsing it into a plist tree. Data objects that
+ * are referenced more than once are not reported, since the caller blanks
+ * the object in place.
+ *
+ * @param bplist The binary plist data.
+ * @param length Size of the binary plist data.
+ * @param key The dictionary key to look for.
+ * @param marker Set to the offset of the data object marker.
+ * @param data Set to the offset of the first data byte.
+ * @param datalen Set to the number of data bytes.
+ *
+ * @return 1 if a data object was found, 0 otherwise.
+ */
+static int bplist_find_data(const unsigned char *bplist, uint32_t length, const char *key, uint32_t *marker, uint32_t *data, uint32_t *datalen)
+{
+	const unsigned char *trailer;
+	uint8_t offset_size;
+	uint8_t ref_size;
+	uint64_t num_objects;
+	uint64_t offset_table;
+	uint64_t i;
+	size_t keylen = strlen(key);
+
+	if (length < 8 + 32 || memcmp(bplist, "bplist00", 8))
+		return 0;
+
+	trailer = bplist + length - 32;
+	offset_size = trailer[6];
+	ref_size = trailer[7];
+	num_objects = bplist_read_uint(trailer + 8, 8);
+	offset_table = bplist_read_uint(trailer + 24, 8);
+
+	if (offset_size < 1 || offset_size > 8 || ref_size < 1 || ref_size > 8)
+		return 0;
+	if (offset_table >= length || num_objects > (length - offset_table) / offset_size)
+		return 0;
+
+#define BPLIST_OBJECT_OFFSET(index) bplist_read_uint(bplist + offset_table + (index) * offset_size, offset_size)
+
+	for (i = 0; i < num_objects; i++) {
+		uint64_t offset = BPLIST_OBJECT_OFFSET(i);
+		uint64_t count = 0;
+		uint64_t payload = 0;
+		uint64_t j;
+
+		if (offset >= offset_table || (bplist[offset] & 0xF0) != 0xD0)
+			continue;
+		if (!bplist_object_size(bplist, length, offset, &count, &payload))
+			continue;
+		/* count comes from the device, avoid overflowing the product */
+		if (payload > offset_table || count > (offset_table - payload) / (2 * ref_size))
+			continue;
+
+		for (j = 0; j < count; j++) {
+			uint64_t keyref = bplist_read_uint(bplist + payload + j * ref_size, ref_size);
+			uint64_t valref = bplist_read_uint(bplist + payload + (count + j) * ref_size, ref_size);
+			uint64_t koff, voff, kcount, kpayload, vcount, vpayload;
+
+			if (keyref >= num_objects || valref >= num_objects)
+				continue;
+			koff = BPLIST_OBJECT_OFFSET(keyref);
+			voff = BPLIST_OBJECT_OFFSET(valref);
+			if (koff >= offset_table || voff >= offset_table)
+				continue;
+
+			/* only ASCII string keys are compared */
+			if ((bplist[koff] & 0xF0) != 0x50 || (bplist[voff] & 0xF0) != 0x40)
+				continue;
+			if (!bplist_object_size(bplist, length, koff, &kcount, &kpayload) || kcount != keylen || kpayload > offset_table || kcount > offset_table - kpayload)
+				continue;
+			if (memcmp(bplist + kpayload, key, keylen))
+				continue;
+			if (!bplist_object_size(bplist, length, voff, &vcount, &vpayload) || vpayload > offset_table || vcount > offset_table - vpayload)
+				continue;
+			if (bplist_count_refs(bplist, length, offset_table, offset_size, ref_size, num_objects, valref) != 1)
+				return 0;
+
+			*marker = (uint32_t)voff;
+			*data = (uint32_t)vpayload;
+			*datalen = (uint32_t)vcount;
+			return 1;
+		}
+	}
+
+#undef BPLIST_OBJECT_OFFSET
+
+	return 0;
+}
+
+/**
+ * Releases the data handed out by the previous receive that used a data
+ * view, and gives the receive buffer back to the reuse logic.
+ *
+ * @param client The property list service client.
+ */
+static void release_data_view(property_list_service_client_t client)
+{
+	if (client->view_copy) {
+		free(client->view_copy);
+		client->view_copy = NULL;
+	}
+	if (client->view_pending) {
+		buffer_release(&client->recv_buffer, client->view_pending);
+		client->view_pending = 0;
+	}
+}
+
+/**
+ * Reads and discards the given number of bytes from the client connection,
+ * so that an over-limit frame does not leave the stream out of sync. No
+ * memory is allocated, so this also works when allocating failed.
+ *
+ * @param client The property list service client.
+ * @param length The number of bytes to discard.
+ *
+ * @return PROPERTY_LIST_SERVICE_E_SUCCESS when all bytes were discarded,
+ *     or PROPERTY_LIST_SERVICE_E_MUX_ERROR when reading failed.
+ */
+static property_list_service_error_t drain_frame(property_list_service_client_t client, uint32_t length)
+{
+	char scratch[DRAIN_CHUNK_SIZE];
+	uint32_t bytes = 0;
+
+	while (length > 0) {
+		uint32_t chunk = (length < sizeof(scratch)) ? length : sizeof(scratch);
+		bytes = 0;
+		idevice_connection_receive(client->connection, scratch, chunk, &bytes);
+		if (bytes <= 0) {
+			return PROPERTY_LIST_SERVICE_E_MUX_ERROR;
+		}
+		length -= bytes;
+	}
+	return PROPERTY_LIST_SERVICE_E_SUCCESS;
+}
+
+/**
+ * Closes the connection of a client whose stream can no longer be trusted.
+ * All further operations on the client fail with
+ * PROPERTY_LIST_SERVICE_E_INVALID_ARG.
+ *
+ * @param client The property list service client.
+ */
+static void close_connection(property_list_service_client_t client)
+{
+	if (client->connection) {
+		idevice_disconnect(client->connection);
+		client->connection = NULL;
+	}
+}
+
 /**
  * Receives a plist using the given property list service client.
  * Internally used generic plist receive function.
  *
+ * If key and data are given, the first data node that is stored under key
+ * in any dictionary of the received plist is not copied into the plist
+ * tree. Instead, data is set to point to its bytes in the receive buffer
+ * and the data node in the returned plist is left empty.
+ *
  * @param client The property list service client to use for receiving
  * @param plist pointer to a plist_t that will point to the received plist
  *      upon successful return
  * @param timeout Maximum time in milliseconds to wait for data.
+ * @param key Dictionary key of the data node to return as a view, or NULL.
+ * @param data Set to the borrowed data, or NULL if no such node was found.
+ * @param length Set to the size of the borrowed data.
  *
  * @return PROPERTY_LIST_SERVICE_E_SUCCESS on success,
  *      PROPERTY_LIST_SERVICE_E_INVALID_ARG when client or *plist is NULL,
  *      PROPERTY_LIST_SERVICE_E_PLIST_ERROR when the received data cannot be
  *      converted to a plist, PROPERTY_LIST_SERVICE_E_MUX_ERROR when a
- *      communication error occurs, or PROPERTY_LIST_SERVICE_E_UNKNOWN_ERROR
- *      when an unspecified error occurs.
+ *      communication error occurs, PROPERTY_LIST_SERVICE_E_FRAME_TOO_LARGE
+ *      when the frame exceeded the client's maximum frame size, or
+ *      PROPERTY_LIST_SERVICE_E_UNKNOWN_ERROR when an unspecified error occurs.
  */
-static property_list_service_error_t internal_plist_receive_timeout(property_list_service_client_t client, plist_t *plist, unsigned int timeout)
+static property_list_service_error_t internal_plist_receive_timeout(property_list_service_client_t client, plist_t *plist, unsigned int timeout, const char *key, const char **data, uint64_t *length)
 {
 	property_list_service_error_t res = PROPERTY_LIST_SERVICE_E_UNKNOWN_ERROR;
 	uint32_t pktlen = 0;
@@ -220,29 +836,78 @@ static property_list_service_error_t internal_plist_receive_timeout(property_lis
 		return PROPERTY_LIST_SERVICE_E_INVALID_ARG;
 	}
 
+	/* any view handed out by the previous receive is invalid from now on */
+	release_data_view(client);
+	if (data) {
+		*data = NULL;
+		*length = 0;
+	}
+
 	idevice_connection_receive_timeout(client->connection, (char*)&pktlen, sizeof(pktlen), &bytes, timeout);
 	debug_info("initial read=%i", bytes);
 	if (bytes < 4) {
 		debug_info("initial read failed!");
 		return PROPERTY_LIST_SERVICE_E_MUX_ERROR;
 	} else {
-		if ((char)pktlen == 0) { /* prevent huge buffers */
-			uint32_t curlen = 0;
-			char *content = NULL;
-			pktlen = GUINT32_FROM_BE(pktlen);
-			debug_info("%d bytes following", pktlen);
-			content = (char*)malloc(pktlen);
-
-			while (curlen < pktlen) {
-				idevice_connection_receive(client->connection, content+curlen, pktlen-curlen, &bytes);
-				if (bytes <= 0) {
-					res = PROPERTY_LIST_SERVICE_E_MUX_ERROR;
-					break;
-				}
-				debug_info("received %d bytes", bytes);
-				curlen += bytes;
+		uint32_t curlen = 0;
+		char *content = NULL;
+		int borrowed = 0;
+		pktlen = GUINT32_FROM_BE(pktlen);
+		debug_info("%d bytes following", pktlen);
+
+		if (pktlen > client->max_frame_size) {
+			if (pktlen > DRAIN_FRAME_MAX) {
+				debug_info("ERROR: frame length %u is not plausible, closing connection", pktlen);
+				close_connection(client);
+				return PROPERTY_LIST_SERVICE_E_MUX_ERROR;
+			}
+			debug_info("ERROR: frame of %d bytes exceeds limit of %d bytes, discarding", pktlen, client->max_frame_size);
+			res = drain_frame(client, pktlen);
+			return (res == PROPERTY_LIST_SERVICE_E_SUCCESS) ? PROPERTY_LIST_SERVICE_E_FRAME_TOO_LARGE : res;
+		}
+
+		/* grow the buffer as data actually arrives instead of trusting
+		 * the announced size up front */
+		while (curlen < pktlen) {
+			uint32_t want = pktlen - curlen;
+			if (want > RECEIVE_CHUNK_SIZE) {
+				want = RECEIVE_CHUNK_SIZE;
+			}
+			content = buffer_grow(&client->recv_buffer, curlen + want, (pktlen > BUFFER_MIN_CAPACITY) ? pktlen : BUFFER_MIN_CAPACITY);
+			if (!content) {
+				debug_info("ERROR: could not allocate %d bytes", curlen + want);
+				/* skip the rest of the frame to stay in sync */
+				res = drain_frame(client, pktlen - curlen);
+				if (res == PROPERTY_LIST_SERVICE_E_SUCCESS)
+					res = PROPERTY_LIST_SERVICE_E_UNKNOWN_ERROR;
+				break;
 			}
-			if (!memcmp(content, "bplist00", 8)) {
+			want = client->recv_buffer.capacity - curlen;
+			if (want > pktlen - curlen) {
+				want = pktlen - curlen;
+			}
+			bytes = 0;
+			idevice_connection_receive(client->connection, content+curlen, want, &bytes);
+			if (bytes <= 0) {
+				res = PROPERTY_LIST_SERVICE_E_MUX_ERROR;
+				break;
+			}
+			debug_info("received %d bytes", bytes);
+			curlen += bytes;
+		}
+		if ((pktlen > 0) && (curlen == pktlen)) {
+			if ((pktlen > 8) && !memcmp(content, "bplist00", 8)) {
+				uint32_t marker = 0;
+				uint32_t offset = 0;
+				uint32_t datalen = 0;
+				if (key && data && bplist_find_data((unsigned char*)content, pktlen, key, &marker, &offset, &datalen)) {
+					/* turn the node into an empty data object so
+					 * libplist does not copy the payload */
+					content[marker] = 0x40;
+					*data = content + offset;
+					*length = datalen;
+					borrowed = 1;
+				}
 				plist_from_bin(content, pktlen, plist);
 			} else {
 				plist_from_xml(content, pktlen, plist);
@@ -252,11 +917,19 @@ static property_list_service_error_t internal_plist_receive_timeout(property_lis
 				res = PROPERTY_LIST_SERVICE_E_SUCCESS;
 			} else {
 				res = PROPERTY_LIST_SERVICE_E_PLIST_ERROR;
+				borrowed = 0;
+				if (data) {
+					*data = NULL;
+					*length = 0;
+				}
 			}
-			free(content);
-			content = NULL;
+		} else if (pktlen == 0) {
+			res = PROPERTY_LIST_SERVICE_E_PLIST_ERROR;
+		}
+		if (borrowed) {
+			client->view_pending = curlen;
 		} else {
-			res = PROPERTY_LIST_SERVICE_E_UNKNOWN_ERROR;
+			buffer_release(&client->recv_buffer, curlen);
 		}
 	}
 	return res;
@@ -276,12 +949,13 @@ static property_list_service_error_t internal_plist_receive_timeout(property_lis
  *      PROPERTY_LIST_SERVICE_E_INVALID_ARG when connection or *plist is NULL,
  *      PROPERTY_LIST_SERVICE_E_PLIST_ERROR when the received data cannot be
  *      converted to a plist, PROPERTY_LIST_SERVICE_E_MUX_ERROR when a
- *      communication error occurs, or PROPERTY_LIST_SERVICE_E_UNKNOWN_ERROR when
- *      an unspecified error occurs.
+ *      communication error occurs, PROPERTY_LIST_SERVICE_E_FRAME_TOO_LARGE
+ *      when the frame exceeded the client's maximum frame size, or
+ *      PROPERTY_LIST_SERVICE_E_UNKNOWN_ERROR when an unspecified error occurs.
  */
 property_list_service_error_t property_list_service_receive_plist_with_timeout(property_list_service_client_t client, plist_t *plist, unsigned int timeout)
 {
-	return internal_plist_receive_timeout(client, plist, timeout);
+	return internal_plist_receive_timeout(client, plist, timeout, NULL, NULL, NULL);
 }
 
 /**
@@ -300,12 +974,146 @@ property_list_service_error_t property_list_service_receive_plist_with_timeout(p
  *      PROPERTY_LIST_SERVICE_E_INVALID_ARG when client or *plist is NULL,
  *      PROPERTY_LIST_SERVICE_E_PLIST_ERROR when the received data cannot be
  *      converted to a plist, PROPERTY_LIST_SERVICE_E_MUX_ERROR when a
- *      communication error occurs, or PROPERTY_LIST_SERVICE_E_UNKNOWN_ERROR when
- *      an unspecified error occurs.
+ *      communication error occurs, PROPERTY_LIST_SERVICE_E_FRAME_TOO_LARGE
+ *      when the frame exceeded the client's maximum frame size, or
+ *      PROPERTY_LIST_SERVICE_E_UNKNOWN_ERROR when an unspecified error occurs.
  */
 property_list_service_error_t property_list_service_receive_plist(property_list_service_client_t client, plist_t *plist)
 {
-	return internal_plist_receive_timeout(client, plist, 10000);
+	return internal_plist_receive_timeout(client, plist, 10000, NULL, NULL, NULL);
+}
+
+/**
+ * Recursively looks for a data node stored under the given key in any
+ * dictionary of a plist tree.
+ *
+ * @param node The plist node to start searching at.
+ * @param key The dictionary key to look for.
+ *
+ * @return The data node, or NULL if no such node exists.
+ */
+static plist_t plist_find_data_node(plist_t node, const char *key)
+{
+	plist_t found = NULL;
+
+	if (plist_get_node_type(node) == PLIST_DICT) {
+		plist_dict_iter iter = NULL;
+		char *item_key = NULL;
+		plist_t item = NULL;
+
+		plist_dict_new_iter(node, &iter);
+		if (!iter)
+			return NULL;
+		do {
+			item_key = NULL;
+			item = NULL;
+			plist_dict_next_item(node, iter, &item_key, &item);
+			if (item_key && item) {
+				if (!strcmp(item_key, key) && (plist_get_node_type(item) == PLIST_DATA)) {
+					found = item;
+				} else {
+					found = plist_find_data_node(item, key);
+				}
+			}
+			free(item_key);
+		} while (item && !found);
+		free(iter);
+	} else if (plist_get_node_type(node) == PLIST_ARRAY) {
+		uint32_t i;
+		for (i = 0; i < plist_array_get_size(node) && !found; i++) {
+			found = plist_find_data_node(plist_array_get_item(node, i), key);
+		}
+	}
+	return found;
+}
+
+/**
+ * Receives a plist and returns the payload of one large data node as a
+ * view instead of copying it into the plist tree.
+ *
+ * For binary plists the view points directly into the client's receive
+ * buffer, and the data node in the returned plist is left empty. For XML
+ * plists the payload is copied out once. In both cases the view stays
+ * valid until the next receive on this client or until the client is
+ * freed, and must not be freed by the caller.
+ *
+ * @param client The property list service client to use for receiving
+ * @param plist pointer to a plist_t that will point to the received plist
+ *      upon successful return
+ * @param key The dictionary key of the data node, searched in all
+ *      dictionaries of the plist.
+ * @param data Set to the data view, or NULL if the plist has no data node
+ *      stored under key.
+ * @param length Set to the size of the data view.
+ *
+ * @return PROPERTY_LIST_SERVICE_E_SUCCESS on success,
+ *      PROPERTY_LIST_SERVICE_E_INVALID_ARG when an argument is NULL,
+ *      PROPERTY_LIST_SERVICE_E_PLIST_ERROR when the received data cannot be
+ *      converted to a plist, PROPERTY_LIST_SERVICE_E_MUX_ERROR when a
+ *      communication error occurs, PROPERTY_LIST_SERVICE_E_FRAME_TOO_LARGE
+ *      when the frame exceeded the client's maximum frame size, or
+ *      PROPERTY_LIST_SERVICE_E_UNKNOWN_ERROR when an unspecified error occurs.
+ */
+property_list_service_error_t property_list_service_receive_plist_with_data(property_list_service_client_t client, plist_t *plist, const char *key, const char **data, uint64_t *length)
+{
+	if (!key || !data || !length)
+		return PROPERTY_LIST_SERVICE_E_INVALID_ARG;
+
+	property_list_service_error_t res = internal_plist_receive_timeout(client, plist, 10000, key, data, length);
+	if ((res == PROPERTY_LIST_SERVICE_E_SUCCESS) && !*data) {
+		/* XML plist or no binary data object found; copy it out once */
+		plist_t node = plist_find_data_node(*plist, key);
+		if (node) {
+			plist_get_data_val(node, &client->view_copy, length);
+			*data = client->view_copy;
+		}
+	}
+	return res;
+}
+
+/**
+ * Checks whether the next plist can be received without waiting for more
+ * data from the device, i.e. whether its whole frame already arrived. Frames
+ * larger than the socket buffer can never be complete there and count as
+ * ready once it holds FRAME_READY_MAX bytes. A closed connection counts as
+ * ready so the next receive reports the error.
+ *
+ * @note For SSL connections only the decrypted data buffered by SSL can be
+ *     inspected, so any buffered data counts as ready.
+ *
+ * @param client The property list service client to check.
+ *
+ * @return 1 if a plist can be received right away, 0 otherwise.
+ */
+int property_list_service_frame_ready(property_list_service_client_t client)
+{
+	uint32_t pktlen = 0;
+	ssize_t res;
+	int avail = 0;
+	int fd;
+
+	if (!client || !client->connection)
+		return 1;
+
+	if (client->connection->ssl_data)
+		return (idevice_connection_get_pending(client->connection) > 0);
+
+	fd = idevice_connection_get_fd(client->connection);
+	if (fd < 0)
+		return 1;
+
+	res = recv(fd, &pktlen, sizeof(pktlen), MSG_PEEK | MSG_DONTWAIT);
+	if (res == 0)
+		return 1;
+	if (res < 0)
+		return (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+	if (res < (ssize_t)sizeof(pktlen))
+		return 0;
+
+	if (ioctl(fd, FIONREAD, &avail) < 0)
+		return 1;
+	pktlen = GUINT32_FROM_BE(pktlen);
+	return ((uint32_t)avail >= sizeof(pktlen) + pktlen) || (avail >= FRAME_READY_MAX);
 }
 
 /**
@@ -29,11 +29,29 @@
 #define PROPERTY_LIST_SERVICE_E_PLIST_ERROR           -2
 #define PROPERTY_LIST_SERVICE_E_MUX_ERROR             -3
 #define PROPERTY_LIST_SERVICE_E_SSL_ERROR             -4
+#define PROPERTY_LIST_SERVICE_E_FRAME_TOO_LARGE       -5
 
 #define PROPERTY_LIST_SERVICE_E_UNKNOWN_ERROR       -256
 
+/** Default maximum size of a received plist frame. */
+#define PROPERTY_LIST_SERVICE_DEFAULT_MAX_FRAME_SIZE (16 * 1024 * 1024)
+
+/** Growable buffer that is reused for subsequent messages of a client. */
+struct property_list_service_buffer {
+	char *data;
+	uint32_t capacity;
+	uint32_t high_water;
+	uint32_t messages;
+};
+
 struct property_list_service_client_private {
 	idevice_connection_t connection;
+	enum idevice_plist_encoding encoding;
+	uint32_t max_frame_size;
+	struct property_list_service_buffer send_buffer;
+	struct property_list_service_buffer recv_buffer;
+	uint32_t view_pending;
+	char *view_copy;
 };
 
 typedef struct property_list_service_client_private *property_list_service_client_t;
@@ -44,15 +62,24 @@ typedef int16_t property_list_service_error_t;
 property_list_service_error_t property_list_service_client_new(idevice_t device, uint16_t port, property_list_service_client_t *client);
 property_list_service_error_t property_list_service_client_free(property_list_service_client_t client);
 
+/* encoding */
+enum idevice_plist_encoding property_list_service_get_service_encoding(const char *service);
+property_list_service_error_t property_list_service_set_encoding(property_list_service_client_t client, enum idevice_plist_encoding encoding);
+
 /* sending */
+property_list_service_error_t property_list_service_send_plist(property_list_service_client_t client, plist_t plist);
+property_list_service_error_t property_list_service_send_plists(property_list_service_client_t client, plist_t *plists, uint32_t count);
 property_list_service_error_t property_list_service_send_xml_plist(property_list_service_client_t client, plist_t plist);
 property_list_service_error_t property_list_service_send_binary_plist(property_list_service_client_t client, plist_t plist);
 
 /* receiving */
 property_list_service_error_t property_list_service_receive_plist_with_timeout(property_list_service_client_t client, plist_t *plist, unsigned int timeout);
 property_list_service_error_t property_list_service_receive_plist(property_list_service_client_t client, plist_t *plist);
+property_list_service_error_t property_list_service_receive_plist_with_data(property_list_service_client_t client, plist_t *plist, const char *key, const char **data, uint64_t *length);
+int property_list_service_frame_ready(property_list_service_client_t client);
 
 /* misc */
+property_list_service_error_t property_list_service_set_max_frame_size(property_list_service_client_t client, uint32_t max_frame_size);
 property_list_service_error_t property_list_service_enable_ssl(property_list_service_client_t client);
 property_list_service_error_t property_list_service_disable_ssl(property_list_service_client_t client);
 
@@ -26,8 +26,12 @@
 
 #include "sbservices.h"
 #include "property_list_service.h"
+#include "userpref.h"
 #include "debug.h"
 
+/** Number of icon requests sent ahead of the reply being read */
+#define SBS_ICON_PIPELINE_DEPTH 8
+
 /**
  * Locks an sbservices client, used for thread safety.
  *
@@ -102,9 +106,12 @@ sbservices_error_t sbservices_client_new(idevice_t device, uint16_t port, sbserv
 		return err;
 	}
 
+	property_list_service_set_encoding(plistclient, property_list_service_get_service_encoding("com.apple.springboardservices"));
+
 	sbservices_client_t client_loc = (sbservices_client_t) malloc(sizeof(struct sbservices_client_private));
 	client_loc->parent = plistclient;
 	client_loc->mutex = g_mutex_new();
+	client_loc->icon_state = NULL;
 
 	*client = client_loc;
 	return SBSERVICES_E_SUCCESS;
@@ -124,45 +131,56 @@ sbservices_error_t sbservices_client_free(sbservices_client_t client)
 	if (!client)
 		return SBSERVICES_E_INVALID_ARG;
 
-	sbservices_error_t err = sbservices_error(property_list_service_client_free(client->parent));
-	client->parent = NULL;
+	sbservices_error_t err = SBSERVICES_E_SUCCESS;
+	/* the connection is gone already if the client was invalidated */
+	if (client->parent) {
+		err = sbservices_error(property_list_service_client_free(client->parent));
+		client->parent = NULL;
+	}
 	if (client->mutex) {
 		g_mutex_free(client->mutex);
 	}
+	if (client->icon_state) {
+		plist_free(client->icon_state);
+	}
 	free(client);
 
 	return err;
 }
 
 /**
- * Gets the icon state of the connected device.
+ * Internally used function that keeps a copy of the icon state last read
+ * from or written to the device, so unchanged states need not be sent again.
  *
- * @param client The connected sbservices client to use.
- * @param state Pointer that will point to a newly allocated plist containing
- *     the current icon state. It is up to the caller to free the memory.
- *
- * @return SBSERVICES_E_SUCCESS on success, SBSERVICES_E_INVALID_ARG when
- *     client or state is invalid, or an SBSERVICES_E_* error code otherwise.
+ * @param client The sbservices client
+ * @param state The icon state, or NULL to forget it.
  */
-sbservices_error_t sbservices_get_icon_state(sbservices_client_t client, plist_t *state)
+static void sbservices_remember_icon_state(sbservices_client_t client, plist_t state)
 {
-	if (!client || !client->parent || !state)
-		return SBSERVICES_E_INVALID_ARG;
+	if (client->icon_state) {
+		plist_free(client->icon_state);
+	}
+	client->icon_state = state ? plist_copy(state) : NULL;
+}
 
+/**
+ * Internally used function that reads the icon state from the device.
+ *
+ * @note Must be called with the client locked.
+ */
+static sbservices_error_t sbservices_get_icon_state_unlocked(sbservices_client_t client, plist_t *state)
+{
 	sbservices_error_t res = SBSERVICES_E_UNKNOWN_ERROR;
 
 	plist_t dict = plist_new_dict();
 	plist_dict_insert_item(dict, "command", plist_new_string("getIconState"));
 
-	sbs_lock(client);
-
-	res = sbservices_error(property_list_service_send_binary_plist(client->parent, dict));
+	res = sbservices_error(property_list_service_send_plist(client->parent, dict));
+	plist_free(dict);
 	if (res != SBSERVICES_E_SUCCESS) {
 		debug_info("could not send plist, error %d", res);
-		goto leave_unlock;
+		return res;
 	}
-	plist_free(dict);
-	dict = NULL;
 
 	res = sbservices_error(property_list_service_receive_plist(client->parent, state));
 	if (res != SBSERVICES_E_SUCCESS) {
@@ -171,48 +189,85 @@ sbservices_error_t sbservices_get_icon_state(sbservices_client_t client, plist_t
 			plist_free(*state);
 			*state = NULL;
 		}
+	} else if (*state) {
+		sbservices_remember_icon_state(client, *state);
 	}
 
-leave_unlock:
-	if (dict) {
-		plist_free(dict);
-	}
-	sbs_unlock(client);
 	return res;
 }
 
 /**
- * Sets the icon state of the connected device.
+ * Gets the icon state of the connected device.
  *
  * @param client The connected sbservices client to use.
- * @param newstate A plist containing the new iconstate.
+ * @param state Pointer that will point to a newly allocated plist containing
+ *     the current icon state. It is up to the caller to free the memory.
  *
  * @return SBSERVICES_E_SUCCESS on success, SBSERVICES_E_INVALID_ARG when
- *     client or newstate is NULL, or an SBSERVICES_E_* error code otherwise.
+ *     client or state is invalid, or an SBSERVICES_E_* error code otherwise.
  */
-sbservices_error_t sbservices_set_icon_state(sbservices_client_t client, plist_t newstate)
+sbservices_error_t sbservices_get_icon_state(sbservices_client_t client, plist_t *state)
 {
-	if (!client || !client->parent || !newstate)
+	if (!client || !client->parent || !state)
 		return SBSERVICES_E_INVALID_ARG;
 
+	sbs_lock(client);
+	sbservices_error_t res = sbservices_get_icon_state_unlocked(client, state);
+	sbs_unlock(client);
+
+	return res;
+}
+
+/**
+ * Internally used function that sends a new icon state to the device.
+ *
+ * @note Must be called with the client locked.
+ */
+static sbservices_error_t sbservices_set_icon_state_unlocked(sbservices_client_t client, plist_t newstate)
+{
 	sbservices_error_t res = SBSERVICES_E_UNKNOWN_ERROR;
 
 	plist_t dict = plist_new_dict();
 	plist_dict_insert_item(dict, "command", plist_new_string("setIconState"));
 	plist_dict_insert_item(dict, "iconState", plist_copy(newstate));
 
-	sbs_lock(client);
-
-	res = sbservices_error(property_list_service_send_binary_plist(client->parent, dict));
+	res = sbservices_error(property_list_service_send_plist(client->parent, dict));
 	if (res != SBSERVICES_E_SUCCESS) {
 		debug_info("could not send plist, error %d", res);
+		sbservices_remember_icon_state(client, NULL);
+	} else {
+		/* the device does not answer, assume it took the new state */
+		sbservices_remember_icon_state(client, newstate);
 	}
 	/* NO RESPONSE */
 
-	if (dict) {
-		plist_free(dict);
-	}
+	plist_free(dict);
+	return res;
+}
+
+/**
+ * Sets the icon state of the connected device.
+ *
+ * The device never acknowledges the new state. Once it was sent, the client
+ * remembers it as the current state for sbservices_set_icon_state_if_changed
+ * even if the device rejected it; read the state with
+ * sbservices_get_icon_state to get the one the device actually has.
+ *
+ * @param client The connected sbservices client to use.
+ * @param newstate A plist containing the new iconstate.
+ *
+ * @return SBSERVICES_E_SUCCESS on success, SBSERVICES_E_INVALID_ARG when
+ *     client or newstate is NULL, or an SBSERVICES_E_* error code otherwise.
+ */
+sbservices_error_t sbservices_set_icon_state(sbservices_client_t client, plist_t newstate)
+{
+	if (!client || !client->parent || !newstate)
+		return SBSERVICES_E_INVALID_ARG;
+
+	sbs_lock(client);
+	sbservices_error_t res = sbservices_set_icon_state_unlocked(client, newstate);
 	sbs_unlock(client);
+
 	return res;
 }
 
@@ -244,7 +299,7 @@ sbservices_error_t sbservices_get_icon_pngdata(sbservices_client_t client, const
 
 	sbs_lock(client);
 
-	res = sbservices_error(property_list_service_send_binary_plist(client->parent, dict));
+	res = sbservices_error(property_list_service_send_plist(client->parent, dict));
 	if (res != SBSERVICES_E_SUCCESS) {
 		debug_info("could not send plist, error %d", res);
 		goto leave_unlock;
@@ -252,11 +307,17 @@ sbservices_error_t sbservices_get_icon_pngdata(sbservices_client_t client, const
 	plist_free(dict);
 
 	dict = NULL;
-	res = sbservices_error(property_list_service_receive_plist(client->parent, &dict));
-	if (res	== SBSERVICES_E_SUCCESS) {
-		plist_t node = plist_dict_get_item(dict, "pngData");
-		if (node) {
-			plist_get_data_val(node, pngdata, pngsize);
+	const char *data = NULL;
+	uint64_t length = 0;
+	res = sbservices_error(property_list_service_receive_plist_with_data(client->parent, &dict, "pngData", &data, &length));
+	if ((res == SBSERVICES_E_SUCCESS) && data) {
+		/* the PNG data is only borrowed from the receive buffer */
+		*pngdata = (char*)malloc(length);
+		if (*pngdata) {
+			memcpy(*pngdata, data, length);
+			*pngsize = length;
+		} else {
+			res = SBSERVICES_E_UNKNOWN_ERROR;
 		}
 	}
 
@@ -269,3 +330,482 @@ leave_unlock:
 
 }
 
+/**
+ * Internally used function that sends an icon request.
+ */
+static sbservices_error_t sbservices_send_icon_request(sbservices_client_t client, const char *bundleId)
+{
+	plist_t dict = plist_new_dict();
+	plist_dict_insert_item(dict, "command", plist_new_string("getIconPNGData"));
+	plist_dict_insert_item(dict, "bundleId", plist_new_string(bundleId));
+
+	sbservices_error_t res = sbservices_error(property_list_service_send_plist(client->parent, dict));
+	plist_free(dict);
+	return res;
+}
+
+/**
+ * Internally used function that closes the connection of a client whose
+ * stream got out of sync. Later requests fail until the client is freed.
+ *
+ * @note Must be called with the client locked.
+ */
+static void sbservices_invalidate(sbservices_client_t client)
+{
+	debug_info("connection out of sync, closing it");
+	property_list_service_client_free(client->parent);
+	client->parent = NULL;
+}
+
+/**
+ * Internally used function that reads and discards the replies to icon
+ * requests still in flight after a failure, so the next request does not
+ * get a stale reply. If that fails too, the client is invalidated.
+ *
+ * @note Must be called with the client locked.
+ */
+static void sbservices_discard_replies(sbservices_client_t client, uint32_t count)
+{
+	while (count > 0) {
+		plist_t dict = NULL;
+		property_list_service_error_t err = property_list_service_receive_plist(client->parent, &dict);
+		if (dict)
+			plist_free(dict);
+		/* these leave the stream in sync */
+		if ((err != PROPERTY_LIST_SERVICE_E_SUCCESS) && (err != PROPERTY_LIST_SERVICE_E_PLIST_ERROR) && (err != PROPERTY_LIST_SERVICE_E_FRAME_TOO_LARGE)) {
+			sbservices_invalidate(client);
+			return;
+		}
+		count--;
+	}
+}
+
+/**
+ * Get the icons of many apps as PNG data at once.
+ *
+ * Icons with a version given are looked up in an on-disk cache first, which
+ * is keyed by bundle identifier and version only; the cached data is not
+ * compared with the icon on the device, so an icon that changes without a
+ * new version keeps being served from the cache. The remaining icons are
+ * requested from the device with several requests in flight, so the
+ * round-trip per icon is not paid one after another. Fetched icons with a
+ * version are added to the cache.
+ *
+ * @param client The connected sbservices client to use.
+ * @param icons Array of icons to get. For each, bundle_id has to be set and
+ *     version may be set to use the cache. The other fields are set on
+ *     return; pngdata has to be freed by the caller.
+ * @param count Number of entries in icons.
+ *
+ * @return SBSERVICES_E_SUCCESS if the requests could be processed, even if
+ *     single icons failed (see their error field), SBSERVICES_E_INVALID_ARG
+ *     when a parameter is invalid, or an SBSERVICES_E_* error code if the
+ *     communication with the device failed. Replies to requests still in
+ *     flight are discarded then; if the connection cannot be brought back
+ *     in sync it is closed and the client has to be freed.
+ */
+sbservices_error_t sbservices_get_icons(sbservices_client_t client, struct sbservices_icon *icons, uint32_t count)
+{
+	if (!client || !client->parent || !icons)
+		return SBSERVICES_E_INVALID_ARG;
+
+	sbservices_error_t res = SBSERVICES_E_SUCCESS;
+	int send_failed = 0;
+	uint32_t *pending = NULL;
+	uint32_t npending = 0;
+	uint32_t sent = 0;
+	uint32_t received = 0;
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		if (!icons[i].bundle_id)
+			return SBSERVICES_E_INVALID_ARG;
+	}
+
+	/* serve what we can from the cache */
+	pending = (uint32_t*)malloc(sizeof(uint32_t) * (count + 1));
+	for (i = 0; i < count; i++) {
+		icons[i].pngdata = NULL;
+		icons[i].pngsize = 0;
+		icons[i].from_cache = 0;
+		icons[i].error = SBSERVICES_E_UNKNOWN_ERROR;
+		if (icons[i].version && (userpref_get_cached_icon(icons[i].bundle_id, icons[i].version, &icons[i].pngdata, &icons[i].pngsize) == USERPREF_E_SUCCESS)) {
+			icons[i].from_cache = 1;
+			icons[i].error = SBSERVICES_E_SUCCESS;
+		} else {
+			pending[npending++] = i;
+		}
+	}
+	debug_info("%d of %d icons cached", count - npending, count);
+
+	sbs_lock(client);
+	while ((received < npending) && (res == SBSERVICES_E_SUCCESS)) {
+		/* keep the pipeline filled */
+		while ((sent < npending) && (sent - received < SBS_ICON_PIPELINE_DEPTH)) {
+			res = sbservices_send_icon_request(client, icons[pending[sent]].bundle_id);
+			if (res != SBSERVICES_E_SUCCESS) {
+				debug_info("could not send plist, error %d", res);
+				send_failed = 1;
+				break;
+			}
+			sent++;
+		}
+		if (res != SBSERVICES_E_SUCCESS)
+			break;
+
+		struct sbservices_icon *icon = &icons[pending[received]];
+		plist_t dict = NULL;
+		const char *data = NULL;
+		uint64_t length = 0;
+		res = sbservices_error(property_list_service_receive_plist_with_data(client->parent, &dict, "pngData", &data, &length));
+		if (res == SBSERVICES_E_SUCCESS) {
+			if (data) {
+				/* the PNG data is only borrowed from the receive buffer */
+				icon->pngdata = (char*)malloc(length);
+				if (icon->pngdata) {
+					memcpy(icon->pngdata, data, length);
+					icon->pngsize = length;
+					icon->error = SBSERVICES_E_SUCCESS;
+					if (icon->version) {
+						userpref_set_cached_icon(icon->bundle_id, icon->version, icon->pngdata, icon->pngsize);
+					}
+				}
+			} else {
+				icon->error = SBSERVICES_E_PLIST_ERROR;
+			}
+		} else {
+			icon->error = res;
+		}
+		if (dict)
+			plist_free(dict);
+		received++;
+	}
+	if (send_failed) {
+		/* part of a request might have been written */
+		sbservices_invalidate(client);
+	} else if (sent > received) {
+		sbservices_discard_replies(client, sent - received);
+	}
+	sbs_unlock(client);
+
+	/* requests that could not be completed */
+	for (i = received; i < npending; i++) {
+		icons[pending[i]].error = res;
+	}
+	free(pending);
+
+	return res;
+}
+
+/**
+ * Internally used function that collects the position of every icon in an
+ * icon state. Positions are the indices leading to the icon, joined by dots,
+ * e.g. "1.0.3".
+ *
+ * @param node The node to walk.
+ * @param path The position of node, "" for the root.
+ * @param positions Table to add identifier -> position to.
+ * @param order Array to append each identifier to, in layout order.
+ *
+ * @return The number of icons found more than once.
+ */
+static uint32_t sbs_collect_icons(plist_t node, const char *path, GHashTable *positions, GPtrArray *order)
+{
+	uint32_t duplicates = 0;
+	uint32_t i;
+
+	if (plist_get_node_type(node) == PLIST_DICT) {
+		char *identifier = NULL;
+		plist_t id_node = plist_dict_get_item(node, "displayIdentifier");
+		if (!id_node)
+			id_node = plist_dict_get_item(node, "bundleIdentifier");
+		if (id_node && (plist_get_node_type(id_node) == PLIST_STRING))
+			plist_get_string_val(id_node, &identifier);
+		if (identifier) {
+			if (g_hash_table_lookup(positions, identifier)) {
+				duplicates++;
+			} else {
+				gchar *key = g_strdup(identifier);
+				g_hash_table_insert(positions, key, g_strdup(path));
+				g_ptr_array_add(order, key);
+			}
+			free(identifier);
+		}
+		/* folders keep their icons in iconLists */
+		plist_t lists = plist_dict_get_item(node, "iconLists");
+		if (lists)
+			duplicates += sbs_collect_icons(lists, path, positions, order);
+	} else if (plist_get_node_type(node) == PLIST_ARRAY) {
+		for (i = 0; i < plist_array_get_size(node); i++) {
+			gchar *item_path = (path[0] != '\0') ? g_strdup_printf("%s.%u", path, i) : g_strdup_printf("%u", i);
+			duplicates += sbs_collect_icons(plist_array_get_item(node, i), item_path, positions, order);
+			g_free(item_path);
+		}
+	}
+
+	return duplicates;
+}
+
+/**
+ * Internally used function that adds a change to an array.
+ */
+static void sbs_append_icon_change(GArray *changes, enum sbservices_icon_change_type type, const char *identifier, const char *old_position, const char *new_position)
+{
+	sbservices_icon_change_t change;
+
+	change.type = type;
+	change.identifier = strdup(identifier);
+	change.old_position = old_position ? strdup(old_position) : NULL;
+	change.new_position = new_position ? strdup(new_position) : NULL;
+	g_array_append_val(changes, change);
+}
+
+/**
+ * Computes the icon changes between two icon states: icons that were added,
+ * removed or moved to another position.
+ *
+ * @param oldstate The icon state before, as returned by
+ *     sbservices_get_icon_state.
+ * @param newstate The icon state after.
+ * @param changes Pointer that will be set to an array of changes in layout
+ *     order, or NULL if no icon changed. Free it with
+ *     sbservices_icon_changes_free.
+ * @param count Pointer that will be set to the number of changes.
+ *
+ * @return SBSERVICES_E_SUCCESS on success or SBSERVICES_E_INVALID_ARG when a
+ *     parameter is NULL.
+ */
+sbservices_error_t sbservices_icon_state_diff(plist_t oldstate, plist_t newstate, sbservices_icon_change_t **changes, uint32_t *count)
+{
+	if (!oldstate || !newstate || !changes || !count)
+		return SBSERVICES_E_INVALID_ARG;
+
+	GHashTable *old_positions = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	GHashTable *new_positions = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	GPtrArray *old_order = g_ptr_array_new();
+	GPtrArray *new_order = g_ptr_array_new();
+	GArray *list = g_array_new(FALSE, FALSE, sizeof(sbservices_icon_change_t));
+	guint i;
+
+	sbs_collect_icons(oldstate, "", old_positions, old_order);
+	sbs_collect_icons(newstate, "", new_positions, new_order);
+
+	for (i = 0; i < new_order->len; i++) {
+		const char *identifier = (const char*)g_ptr_array_index(new_order, i);
+		const char *new_position = (const char*)g_hash_table_lookup(new_positions, identifier);
+		const char *old_position = (const char*)g_hash_table_lookup(old_positions, identifier);
+		if (!old_position) {
+			sbs_append_icon_change(list, SBSERVICES_ICON_ADDED, identifier, NULL, new_position);
+		} else if (strcmp(old_position, new_position)) {
+			sbs_append_icon_change(list, SBSERVICES_ICON_MOVED, identifier, old_position, new_position);
+		}
+	}
+	for (i = 0; i < old_order->len; i++) {
+		const char *identifier = (const char*)g_ptr_array_index(old_order, i);
+		if (!g_hash_table_lookup(new_positions, identifier)) {
+			sbs_append_icon_change(list, SBSERVICES_ICON_REMOVED, identifier, (const char*)g_hash_table_lookup(old_positions, identifier), NULL);
+		}
+	}
+
+	g_ptr_array_free(old_order, TRUE);
+	g_ptr_array_free(new_order, TRUE);
+	g_hash_table_destroy(old_positions);
+	g_hash_table_destroy(new_positions);
+
+	*count = list->len;
+	if (list->len > 0) {
+		*changes = (sbservices_icon_change_t*)g_array_free(list, FALSE);
+	} else {
+		*changes = NULL;
+		g_array_free(list, TRUE);
+	}
+
+	return SBSERVICES_E_SUCCESS;
+}
+
+/**
+ * Frees an array of changes returned by sbservices_icon_state_diff.
+ *
+ * @param changes The array to free, may be NULL.
+ * @param count The number of changes in the array.
+ */
+void sbservices_icon_changes_free(sbservices_icon_change_t *changes, uint32_t count)
+{
+	uint32_t i;
+
+	if (!changes)
+		return;
+
+	for (i = 0; i < count; i++) {
+		free(changes[i].identifier);
+		free(changes[i].old_position);
+		free(changes[i].new_position);
+	}
+	g_free(changes);
+}
+
+/**
+ * Checks a new icon state before it is sent to the device. It has to be an
+ * array of pages, may not contain an icon twice and, if the current state
+ * is given, has to contain exactly the icons of the current state, so no
+ * app is lost or made up by rearranging.
+ *
+ * @param oldstate The current icon state of the device, or NULL to only
+ *     check the new state by itself.
+ * @param newstate The icon state to check.
+ *
+ * @return SBSERVICES_E_SUCCESS if the state is valid, SBSERVICES_E_INVALID_ARG
+ *     when newstate is NULL, or SBSERVICES_E_INVALID_STATE otherwise.
+ */
+sbservices_error_t sbservices_icon_state_validate(plist_t oldstate, plist_t newstate)
+{
+	if (!newstate)
+		return SBSERVICES_E_INVALID_ARG;
+
+	sbservices_error_t res = SBSERVICES_E_SUCCESS;
+	uint32_t i;
+
+	if (plist_get_node_type(newstate) != PLIST_ARRAY)
+		return SBSERVICES_E_INVALID_STATE;
+	for (i = 0; i < plist_array_get_size(newstate); i++) {
+		if (plist_get_node_type(plist_array_get_item(newstate, i)) != PLIST_ARRAY)
+			return SBSERVICES_E_INVALID_STATE;
+	}
+
+	GHashTable *new_positions = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	GPtrArray *new_order = g_ptr_array_new();
+	if (sbs_collect_icons(newstate, "", new_positions, new_order) > 0) {
+		debug_info("icon state contains icons more than once");
+		res = SBSERVICES_E_INVALID_STATE;
+	}
+
+	if ((res == SBSERVICES_E_SUCCESS) && oldstate) {
+		GHashTable *old_positions = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+		GPtrArray *old_order = g_ptr_array_new();
+		sbs_collect_icons(oldstate, "", old_positions, old_order);
+		if (old_order->len != new_order->len) {
+			res = SBSERVICES_E_INVALID_STATE;
+		}
+		for (i = 0; (res == SBSERVICES_E_SUCCESS) && (i < new_order->len); i++) {
+			if (!g_hash_table_lookup(old_positions, g_ptr_array_index(new_order, i))) {
+				debug_info("icon %s is not on the device", (const char*)g_ptr_array_index(new_order, i));
+				res = SBSERVICES_E_INVALID_STATE;
+			}
+		}
+		g_ptr_array_free(old_order, TRUE);
+		g_hash_table_destroy(old_positions);
+	}
+
+	g_ptr_array_free(new_order, TRUE);
+	g_hash_table_destroy(new_positions);
+
+	return res;
+}
+
+/**
+ * Internally used function that compares two plists including all children.
+ *
+ * @return 1 if both are equal, 0 otherwise.
+ */
+static int sbs_plist_equal(plist_t a, plist_t b)
+{
+	plist_type type = plist_get_node_type(a);
+	uint32_t i;
+
+	if (type != plist_get_node_type(b))
+		return 0;
+
+	if (type == PLIST_ARRAY) {
+		if (plist_array_get_size(a) != plist_array_get_size(b))
+			return 0;
+		for (i = 0; i < plist_array_get_size(a); i++) {
+			if (!sbs_plist_equal(plist_array_get_item(a, i), plist_array_get_item(b, i)))
+				return 0;
+		}
+		return 1;
+	} else if (type == PLIST_DICT) {
+		plist_dict_iter iter = NULL;
+		char *key = NULL;
+		plist_t item = NULL;
+		int equal = 1;
+
+		if (plist_dict_get_size(a) != plist_dict_get_size(b))
+			return 0;
+		plist_dict_new_iter(a, &iter);
+		if (!iter)
+			return 0;
+		do {
+			key = NULL;
+			item = NULL;
+			plist_dict_next_item(a, iter, &key, &item);
+			if (key && item) {
+				plist_t other = plist_dict_get_item(b, key);
+				if (!other || !sbs_plist_equal(item, other))
+					equal = 0;
+			}
+			free(key);
+		} while (item && equal);
+		free(iter);
+		return equal;
+	}
+
+	return plist_compare_node_value(a, b) ? 1 : 0;
+}
+
+/**
+ * Sets the icon state of the connected device, but only if it differs from
+ * the current one. The current state is the one last read or written with
+ * this client, or is read from the device if there is none. The new state is
+ * validated against it with sbservices_icon_state_validate before it is
+ * sent. A state written before is assumed to be current since the device
+ * does not acknowledge it, see sbservices_set_icon_state.
+ *
+ * @param client The connected sbservices client to use.
+ * @param newstate A plist containing the new icon state.
+ * @param changed Set to 1 if the state was sent, 0 if it was unchanged. May
+ *     be NULL.
+ *
+ * @return SBSERVICES_E_SUCCESS on success, SBSERVICES_E_INVALID_ARG when
+ *     client or newstate is NULL, SBSERVICES_E_INVALID_STATE if newstate did
+ *     not validate, or an SBSERVICES_E_* error code otherwise.
+ */
+sbservices_error_t sbservices_set_icon_state_if_changed(sbservices_client_t client, plist_t newstate, int *changed)
+{
+	if (!client || !client->parent || !newstate)
+		return SBSERVICES_E_INVALID_ARG;
+
+	sbservices_error_t res = SBSERVICES_E_SUCCESS;
+	plist_t current = NULL;
+
+	if (changed)
+		*changed = 0;
+
+	/* the remembered state must not change between comparing and sending */
+	sbs_lock(client);
+	if (!client->icon_state) {
+		res = sbservices_get_icon_state_unlocked(client, &current);
+		if (current)
+			plist_free(current);
+		if ((res == SBSERVICES_E_SUCCESS) && !client->icon_state)
+			res = SBSERVICES_E_UNKNOWN_ERROR;
+		if (res != SBSERVICES_E_SUCCESS)
+			goto leave_unlock;
+	}
+
+	if (sbs_plist_equal(client->icon_state, newstate)) {
+		debug_info("icon state unchanged, not sending it");
+		goto leave_unlock;
+	}
+
+	res = sbservices_icon_state_validate(client->icon_state, newstate);
+	if (res != SBSERVICES_E_SUCCESS)
+		goto leave_unlock;
+
+	res = sbservices_set_icon_state_unlocked(client, newstate);
+	if ((res == SBSERVICES_E_SUCCESS) && changed)
+		*changed = 1;
+
+leave_unlock:
+	sbs_unlock(client);
+	return res;
+}
@@ -29,6 +29,7 @@
 struct sbservices_client_private {
 	property_list_service_client_t parent;
 	GMutex *mutex;
+	plist_t icon_state;
 };
 
 #endif
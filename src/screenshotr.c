@@ -22,6 +22,7 @@
 #include <plist/plist.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/time.h>
 
 #include "screenshotr.h"
 #include "device_link_service.h"
@@ -30,6 +31,9 @@
 #define SCREENSHOTR_VERSION_INT1 100
 #define SCREENSHOTR_VERSION_INT2 0
 
+/** Number of screenshot requests kept in flight while capturing */
+#define SCREENSHOTR_PIPELINE_DEPTH 2
+
 /**
  * Convert a device_link_service_error_t value to a screenshotr_error_t value.
  * Used internally to get correct error codes.
@@ -121,38 +125,39 @@ screenshotr_error_t screenshotr_client_free(screenshotr_client_t client)
 }
 
 /**
- * Get a screen shot from the connected device.
- *
- * @param client The connection screenshotr service client.
- * @param imgdata Pointer that will point to a newly allocated buffer
- *     containing TIFF image data upon successful return. It is up to the
- *     caller to free the memory.
- * @param imgsize Pointer to a uint64_t that will be set to the size of the
- *     buffer imgdata points to upon successful return.
- *
- * @return SCREENSHOTR_E_SUCCESS on success, SCREENSHOTR_E_INVALID_ARG if
- *     one or more parameters are invalid, or another error code if an
- *     error occured.
+ * Internally used function that sends a screenshot request.
  */
-screenshotr_error_t screenshotr_take_screenshot(screenshotr_client_t client, char **imgdata, uint64_t *imgsize)
+static screenshotr_error_t screenshotr_send_request(screenshotr_client_t client)
 {
-	if (!client || !client->parent || !imgdata)
-		return SCREENSHOTR_E_INVALID_ARG;
-
-	screenshotr_error_t res = SCREENSHOTR_E_UNKNOWN_ERROR;
-
 	plist_t dict = plist_new_dict();
 	plist_dict_insert_item(dict, "MessageType", plist_new_string("ScreenShotRequest"));
 
-	res = screenshotr_error(device_link_service_send_process_message(client->parent, dict));
+	screenshotr_error_t res = screenshotr_error(device_link_service_send_process_message(client->parent, dict));
 	plist_free(dict);
 	if (res != SCREENSHOTR_E_SUCCESS) {
 		debug_info("could not send plist, error %d", res);
-		return res;
 	}
+	return res;
+}
+
+/**
+ * Internally used function that receives a screenshot reply.
+ *
+ * @param client The connected screenshotr client
+ * @param imgdata Set to the image data. It is borrowed from the receive
+ *     buffer and stays valid until the next receive on this client.
+ * @param imgsize Set to the size of the image data.
+ *
+ * @return SCREENSHOTR_E_SUCCESS on success or an error code.
+ */
+static screenshotr_error_t screenshotr_receive_reply(screenshotr_client_t client, const char **imgdata, uint64_t *imgsize)
+{
+	screenshotr_error_t res = SCREENSHOTR_E_UNKNOWN_ERROR;
+	plist_t dict = NULL;
+	const char *data = NULL;
+	uint64_t length = 0;
 
-	dict = NULL;
-	res = screenshotr_error(device_link_service_receive_process_message(client->parent, &dict));
+	res = screenshotr_error(device_link_service_receive_process_message_with_data(client->parent, &dict, "ScreenShotData", &data, &length));
 	if (res != SCREENSHOTR_E_SUCCESS) {
 		debug_info("could not get screenshot data, error %d", res);
 		goto leave;
@@ -169,16 +174,18 @@ screenshotr_error_t screenshotr_take_screenshot(screenshotr_client_t client, cha
 	if (!strval || strcmp(strval, "ScreenShotReply")) {
 		debug_info("invalid screenshot data received!");
 		res = SCREENSHOTR_E_PLIST_ERROR;
+		free(strval);
 		goto leave;
 	}
-	node = plist_dict_get_item(dict, "ScreenShotData");
-	if (!node || plist_get_node_type(node) != PLIST_DATA) {
+	free(strval);
+	if (!data) {
 		debug_info("no PNG data received!");
 		res = SCREENSHOTR_E_PLIST_ERROR;
 		goto leave;
 	}
 
-	plist_get_data_val(node, imgdata, imgsize);
+	*imgdata = data;
+	*imgsize = length;
 	res = SCREENSHOTR_E_SUCCESS;
 
 leave:
@@ -187,3 +194,140 @@ leave:
 
 	return res;
 }
+
+/**
+ * Get a screen shot from the connected device.
+ *
+ * @param client The connection screenshotr service client.
+ * @param imgdata Pointer that will point to a newly allocated buffer
+ *     containing TIFF image data upon successful return. It is up to the
+ *     caller to free the memory.
+ * @param imgsize Pointer to a uint64_t that will be set to the size of the
+ *     buffer imgdata points to upon successful return.
+ *
+ * @return SCREENSHOTR_E_SUCCESS on success, SCREENSHOTR_E_INVALID_ARG if
+ *     one or more parameters are invalid, or another error code if an
+ *     error occured.
+ */
+screenshotr_error_t screenshotr_take_screenshot(screenshotr_client_t client, char **imgdata, uint64_t *imgsize)
+{
+	if (!client || !client->parent || !imgdata)
+		return SCREENSHOTR_E_INVALID_ARG;
+
+	screenshotr_error_t res = screenshotr_send_request(client);
+	if (res != SCREENSHOTR_E_SUCCESS)
+		return res;
+
+	const char *data = NULL;
+	uint64_t length = 0;
+	res = screenshotr_receive_reply(client, &data, &length);
+	if (res != SCREENSHOTR_E_SUCCESS)
+		return res;
+
+	/* the image data is only borrowed from the receive buffer */
+	*imgdata = (char*)malloc(length);
+	if (!*imgdata)
+		return SCREENSHOTR_E_UNKNOWN_ERROR;
+	memcpy(*imgdata, data, length);
+	*imgsize = length;
+
+	return SCREENSHOTR_E_SUCCESS;
+}
+
+static double screenshotr_elapsed_ms(struct timeval *start, struct timeval *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_usec - start->tv_usec) / 1000.0;
+}
+
+/**
+ * Captures screenshots continuously and hands each frame to a callback.
+ *
+ * The request for the next frame is sent before the current frame is
+ * received, so the device can start on it while the host is still reading
+ * and processing. Frames are not copied; the callback gets a view into the
+ * client's receive buffer, which is reused for every frame.
+ *
+ * @param client The connected screenshotr client
+ * @param max_frames Number of frames to capture, or 0 to capture until the
+ *     callback asks to stop.
+ * @param frame_cb Called for every frame. The image data is only valid
+ *     during the call. Return nonzero to stop capturing.
+ * @param user_data Pointer passed to frame_cb.
+ * @param stats Filled with the number of frames, the achieved frame rate and
+ *     the latency from request to complete frame. May be NULL.
+ *
+ * @return SCREENSHOTR_E_SUCCESS on success, SCREENSHOTR_E_INVALID_ARG if
+ *     client or frame_cb is NULL, or another error code if an error
+ *     occured. The statistics cover the frames captured until the error.
+ */
+screenshotr_error_t screenshotr_capture(screenshotr_client_t client, uint32_t max_frames, screenshotr_frame_cb_t frame_cb, void *user_data, screenshotr_capture_stats_t *stats)
+{
+	if (!client || !client->parent || !frame_cb)
+		return SCREENSHOTR_E_INVALID_ARG;
+
+	screenshotr_error_t res = SCREENSHOTR_E_SUCCESS;
+	struct timeval sent_at[SCREENSHOTR_PIPELINE_DEPTH];
+	struct timeval start, now;
+	uint64_t requested = 0;
+	uint64_t received = 0;
+	double latency_sum = 0;
+	int stop = 0;
+	screenshotr_capture_stats_t st;
+
+	memset(&st, 0, sizeof(st));
+	gettimeofday(&start, NULL);
+
+	while (!stop || (received < requested)) {
+		/* keep the pipeline filled */
+		while (!stop && (res == SCREENSHOTR_E_SUCCESS) && (requested - received < SCREENSHOTR_PIPELINE_DEPTH) && (!max_frames || (requested < max_frames))) {
+			res = screenshotr_send_request(client);
+			if (res == SCREENSHOTR_E_SUCCESS) {
+				gettimeofday(&sent_at[requested % SCREENSHOTR_PIPELINE_DEPTH], NULL);
+				requested++;
+			}
+		}
+		if (res != SCREENSHOTR_E_SUCCESS)
+			stop = 1;
+		if (received == requested)
+			break;
+
+		const char *data = NULL;
+		uint64_t length = 0;
+		screenshotr_error_t rres = screenshotr_receive_reply(client, &data, &length);
+		gettimeofday(&now, NULL);
+		if (rres != SCREENSHOTR_E_SUCCESS) {
+			/* the connection is out of sync now, give up */
+			res = rres;
+			break;
+		}
+
+		double latency = screenshotr_elapsed_ms(&sent_at[received % SCREENSHOTR_PIPELINE_DEPTH], &now);
+		received++;
+		if (stop) {
+			/* reply to a request sent ahead, drop it */
+			continue;
+		}
+
+		st.frames++;
+		latency_sum += latency;
+		if ((st.frames == 1) || (latency < st.min_latency))
+			st.min_latency = latency;
+		if (latency > st.max_latency)
+			st.max_latency = latency;
+
+		if (frame_cb(data, length, st.frames, user_data) || (max_frames && (st.frames >= max_frames)))
+			stop = 1;
+	}
+
+	gettimeofday(&now, NULL);
+	st.duration = screenshotr_elapsed_ms(&start, &now) / 1000.0;
+	if (st.frames > 0) {
+		st.avg_latency = latency_sum / st.frames;
+		if (st.duration > 0)
+			st.fps = st.frames / st.duration;
+	}
+	if (stats)
+		memcpy(stats, &st, sizeof(st));
+
+	return res;
+}
@@ -26,9 +26,9 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <gnutls/gnutls.h>
 #include <gnutls/x509.h>
-#include <gcrypt.h>
 
 #include "userpref.h"
 #include "debug.h"
@@ -40,6 +40,147 @@
 #define LIBIMOBILEDEVICE_HOST_PRIVKEY "HostPrivateKey.pem"
 #define LIBIMOBILEDEVICE_ROOT_CERTIF "RootCertificate.pem"
 #define LIBIMOBILEDEVICE_HOST_CERTIF "HostCertificate.pem"
+#define LIBIMOBILEDEVICE_HANDSHAKE_CACHE "handshakecache"
+#define LIBIMOBILEDEVICE_DEVICE_CERTS_DIR "devicecerts"
+#define LIBIMOBILEDEVICE_VALUE_CACHE_DIR "valuecache"
+#define LIBIMOBILEDEVICE_APP_INVENTORY_DIR "appinventory"
+#define LIBIMOBILEDEVICE_ICON_CACHE_DIR "icons"
+
+/** Seconds after which a cached file is checked for changes on disk. */
+#define USERPREF_CACHE_CHECK_INTERVAL 2
+
+/** In-memory copy of a file in the configuration directory. */
+struct userpref_cache_entry {
+	gchar *data;      /* file contents, NULL if the file does not exist */
+	gsize size;
+	time_t mtime;
+	time_t checked;   /* when the file was last compared with the disk */
+	gchar *host_id;   /* parsed HostID, only used for the config file */
+};
+
+static GHashTable *userpref_cache = NULL;
+static GStaticMutex userpref_cache_mutex = G_STATIC_MUTEX_INIT;
+
+/** Serializes read-modify-write updates of files in the configuration directory. */
+static GStaticMutex userpref_store_mutex = G_STATIC_MUTEX_INIT;
+
+/** Serializes key generation between the background worker and callers. */
+static GStaticMutex userpref_keygen_mutex = G_STATIC_MUTEX_INIT;
+
+/** Guards the state of the background key generation worker. */
+static GStaticMutex userpref_keygen_state_mutex = G_STATIC_MUTEX_INIT;
+static GCond *userpref_keygen_done = NULL;
+static int userpref_keygen_running = 0;
+static userpref_error_t userpref_keygen_result = USERPREF_E_SUCCESS;
+
+/** Root key and certificates loaded once for signing device certificates. */
+static userpref_root_signer_t userpref_signer = NULL;
+static GStaticMutex userpref_signer_mutex = G_STATIC_MUTEX_INIT;
+
+static void userpref_cache_entry_free(gpointer data)
+{
+	struct userpref_cache_entry *entry = (struct userpref_cache_entry*)data;
+	g_free(entry->data);
+	g_free(entry->host_id);
+	g_free(entry);
+}
+
+/**
+ * Checks whether a file of the configuration directory is read on every
+ * handshake and therefore worth keeping in memory: the configuration file,
+ * the handshake cache, the public host and root certificates and the
+ * per-device pair records. Private keys and the per-device caches in
+ * subdirectories are always read from disk.
+ *
+ * @param file The name of the file in the configuration directory.
+ *
+ * @return 1 if the file may be cached, 0 otherwise.
+ */
+static int userpref_cache_is_hot(const char *file)
+{
+	if (!strcmp(file, LIBIMOBILEDEVICE_ROOT_PRIVKEY) || !strcmp(file, LIBIMOBILEDEVICE_HOST_PRIVKEY))
+		return 0;
+	return (strchr(file, G_DIR_SEPARATOR) == NULL);
+}
+
+/**
+ * Looks up a file of the configuration directory in the cache, loading it
+ * from disk when it is not cached yet or has changed. Files are compared
+ * with the disk at most every USERPREF_CACHE_CHECK_INTERVAL seconds, using
+ * their modification time and size.
+ *
+ * @note Must be called with userpref_cache_mutex held, and only for files
+ *       accepted by userpref_cache_is_hot().
+ *
+ * @param file The name of the file in the configuration directory.
+ *
+ * @return The cache entry for the file. Its data is NULL if the file does
+ *         not exist.
+ */
+static struct userpref_cache_entry *userpref_cache_lookup(const char *file)
+{
+	struct userpref_cache_entry *entry = NULL;
+	struct stat st;
+	time_t now = time(NULL);
+	int exists;
+
+	if (!userpref_cache) {
+		userpref_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, userpref_cache_entry_free);
+	}
+
+	entry = (struct userpref_cache_entry*)g_hash_table_lookup(userpref_cache, file);
+	if (entry && (now >= entry->checked) && (now - entry->checked < USERPREF_CACHE_CHECK_INTERVAL)) {
+		return entry;
+	}
+
+	gchar *path = g_build_path(G_DIR_SEPARATOR_S, g_get_user_config_dir(), LIBIMOBILEDEVICE_CONF_DIR, file, NULL);
+	exists = (g_stat(path, &st) == 0);
+
+	if (entry && (exists == (entry->data != NULL)) && (!exists || ((st.st_mtime == entry->mtime) && ((gsize)st.st_size == entry->size)))) {
+		/* unchanged on disk */
+		entry->checked = now;
+		g_free(path);
+		return entry;
+	}
+
+	if (!entry) {
+		entry = g_new0(struct userpref_cache_entry, 1);
+		g_hash_table_insert(userpref_cache, g_strdup(file), entry);
+	} else {
+		g_free(entry->data);
+		g_free(entry->host_id);
+		entry->data = NULL;
+		entry->host_id = NULL;
+		entry->size = 0;
+	}
+
+	if (exists && g_file_get_contents(path, &entry->data, &entry->size, NULL)) {
+		entry->mtime = st.st_mtime;
+		debug_info("loaded %s into cache", file);
+	} else {
+		entry->data = NULL;
+		entry->size = 0;
+	}
+	entry->checked = now;
+	g_free(path);
+
+	return entry;
+}
+
+/**
+ * Drops the cached copy of a file of the configuration directory, used
+ * after the file was written or removed.
+ *
+ * @param file The name of the file in the configuration directory.
+ */
+static void userpref_cache_invalidate(const char *file)
+{
+	g_static_mutex_lock(&userpref_cache_mutex);
+	if (userpref_cache) {
+		g_hash_table_remove(userpref_cache, file);
+	}
+	g_static_mutex_unlock(&userpref_cache_mutex);
+}
 
 
 /**
@@ -123,9 +264,36 @@ static int userpref_set_host_id(const char *host_id)
 	g_io_channel_unref(file);
 
 	g_key_file_free(key_file);
+	userpref_cache_invalidate(LIBIMOBILEDEVICE_CONF_FILE);
 	return 1;
 }
 
+/**
+ * Private function which reads the HostID from the cached configuration
+ * file.
+ *
+ * @param host_id Set to a copy of the HostID, or left untouched if there
+ *        is none.
+ */
+static void userpref_read_host_id(char **host_id)
+{
+	struct userpref_cache_entry *entry;
+
+	g_static_mutex_lock(&userpref_cache_mutex);
+	entry = userpref_cache_lookup(LIBIMOBILEDEVICE_CONF_FILE);
+	if (entry->data && !entry->host_id) {
+		/* parse the config file once per change to get the HostID */
+		GKeyFile *key_file = g_key_file_new();
+		if (g_key_file_load_from_data(key_file, entry->data, entry->size, G_KEY_FILE_KEEP_COMMENTS, NULL)) {
+			entry->host_id = g_key_file_get_value(key_file, "Global", "HostID", NULL);
+		}
+		g_key_file_free(key_file);
+	}
+	if (entry->host_id)
+		*host_id = strdup((char *) entry->host_id);
+	g_static_mutex_unlock(&userpref_cache_mutex);
+}
+
 /**
  * Reads the HostID from a previously generated configuration file.
  *
@@ -135,28 +303,17 @@ static int userpref_set_host_id(const char *host_id)
  */
 void userpref_get_host_id(char **host_id)
 {
-	gchar *config_file;
-	GKeyFile *key_file;
-	gchar *loc_host_id;
-
-	config_file =
-		g_build_path(G_DIR_SEPARATOR_S, g_get_user_config_dir(), LIBIMOBILEDEVICE_CONF_DIR, LIBIMOBILEDEVICE_CONF_FILE, NULL);
-
-	/* now parse file to get the HostID */
-	key_file = g_key_file_new();
-	if (g_key_file_load_from_file(key_file, config_file, G_KEY_FILE_KEEP_COMMENTS, NULL)) {
-		loc_host_id = g_key_file_get_value(key_file, "Global", "HostID", NULL);
-		if (loc_host_id)
-			*host_id = strdup((char *) loc_host_id);
-		g_free(loc_host_id);
-	}
-	g_key_file_free(key_file);
-	g_free(config_file);
+	userpref_read_host_id(host_id);
 
 	if (!*host_id) {
-		/* no config, generate host_id */
-		*host_id = userpref_generate_host_id();
-		userpref_set_host_id(*host_id);
+		/* no config, generate host_id unless another thread just did */
+		g_static_mutex_lock(&userpref_store_mutex);
+		userpref_read_host_id(host_id);
+		if (!*host_id) {
+			*host_id = userpref_generate_host_id();
+			userpref_set_host_id(*host_id);
+		}
+		g_static_mutex_unlock(&userpref_store_mutex);
 	}
 
 	debug_info("Using %s as HostID", *host_id);
@@ -173,14 +330,12 @@ void userpref_get_host_id(char **host_id)
 int userpref_has_device_public_key(const char *uuid)
 {
 	int ret = 0;
-	gchar *config_file;
 
-	/* first get config file */
 	gchar *device_file = g_strconcat(uuid, ".pem", NULL);
-	config_file = g_build_path(G_DIR_SEPARATOR_S, g_get_user_config_dir(), LIBIMOBILEDEVICE_CONF_DIR, device_file, NULL);
-	if (g_file_test(config_file, (G_FILE_TEST_EXISTS | G_FILE_TEST_IS_REGULAR)))
+	g_static_mutex_lock(&userpref_cache_mutex);
+	if (userpref_cache_lookup(device_file)->data)
 		ret = 1;
-	g_free(config_file);
+	g_static_mutex_unlock(&userpref_cache_mutex);
 	g_free(device_file);
 	return ret;
 }
@@ -214,6 +369,7 @@ userpref_error_t userpref_set_device_public_key(const char *uuid, gnutls_datum_t
 	fwrite(public_key.data, 1, public_key.size, pFile);
 	fclose(pFile);
 	g_free(pem);
+	userpref_cache_invalidate(device_file);
 	g_free(device_file);
 
 	return USERPREF_E_SUCCESS;
@@ -239,11 +395,114 @@ userpref_error_t userpref_remove_device_public_key(const char *uuid)
 	g_remove(pem);
 
 	g_free(pem);
+	userpref_cache_invalidate(device_file);
 	g_free(device_file);
 
+	/* a device we are no longer paired with must be validated again */
+	userpref_set_validated_handshake(uuid, NULL, 0);
+
 	return USERPREF_E_SUCCESS;
 }
 
+/**
+ * Reads when pairing of the device with uuid was last validated
+ * successfully using the given HostID.
+ *
+ * @param uuid The uuid of the device
+ * @param host_id The HostID used for the validation
+ *
+ * @return The time of the last successful validation, or 0 if there is no
+ *         cached validation for this device and HostID.
+ */
+time_t userpref_get_validated_handshake(const char *uuid, const char *host_id)
+{
+	time_t validated = 0;
+	struct userpref_cache_entry *entry;
+	GKeyFile *key_file;
+
+	if (!uuid || !host_id)
+		return 0;
+
+	g_static_mutex_lock(&userpref_cache_mutex);
+	entry = userpref_cache_lookup(LIBIMOBILEDEVICE_HANDSHAKE_CACHE);
+	key_file = g_key_file_new();
+	if (entry->data && g_key_file_load_from_data(key_file, entry->data, entry->size, G_KEY_FILE_NONE, NULL)) {
+		gchar *cached_host_id = g_key_file_get_value(key_file, uuid, "HostID", NULL);
+		gchar *timestamp = g_key_file_get_value(key_file, uuid, "Validated", NULL);
+		if (cached_host_id && timestamp && !strcmp(cached_host_id, host_id)) {
+			validated = (time_t)strtoll(timestamp, NULL, 10);
+		}
+		g_free(cached_host_id);
+		g_free(timestamp);
+	}
+	g_key_file_free(key_file);
+	g_static_mutex_unlock(&userpref_cache_mutex);
+
+	return validated;
+}
+
+/**
+ * Stores when pairing of the device with uuid was last validated
+ * successfully, so later connections can skip the validation.
+ *
+ * @param uuid The uuid of the device
+ * @param host_id The HostID used for the validation
+ * @param validated The time of the validation, or 0 to forget a cached
+ *        validation for the device.
+ *
+ * @return USERPREF_E_SUCCESS on success, USERPREF_E_INVALID_ARG if uuid is
+ *         NULL or host_id is NULL while validated is not 0, or
+ *         USERPREF_E_UNKNOWN_ERROR if the cache could not be written.
+ */
+userpref_error_t userpref_set_validated_handshake(const char *uuid, const char *host_id, time_t validated)
+{
+	userpref_error_t ret = USERPREF_E_SUCCESS;
+	gchar *cache_file;
+	GKeyFile *key_file;
+	gchar *buf;
+	gsize length;
+
+	if (!uuid || (validated && !host_id))
+		return USERPREF_E_INVALID_ARG;
+
+	userpref_create_config_dir();
+	cache_file = g_build_path(G_DIR_SEPARATOR_S, g_get_user_config_dir(), LIBIMOBILEDEVICE_CONF_DIR, LIBIMOBILEDEVICE_HANDSHAKE_CACHE, NULL);
+
+	g_static_mutex_lock(&userpref_store_mutex);
+	key_file = g_key_file_new();
+	if (!g_key_file_load_from_file(key_file, cache_file, G_KEY_FILE_NONE, NULL) && !validated) {
+		/* nothing cached, nothing to forget */
+		g_static_mutex_unlock(&userpref_store_mutex);
+		g_key_file_free(key_file);
+		g_free(cache_file);
+		return USERPREF_E_SUCCESS;
+	}
+
+	if (validated) {
+		gchar *timestamp = g_strdup_printf("%lld", (long long)validated);
+		g_key_file_set_value(key_file, uuid, "HostID", host_id);
+		g_key_file_set_value(key_file, uuid, "Validated", timestamp);
+		g_free(timestamp);
+	} else {
+		g_key_file_remove_group(key_file, uuid, NULL);
+	}
+
+	/* write atomically, other processes might read the cache concurrently */
+	buf = g_key_file_to_data(key_file, &length, NULL);
+	if (!g_file_set_contents(cache_file, buf, length, NULL)) {
+		debug_info("could not write handshake cache %s", cache_file);
+		ret = USERPREF_E_UNKNOWN_ERROR;
+	}
+	g_free(buf);
+
+	g_key_file_free(key_file);
+	g_free(cache_file);
+	userpref_cache_invalidate(LIBIMOBILEDEVICE_HANDSHAKE_CACHE);
+	g_static_mutex_unlock(&userpref_store_mutex);
+
+	return ret;
+}
+
 /**
  * Private function which reads the given file into a gnutls structure.
  *
@@ -254,22 +513,37 @@ userpref_error_t userpref_remove_device_public_key(const char *uuid)
  */
 static int userpref_get_file_contents(const char *file, gnutls_datum_t * data)
 {
-	gboolean success;
-	gsize size;
-	char *content;
-	gchar *filepath;
+	struct userpref_cache_entry *entry;
+	int success = 0;
 
 	if (NULL == file || NULL == data)
 		return 0;
 
-	/* Read file */
-	filepath = g_build_path(G_DIR_SEPARATOR_S, g_get_user_config_dir(), LIBIMOBILEDEVICE_CONF_DIR, file, NULL);
-	success = g_file_get_contents(filepath, &content, &size, NULL);
-	g_free(filepath);
+	data->data = NULL;
+	data->size = 0;
+
+	if (!userpref_cache_is_hot(file)) {
+		gchar *content = NULL;
+		gsize size = 0;
+		gchar *path = g_build_path(G_DIR_SEPARATOR_S, g_get_user_config_dir(), LIBIMOBILEDEVICE_CONF_DIR, file, NULL);
+		if (g_file_get_contents(path, &content, &size, NULL)) {
+			data->data = (uint8_t*) content;
+			data->size = size;
+			success = 1;
+		}
+		g_free(path);
+		return success;
+	}
 
-	/* Add it to the gnutls_datnum_t structure */
-	data->data = (uint8_t*) content;
-	data->size = size;
+	/* hand out a copy of the cached file */
+	g_static_mutex_lock(&userpref_cache_mutex);
+	entry = userpref_cache_lookup(file);
+	if (entry->data) {
+		data->data = (uint8_t*) g_memdup(entry->data, entry->size + 1);
+		data->size = entry->size;
+		success = 1;
+	}
+	g_static_mutex_unlock(&userpref_cache_mutex);
 
 	return success;
 }
@@ -288,12 +562,8 @@ static userpref_error_t userpref_gen_keys_and_cert(void)
 	gnutls_x509_privkey_t host_privkey;
 	gnutls_x509_crt_t host_cert;
 
-	gnutls_global_deinit();
 	gnutls_global_init();
 
-	//use less secure random to speed up key generation
-	gcry_control(GCRYCTL_ENABLE_QUICK_RANDOM);
-
 	gnutls_x509_privkey_init(&root_privkey);
 	gnutls_x509_privkey_init(&host_privkey);
 
@@ -367,9 +637,12 @@ static userpref_error_t userpref_gen_keys_and_cert(void)
 	gnutls_free(host_key_pem.data);
 	gnutls_free(host_cert_pem.data);
 
-	//restore gnutls env
+	gnutls_x509_privkey_deinit(root_privkey);
+	gnutls_x509_privkey_deinit(host_privkey);
+	gnutls_x509_crt_deinit(root_cert);
+	gnutls_x509_crt_deinit(host_cert);
+
 	gnutls_global_deinit();
-	gnutls_global_init();
 
 	return ret;
 }
@@ -420,6 +693,140 @@ static userpref_error_t userpref_import_crt(const char* crt_name, gnutls_x509_cr
 	return ret;
 }
 
+/**
+ * Private function which checks that all host keys and certificates exist
+ * and can be imported.
+ *
+ * @return USERPREF_E_SUCCESS if they are usable, another error code
+ *         otherwise.
+ */
+static userpref_error_t userpref_check_keys_and_certs(void)
+{
+	userpref_error_t ret;
+	gnutls_x509_privkey_t root_privkey;
+	gnutls_x509_privkey_t host_privkey;
+	gnutls_x509_crt_t root_crt;
+	gnutls_x509_crt_t host_crt;
+
+	gnutls_global_init();
+	gnutls_x509_privkey_init(&root_privkey);
+	gnutls_x509_privkey_init(&host_privkey);
+	gnutls_x509_crt_init(&root_crt);
+	gnutls_x509_crt_init(&host_crt);
+
+	ret = userpref_import_key(LIBIMOBILEDEVICE_ROOT_PRIVKEY, root_privkey);
+	if (ret == USERPREF_E_SUCCESS)
+		ret = userpref_import_key(LIBIMOBILEDEVICE_HOST_PRIVKEY, host_privkey);
+	if (ret == USERPREF_E_SUCCESS)
+		ret = userpref_import_crt(LIBIMOBILEDEVICE_ROOT_CERTIF, root_crt);
+	if (ret == USERPREF_E_SUCCESS)
+		ret = userpref_import_crt(LIBIMOBILEDEVICE_HOST_CERTIF, host_crt);
+
+	gnutls_x509_privkey_deinit(root_privkey);
+	gnutls_x509_privkey_deinit(host_privkey);
+	gnutls_x509_crt_deinit(root_crt);
+	gnutls_x509_crt_deinit(host_crt);
+	gnutls_global_deinit();
+
+	return ret;
+}
+
+/**
+ * Private function which generates host keys and certificates unless
+ * usable ones exist. If the background worker is currently generating
+ * them, this waits for it instead of generating a second set.
+ *
+ * @return USERPREF_E_SUCCESS if usable keys and certificates exist
+ *         afterwards, another error code otherwise.
+ */
+static userpref_error_t userpref_generate_keys_if_needed(void)
+{
+	userpref_error_t ret;
+
+	g_static_mutex_lock(&userpref_keygen_mutex);
+	ret = userpref_check_keys_and_certs();
+	if (ret != USERPREF_E_SUCCESS) {
+		debug_info("generating host keys and certificates");
+		ret = userpref_gen_keys_and_cert();
+	}
+	g_static_mutex_unlock(&userpref_keygen_mutex);
+
+	return ret;
+}
+
+static gpointer userpref_keygen_worker(gpointer data)
+{
+	userpref_error_t result = userpref_generate_keys_if_needed();
+
+	g_static_mutex_lock(&userpref_keygen_state_mutex);
+	userpref_keygen_result = result;
+	userpref_keygen_running = 0;
+	g_cond_broadcast(userpref_keygen_done);
+	g_static_mutex_unlock(&userpref_keygen_state_mutex);
+
+	return NULL;
+}
+
+/**
+ * Starts generating host keys and certificates in a background thread if
+ * no usable ones exist yet, so that the first pairing does not have to
+ * wait for RSA key generation. The worker is detached and nobody has to
+ * wait for it.
+ *
+ * @return USERPREF_E_SUCCESS if the worker was started or is already
+ *         running, USERPREF_E_UNKNOWN_ERROR if the thread could not be
+ *         created.
+ */
+userpref_error_t userpref_start_key_generation(void)
+{
+	userpref_error_t ret = USERPREF_E_SUCCESS;
+
+	/* makes sure thread environment is available */
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+
+	g_static_mutex_lock(&userpref_keygen_state_mutex);
+	if (!userpref_keygen_done)
+		userpref_keygen_done = g_cond_new();
+	if (!userpref_keygen_running) {
+		userpref_keygen_running = 1;
+		userpref_keygen_result = USERPREF_E_SUCCESS;
+		if (!g_thread_create(userpref_keygen_worker, NULL, FALSE, NULL)) {
+			userpref_keygen_running = 0;
+			ret = USERPREF_E_UNKNOWN_ERROR;
+		}
+	}
+	g_static_mutex_unlock(&userpref_keygen_state_mutex);
+
+	return ret;
+}
+
+/**
+ * Waits until host keys and certificates are available, generating them
+ * in the calling thread if no background worker was started. A failure of
+ * the background worker is reported once.
+ *
+ * @return USERPREF_E_SUCCESS if usable keys and certificates exist, another
+ *         error code otherwise.
+ */
+userpref_error_t userpref_wait_key_generation(void)
+{
+	userpref_error_t result;
+
+	g_static_mutex_lock(&userpref_keygen_state_mutex);
+	while (userpref_keygen_running) {
+		g_cond_wait(userpref_keygen_done, g_static_mutex_get_mutex(&userpref_keygen_state_mutex));
+	}
+	result = userpref_keygen_result;
+	userpref_keygen_result = USERPREF_E_SUCCESS;
+	g_static_mutex_unlock(&userpref_keygen_state_mutex);
+
+	if (result != USERPREF_E_SUCCESS)
+		return result;
+
+	return userpref_generate_keys_if_needed();
+}
+
 /**
  * Function to retrieve host keys and certificates.
  * This function trigger key generation if they do not exists yet or are invalid.
@@ -452,8 +859,8 @@ userpref_error_t userpref_get_keys_and_certs(gnutls_x509_privkey_t root_privkey,
 
 	if (USERPREF_E_SUCCESS != ret) {
 		//we had problem reading or importing root cert
-		//try with a new ones.
-		ret = userpref_gen_keys_and_cert();
+		//try with a new ones, unless a background worker just made them.
+		ret = userpref_generate_keys_if_needed();
 
 		if (ret == USERPREF_E_SUCCESS)
 			ret = userpref_import_key(LIBIMOBILEDEVICE_ROOT_PRIVKEY, root_privkey);
@@ -541,5 +948,430 @@ userpref_error_t userpref_set_keys_and_certs(gnutls_datum_t * root_key, gnutls_d
 	fclose(pFile);
 	g_free(pem);
 
+	userpref_cache_invalidate(LIBIMOBILEDEVICE_ROOT_PRIVKEY);
+	userpref_cache_invalidate(LIBIMOBILEDEVICE_HOST_PRIVKEY);
+	userpref_cache_invalidate(LIBIMOBILEDEVICE_ROOT_CERTIF);
+	userpref_cache_invalidate(LIBIMOBILEDEVICE_HOST_CERTIF);
+
 	return USERPREF_E_SUCCESS;
 }
+
+static void userpref_root_signer_free(userpref_root_signer_t signer)
+{
+	gnutls_x509_privkey_deinit(signer->root_privkey);
+	gnutls_x509_crt_deinit(signer->root_crt);
+	g_free(signer->pem_root_cert.data);
+	g_free(signer->pem_host_cert.data);
+	g_free(signer->fingerprint);
+	g_free(signer);
+	gnutls_global_deinit();
+}
+
+/**
+ * Private function which loads the root key and certificates for signing.
+ *
+ * @param error Set to the error that occured if loading failed.
+ *
+ * @return The new signer with one reference, or NULL on error.
+ */
+static userpref_root_signer_t userpref_root_signer_load(userpref_error_t *error)
+{
+	userpref_root_signer_t signer = g_new0(struct userpref_root_signer, 1);
+	gnutls_x509_privkey_t host_privkey;
+	gnutls_x509_crt_t host_crt;
+	unsigned char digest[20];
+	size_t digest_size = sizeof(digest);
+	userpref_error_t ret;
+	size_t i;
+
+	gnutls_global_init();
+	signer->refs = 1;
+	gnutls_x509_privkey_init(&signer->root_privkey);
+	gnutls_x509_crt_init(&signer->root_crt);
+	gnutls_x509_privkey_init(&host_privkey);
+	gnutls_x509_crt_init(&host_crt);
+
+	ret = userpref_get_keys_and_certs(signer->root_privkey, signer->root_crt, host_privkey, host_crt);
+	gnutls_x509_privkey_deinit(host_privkey);
+	gnutls_x509_crt_deinit(host_crt);
+
+	if (ret == USERPREF_E_SUCCESS) {
+		ret = userpref_get_certs_as_pem(&signer->pem_root_cert, &signer->pem_host_cert);
+		if (ret != USERPREF_E_SUCCESS) {
+			/* already freed by userpref_get_certs_as_pem */
+			signer->pem_root_cert.data = NULL;
+			signer->pem_host_cert.data = NULL;
+		}
+	}
+
+	if ((ret == USERPREF_E_SUCCESS) && (gnutls_fingerprint(GNUTLS_DIG_SHA1, &signer->pem_root_cert, digest, &digest_size) != GNUTLS_E_SUCCESS))
+		ret = USERPREF_E_SSL_ERROR;
+
+	if (ret != USERPREF_E_SUCCESS) {
+		userpref_root_signer_free(signer);
+		*error = ret;
+		return NULL;
+	}
+
+	signer->fingerprint = g_malloc(digest_size * 2 + 1);
+	for (i = 0; i < digest_size; i++) {
+		g_snprintf(signer->fingerprint + i * 2, 3, "%02x", digest[i]);
+	}
+
+	return signer;
+}
+
+/**
+ * Returns the root key and certificates used to sign device certificates.
+ * They are loaded once per process and only reloaded when the root
+ * certificate on disk changes.
+ *
+ * @param signer Set to a new reference to the signer. Release it with
+ *        userpref_root_signer_release().
+ *
+ * @return USERPREF_E_SUCCESS on success, USERPREF_E_INVALID_ARG if signer is
+ *         NULL, or the error that occured while loading the keys.
+ */
+userpref_error_t userpref_root_signer_get(userpref_root_signer_t *signer)
+{
+	userpref_error_t ret = USERPREF_E_SUCCESS;
+	gnutls_datum_t pem_root_cert = { NULL, 0 };
+
+	if (!signer)
+		return USERPREF_E_INVALID_ARG;
+
+	g_static_mutex_lock(&userpref_signer_mutex);
+	if (userpref_signer) {
+		/* make sure the root certificate was not replaced meanwhile */
+		if (!userpref_get_file_contents(LIBIMOBILEDEVICE_ROOT_CERTIF, &pem_root_cert)
+			|| (pem_root_cert.size != userpref_signer->pem_root_cert.size)
+			|| memcmp(pem_root_cert.data, userpref_signer->pem_root_cert.data, pem_root_cert.size)) {
+			debug_info("root certificate changed, reloading");
+			userpref_root_signer_release(userpref_signer);
+			userpref_signer = NULL;
+		}
+		g_free(pem_root_cert.data);
+	}
+	if (!userpref_signer) {
+		userpref_signer = userpref_root_signer_load(&ret);
+	}
+	if (userpref_signer) {
+		g_atomic_int_inc(&userpref_signer->refs);
+	}
+	*signer = userpref_signer;
+	g_static_mutex_unlock(&userpref_signer_mutex);
+
+	return ret;
+}
+
+/**
+ * Releases a reference obtained with userpref_root_signer_get().
+ *
+ * @param signer The signer to release.
+ */
+void userpref_root_signer_release(userpref_root_signer_t signer)
+{
+	if (signer && g_atomic_int_dec_and_test(&signer->refs)) {
+		userpref_root_signer_free(signer);
+	}
+}
+
+/**
+ * Reads a previously signed device certificate.
+ *
+ * @param fingerprint Identifies the device public key and root certificate
+ *        the certificate was signed for.
+ * @param pem_device_cert Holds the PEM encoded certificate on success. The
+ *        data has to be freed with g_free().
+ *
+ * @return USERPREF_E_SUCCESS on success, USERPREF_E_INVALID_CONF if no
+ *         certificate is stored for the fingerprint.
+ */
+userpref_error_t userpref_get_device_certificate(const char *fingerprint, gnutls_datum_t *pem_device_cert)
+{
+	userpref_error_t ret = USERPREF_E_INVALID_CONF;
+
+	if (!fingerprint || !pem_device_cert)
+		return USERPREF_E_INVALID_ARG;
+
+	gchar *device_file = g_strconcat(LIBIMOBILEDEVICE_DEVICE_CERTS_DIR, G_DIR_SEPARATOR_S, fingerprint, ".pem", NULL);
+	if (userpref_get_file_contents(device_file, pem_device_cert))
+		ret = USERPREF_E_SUCCESS;
+	g_free(device_file);
+
+	return ret;
+}
+
+/**
+ * Stores a signed device certificate so pairing the same device again can
+ * reuse it.
+ *
+ * @param fingerprint Identifies the device public key and root certificate
+ *        the certificate was signed for.
+ * @param pem_device_cert The PEM encoded device certificate.
+ *
+ * @return USERPREF_E_SUCCESS on success, USERPREF_E_UNKNOWN_ERROR if the
+ *         certificate could not be written.
+ */
+userpref_error_t userpref_set_device_certificate(const char *fingerprint, gnutls_datum_t pem_device_cert)
+{
+	userpref_error_t ret = USERPREF_E_SUCCESS;
+
+	if (!fingerprint || !pem_device_cert.data)
+		return USERPREF_E_INVALID_ARG;
+
+	gchar *certs_dir = g_build_path(G_DIR_SEPARATOR_S, g_get_user_config_dir(), LIBIMOBILEDEVICE_CONF_DIR, LIBIMOBILEDEVICE_DEVICE_CERTS_DIR, NULL);
+	if (!g_file_test(certs_dir, (G_FILE_TEST_EXISTS | G_FILE_TEST_IS_DIR)))
+		g_mkdir_with_parents(certs_dir, 0755);
+
+	gchar *device_file = g_strconcat(LIBIMOBILEDEVICE_DEVICE_CERTS_DIR, G_DIR_SEPARATOR_S, fingerprint, ".pem", NULL);
+	gchar *pem = g_build_path(G_DIR_SEPARATOR_S, g_get_user_config_dir(), LIBIMOBILEDEVICE_CONF_DIR, device_file, NULL);
+
+	if (!g_file_set_contents(pem, (const gchar*)pem_device_cert.data, pem_device_cert.size, NULL)) {
+		debug_info("could not write device certificate %s", pem);
+		ret = USERPREF_E_UNKNOWN_ERROR;
+	}
+	userpref_cache_invalidate(device_file);
+
+	g_free(pem);
+	g_free(device_file);
+	g_free(certs_dir);
+
+	return ret;
+}
+
+/**
+ * Reads the persisted lockdown value cache of a device.
+ *
+ * @param uuid The uuid of the device
+ * @param data Holds the cache contents on success. The data has to be
+ *        freed with g_free().
+ *
+ * @return USERPREF_E_SUCCESS on success, USERPREF_E_INVALID_CONF if there is
+ *         no cache for the device.
+ */
+userpref_error_t userpref_get_value_cache(const char *uuid, gnutls_datum_t *data)
+{
+	userpref_error_t ret = USERPREF_E_INVALID_CONF;
+
+	if (!uuid || !data)
+		return USERPREF_E_INVALID_ARG;
+
+	gchar *cache_file = g_strconcat(LIBIMOBILEDEVICE_VALUE_CACHE_DIR, G_DIR_SEPARATOR_S, uuid, ".plist", NULL);
+	if (userpref_get_file_contents(cache_file, data))
+		ret = USERPREF_E_SUCCESS;
+	g_free(cache_file);
+
+	return ret;
+}
+
+/**
+ * Persists the lockdown value cache of a device.
+ *
+ * @param uuid The uuid of the device
+ * @param data The cache contents.
+ *
+ * @return USERPREF_E_SUCCESS on success, USERPREF_E_UNKNOWN_ERROR if the
+ *         cache could not be written.
+ */
+userpref_error_t userpref_set_value_cache(const char *uuid, gnutls_datum_t data)
+{
+	userpref_error_t ret = USERPREF_E_SUCCESS;
+
+	if (!uuid || !data.data)
+		return USERPREF_E_INVALID_ARG;
+
+	gchar *cache_dir = g_build_path(G_DIR_SEPARATOR_S, g_get_user_config_dir(), LIBIMOBILEDEVICE_CONF_DIR, LIBIMOBILEDEVICE_VALUE_CACHE_DIR, NULL);
+	if (!g_file_test(cache_dir, (G_FILE_TEST_EXISTS | G_FILE_TEST_IS_DIR)))
+		g_mkdir_with_parents(cache_dir, 0755);
+
+	gchar *cache_file = g_strconcat(LIBIMOBILEDEVICE_VALUE_CACHE_DIR, G_DIR_SEPARATOR_S, uuid, ".plist", NULL);
+	gchar *path = g_build_path(G_DIR_SEPARATOR_S, g_get_user_config_dir(), LIBIMOBILEDEVICE_CONF_DIR, cache_file, NULL);
+
+	/* write atomically, other processes might read the cache concurrently */
+	if (!g_file_set_contents(path, (const gchar*)data.data, data.size, NULL)) {
+		debug_info("could not write value cache %s", path);
+		ret = USERPREF_E_UNKNOWN_ERROR;
+	}
+	userpref_cache_invalidate(cache_file);
+
+	g_free(path);
+	g_free(cache_file);
+	g_free(cache_dir);
+
+	return ret;
+}
+
+/**
+ * Reads the persisted application inventory snapshot of a device.
+ *
+ * @param uuid The uuid of the device
+ * @param data Holds the snapshot on success. The data has to be freed with
+ *        g_free().
+ *
+ * @return USERPREF_E_SUCCESS on success, USERPREF_E_INVALID_CONF if there is
+ *         no snapshot for the device.
+ */
+userpref_error_t userpref_get_app_inventory(const char *uuid, gnutls_datum_t *data)
+{
+	userpref_error_t ret = USERPREF_E_INVALID_CONF;
+
+	if (!uuid || !data)
+		return USERPREF_E_INVALID_ARG;
+
+	gchar *inventory_file = g_strconcat(LIBIMOBILEDEVICE_APP_INVENTORY_DIR, G_DIR_SEPARATOR_S, uuid, ".plist", NULL);
+	if (userpref_get_file_contents(inventory_file, data))
+		ret = USERPREF_E_SUCCESS;
+	g_free(inventory_file);
+
+	return ret;
+}
+
+/**
+ * Persists the application inventory snapshot of a device.
+ *
+ * @param uuid The uuid of the device
+ * @param data The snapshot contents.
+ *
+ * @return USERPREF_E_SUCCESS on success, USERPREF_E_UNKNOWN_ERROR if the
+ *         snapshot could not be written.
+ */
+userpref_error_t userpref_set_app_inventory(const char *uuid, gnutls_datum_t data)
+{
+	userpref_error_t ret = USERPREF_E_SUCCESS;
+
+	if (!uuid || !data.data)
+		return USERPREF_E_INVALID_ARG;
+
+	gchar *inventory_dir = g_build_path(G_DIR_SEPARATOR_S, g_get_user_config_dir(), LIBIMOBILEDEVICE_CONF_DIR, LIBIMOBILEDEVICE_APP_INVENTORY_DIR, NULL);
+	if (!g_file_test(inventory_dir, (G_FILE_TEST_EXISTS | G_FILE_TEST_IS_DIR)))
+		g_mkdir_with_parents(inventory_dir, 0755);
+
+	gchar *inventory_file = g_strconcat(LIBIMOBILEDEVICE_APP_INVENTORY_DIR, G_DIR_SEPARATOR_S, uuid, ".plist", NULL);
+	gchar *path = g_build_path(G_DIR_SEPARATOR_S, g_get_user_config_dir(), LIBIMOBILEDEVICE_CONF_DIR, inventory_file, NULL);
+
+	if (!g_file_set_contents(path, (const gchar*)data.data, data.size, NULL)) {
+		debug_info("could not write app inventory %s", path);
+		ret = USERPREF_E_UNKNOWN_ERROR;
+	}
+	userpref_cache_invalidate(inventory_file);
+
+	g_free(path);
+	g_free(inventory_file);
+	g_free(inventory_dir);
+
+	return ret;
+}
+
+/**
+ * Internally used function that returns the path of a cached icon. Icons are
+ * stored in the user cache directory under the SHA1 of bundle identifier and
+ * version, so a new version of an app never hits an outdated icon.
+ *
+ * @param bundle_id The bundle identifier of the app
+ * @param version The version of the app
+ *
+ * @return The path, to be freed with g_free(), or NULL on error.
+ */
+static gchar *userpref_icon_cache_path(const char *bundle_id, const char *version)
+{
+	unsigned char digest[20];
+	size_t digest_size = sizeof(digest);
+	gchar hex[41];
+	size_t i;
+
+	gchar *key = g_strconcat(bundle_id, "\n", version, NULL);
+	gnutls_datum_t datum = { (unsigned char*)key, strlen(key) };
+	int res = gnutls_fingerprint(GNUTLS_DIG_SHA1, &datum, digest, &digest_size);
+	g_free(key);
+	if (res != GNUTLS_E_SUCCESS)
+		return NULL;
+
+	for (i = 0; i < digest_size; i++) {
+		g_snprintf(hex + i * 2, 3, "%02x", digest[i]);
+	}
+	hex[digest_size * 2] = '\0';
+
+	return g_strconcat(g_get_user_cache_dir(), G_DIR_SEPARATOR_S, LIBIMOBILEDEVICE_CONF_DIR, G_DIR_SEPARATOR_S, LIBIMOBILEDEVICE_ICON_CACHE_DIR, G_DIR_SEPARATOR_S, hex, ".png", NULL);
+}
+
+/**
+ * Reads a cached app icon.
+ *
+ * @param bundle_id The bundle identifier of the app
+ * @param version The version of the app
+ * @param pngdata Set to a newly allocated buffer holding the PNG data on
+ *        success. It has to be freed with free().
+ * @param pngsize Set to the size of the PNG data.
+ *
+ * @return USERPREF_E_SUCCESS on success, USERPREF_E_INVALID_CONF if the icon
+ *         is not cached.
+ */
+userpref_error_t userpref_get_cached_icon(const char *bundle_id, const char *version, char **pngdata, uint64_t *pngsize)
+{
+	userpref_error_t ret = USERPREF_E_INVALID_CONF;
+	struct stat st;
+	FILE *f;
+
+	if (!bundle_id || !version || !pngdata || !pngsize)
+		return USERPREF_E_INVALID_ARG;
+
+	gchar *path = userpref_icon_cache_path(bundle_id, version);
+	if (!path)
+		return USERPREF_E_SSL_ERROR;
+
+	f = fopen(path, "rb");
+	if (f) {
+		if ((fstat(fileno(f), &st) == 0) && (st.st_size > 0)) {
+			char *data = (char*)malloc(st.st_size);
+			if (data && (fread(data, 1, st.st_size, f) == (size_t)st.st_size)) {
+				*pngdata = data;
+				*pngsize = st.st_size;
+				ret = USERPREF_E_SUCCESS;
+			} else {
+				free(data);
+			}
+		}
+		fclose(f);
+	}
+	g_free(path);
+
+	return ret;
+}
+
+/**
+ * Stores an app icon in the icon cache.
+ *
+ * @param bundle_id The bundle identifier of the app
+ * @param version The version of the app
+ * @param pngdata The PNG data
+ * @param pngsize The size of the PNG data
+ *
+ * @return USERPREF_E_SUCCESS on success, USERPREF_E_UNKNOWN_ERROR if the
+ *         icon could not be written.
+ */
+userpref_error_t userpref_set_cached_icon(const char *bundle_id, const char *version, const char *pngdata, uint64_t pngsize)
+{
+	userpref_error_t ret = USERPREF_E_SUCCESS;
+
+	if (!bundle_id || !version || !pngdata)
+		return USERPREF_E_INVALID_ARG;
+
+	gchar *cache_dir = g_build_path(G_DIR_SEPARATOR_S, g_get_user_cache_dir(), LIBIMOBILEDEVICE_CONF_DIR, LIBIMOBILEDEVICE_ICON_CACHE_DIR, NULL);
+	if (!g_file_test(cache_dir, (G_FILE_TEST_EXISTS | G_FILE_TEST_IS_DIR)))
+		g_mkdir_with_parents(cache_dir, 0755);
+	g_free(cache_dir);
+
+	gchar *path = userpref_icon_cache_path(bundle_id, version);
+	if (!path)
+		return USERPREF_E_SSL_ERROR;
+
+	/* write atomically, other processes might read the icon concurrently */
+	if (!g_file_set_contents(path, pngdata, pngsize, NULL)) {
+		debug_info("could not write icon %s", path);
+		ret = USERPREF_E_UNKNOWN_ERROR;
+	}
+	g_free(path);
+
+	return ret;
+}
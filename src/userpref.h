@@ -23,7 +23,10 @@
 #define USERPREF_H
 
 #include <gnutls/gnutls.h>
+#include <gnutls/x509.h>
 #include <glib.h>
+#include <time.h>
+#include <stdint.h>
 
 #define USERPREF_E_SUCCESS             0
 #define USERPREF_E_INVALID_ARG        -1
@@ -34,12 +37,37 @@
 
 typedef int16_t userpref_error_t;
 
+/** Root key and certificates used to sign device certificates. */
+struct userpref_root_signer {
+	gint refs;
+	gnutls_x509_privkey_t root_privkey;
+	gnutls_x509_crt_t root_crt;
+	gnutls_datum_t pem_root_cert;
+	gnutls_datum_t pem_host_cert;
+	gchar *fingerprint; /* hex SHA1 of the PEM root certificate */
+};
+typedef struct userpref_root_signer *userpref_root_signer_t;
+
 G_GNUC_INTERNAL userpref_error_t userpref_get_keys_and_certs(gnutls_x509_privkey_t root_privkey, gnutls_x509_crt_t root_crt, gnutls_x509_privkey_t host_privkey, gnutls_x509_crt_t host_crt);
 G_GNUC_INTERNAL userpref_error_t userpref_set_keys_and_certs(gnutls_datum_t * root_key, gnutls_datum_t * root_cert, gnutls_datum_t * host_key, gnutls_datum_t * host_cert);
+G_GNUC_INTERNAL userpref_error_t userpref_start_key_generation(void);
+G_GNUC_INTERNAL userpref_error_t userpref_wait_key_generation(void);
 G_GNUC_INTERNAL userpref_error_t userpref_get_certs_as_pem(gnutls_datum_t *pem_root_cert, gnutls_datum_t *pem_host_cert);
+G_GNUC_INTERNAL userpref_error_t userpref_root_signer_get(userpref_root_signer_t *signer);
+G_GNUC_INTERNAL void userpref_root_signer_release(userpref_root_signer_t signer);
+G_GNUC_INTERNAL userpref_error_t userpref_get_device_certificate(const char *fingerprint, gnutls_datum_t *pem_device_cert);
+G_GNUC_INTERNAL userpref_error_t userpref_set_device_certificate(const char *fingerprint, gnutls_datum_t pem_device_cert);
+G_GNUC_INTERNAL userpref_error_t userpref_get_value_cache(const char *uuid, gnutls_datum_t *data);
+G_GNUC_INTERNAL userpref_error_t userpref_set_value_cache(const char *uuid, gnutls_datum_t data);
+G_GNUC_INTERNAL userpref_error_t userpref_get_app_inventory(const char *uuid, gnutls_datum_t *data);
+G_GNUC_INTERNAL userpref_error_t userpref_set_app_inventory(const char *uuid, gnutls_datum_t data);
+G_GNUC_INTERNAL userpref_error_t userpref_get_cached_icon(const char *bundle_id, const char *version, char **pngdata, uint64_t *pngsize);
+G_GNUC_INTERNAL userpref_error_t userpref_set_cached_icon(const char *bundle_id, const char *version, const char *pngdata, uint64_t pngsize);
 G_GNUC_INTERNAL userpref_error_t userpref_set_device_public_key(const char *uuid, gnutls_datum_t public_key);
 G_GNUC_INTERNAL userpref_error_t userpref_remove_device_public_key(const char *uuid);
 G_GNUC_INTERNAL int userpref_has_device_public_key(const char *uuid);
 G_GNUC_INTERNAL void userpref_get_host_id(char **host_id);
+G_GNUC_INTERNAL time_t userpref_get_validated_handshake(const char *uuid, const char *host_id);
+G_GNUC_INTERNAL userpref_error_t userpref_set_validated_handshake(const char *uuid, const char *host_id, time_t validated);
 
 #endif
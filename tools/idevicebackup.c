@@ -69,6 +69,22 @@ static void notify_cb(const char *notification, void *userdata)
 	}
 }
 
+/* adapters for lockdownd_start_service_clients */
+static int16_t np_new_adapter(idevice_t device, uint16_t port, void *service_client)
+{
+	return np_client_new(device, port, (np_client_t*)service_client);
+}
+
+static int16_t afc_new_adapter(idevice_t device, uint16_t port, void *service_client)
+{
+	return afc_client_new(device, port, (afc_client_t*)service_client);
+}
+
+static int16_t mobilebackup_new_adapter(idevice_t device, uint16_t port, void *service_client)
+{
+	return mobilebackup_client_new(device, port, (mobilebackup_client_t*)service_client);
+}
+
 static plist_t mobilebackup_factory_info_plist_new()
 {
 	/* gather data from lockdown */
@@ -518,11 +534,20 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
-	/* start notification_proxy */
-	np_client_t np = NULL;
-	ret = lockdownd_start_service(client, NP_SERVICE_NAME, &port);
-	if ((ret == LOCKDOWN_E_SUCCESS) && port) {
-		np_client_new(phone, port, &np);
+	/* start notification_proxy, AFC (we need this for the lock file) and
+	 * mobilebackup in one go and connect to them concurrently */
+	struct lockdownd_service services[3];
+	memset(services, 0, sizeof(services));
+	services[0].name = NP_SERVICE_NAME;
+	services[0].client_new = np_new_adapter;
+	services[1].name = "com.apple.afc";
+	services[1].client_new = afc_new_adapter;
+	services[2].name = MOBILEBACKUP_SERVICE_NAME;
+	services[2].client_new = mobilebackup_new_adapter;
+	lockdownd_start_service_clients(client, phone, services, 3);
+
+	np_client_t np = (np_client_t)services[0].client;
+	if (np) {
 		np_set_notify_callback(np, notify_cb, NULL);
 		const char *noties[5] = {
 			NP_SYNC_CANCEL_REQUEST,
@@ -536,20 +561,12 @@ int main(int argc, char *argv[])
 		printf("ERROR: Could not start service %s.\n", NP_SERVICE_NAME);
 	}
 
-	/* start AFC, we need this for the lock file */
-	afc_client_t afc = NULL;
-	port = 0;
-	ret = lockdownd_start_service(client, "com.apple.afc", &port);
-	if ((ret == LOCKDOWN_E_SUCCESS) && port) {
-		afc_client_new(phone, port, &afc);
-	}
+	afc_client_t afc = (afc_client_t)services[1].client;
 
-	/* start syslog_relay service and retrieve port */
-	port = 0;
-	ret = lockdownd_start_service(client, MOBILEBACKUP_SERVICE_NAME, &port);
-	if ((ret == LOCKDOWN_E_SUCCESS) && port) {
+	port = services[2].port;
+	if ((services[2].error == LOCKDOWN_E_SUCCESS) && port) {
 		printf("Started \"%s\" service on port %d.\n", MOBILEBACKUP_SERVICE_NAME, port);
-		mobilebackup_client_new(phone, port, &mobilebackup);
+		mobilebackup = (mobilebackup_client_t)services[2].client;
 
 		/* check abort conditions */
 		if (quit_flag > 0) {
@@ -0,0 +1,366 @@
+/**
+ * idevicefleetinstall -- Installs an application on many devices at once
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more profile.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <glib.h>
+
+#include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/lockdown.h>
+#include <libimobiledevice/afc.h>
+#include <libimobiledevice/installation_proxy.h>
+
+#define PKG_PATH "PublicStaging"
+#define DEFAULT_UPLOADS 4
+#define UPLOAD_CHUNK_SIZE 65536
+
+struct install_job {
+	char *uuid;
+	GThread *thread;
+	const char *stage;
+	double handshake_time;
+	double upload_time;
+	double install_time;
+	int ok;
+};
+
+static gchar *pkg_data = NULL;
+static gsize pkg_size = 0;
+static char *pkg_target = NULL;
+
+/* upload slots, limits how many devices receive the package at once */
+static GMutex *upload_mutex = NULL;
+static GCond *upload_cond = NULL;
+static int uploads_free = DEFAULT_UPLOADS;
+
+static GMutex *print_mutex = NULL;
+
+void print_usage(int argc, char **argv);
+
+static double elapsed_sec(struct timeval *start)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+static void job_report(struct install_job *job, const char *msg)
+{
+	g_mutex_lock(print_mutex);
+	printf("%s: %s\n", job->uuid, msg);
+	fflush(stdout);
+	g_mutex_unlock(print_mutex);
+}
+
+static void upload_slot_acquire()
+{
+	g_mutex_lock(upload_mutex);
+	while (uploads_free == 0) {
+		g_cond_wait(upload_cond, upload_mutex);
+	}
+	uploads_free--;
+	g_mutex_unlock(upload_mutex);
+}
+
+static void upload_slot_release()
+{
+	g_mutex_lock(upload_mutex);
+	uploads_free++;
+	g_cond_signal(upload_cond);
+	g_mutex_unlock(upload_mutex);
+}
+
+/* adapters for lockdownd_start_service_clients */
+static int16_t afc_new_adapter(idevice_t device, uint16_t port, void *service_client)
+{
+	return afc_client_new(device, port, (afc_client_t*)service_client);
+}
+
+static int16_t instproxy_new_adapter(idevice_t device, uint16_t port, void *service_client)
+{
+	return instproxy_client_new(device, port, (instproxy_client_t*)service_client);
+}
+
+static int upload_package(afc_client_t afc)
+{
+	uint64_t af = 0;
+	gsize offset = 0;
+	char **strs = NULL;
+
+	if (afc_get_file_info(afc, PKG_PATH, &strs) != AFC_E_SUCCESS) {
+		afc_make_directory(afc, PKG_PATH);
+	}
+	if (strs) {
+		int i = 0;
+		while (strs[i]) {
+			free(strs[i]);
+			i++;
+		}
+		free(strs);
+	}
+
+	if ((afc_file_open(afc, pkg_target, AFC_FOPEN_WRONLY, &af) != AFC_E_SUCCESS) || !af) {
+		return -1;
+	}
+
+	while (offset < pkg_size) {
+		uint32_t amount = (pkg_size - offset > UPLOAD_CHUNK_SIZE) ? UPLOAD_CHUNK_SIZE : (uint32_t)(pkg_size - offset);
+		uint32_t written = 0;
+		if ((afc_file_write(afc, af, pkg_data + offset, amount, &written) != AFC_E_SUCCESS) || (written == 0)) {
+			afc_file_close(afc, af);
+			return -1;
+		}
+		offset += written;
+	}
+
+	afc_file_close(afc, af);
+	return 0;
+}
+
+static gpointer install_worker(gpointer data)
+{
+	struct install_job *job = (struct install_job*)data;
+	idevice_t device = NULL;
+	lockdownd_client_t client = NULL;
+	struct lockdownd_service services[2];
+	afc_client_t afc = NULL;
+	instproxy_client_t ipc = NULL;
+	struct timeval start;
+	instproxy_error_t err;
+
+	/* handshake and start both services while the session is open */
+	job->stage = "handshake";
+	gettimeofday(&start, NULL);
+	if (idevice_new(&device, job->uuid) != IDEVICE_E_SUCCESS) {
+		job_report(job, "ERROR: No device found");
+		goto leave;
+	}
+	if (lockdownd_client_new_with_handshake(device, &client, "idevicefleetinstall") != LOCKDOWN_E_SUCCESS) {
+		job_report(job, "ERROR: Could not connect to lockdownd");
+		goto leave;
+	}
+
+	memset(services, 0, sizeof(services));
+	services[0].name = "com.apple.afc";
+	services[0].client_new = afc_new_adapter;
+	services[1].name = "com.apple.mobile.installation_proxy";
+	services[1].client_new = instproxy_new_adapter;
+	lockdownd_start_service_clients(client, device, services, 2);
+	afc = (afc_client_t)services[0].client;
+	ipc = (instproxy_client_t)services[1].client;
+	lockdownd_client_free(client);
+	client = NULL;
+	job->handshake_time = elapsed_sec(&start);
+	if (!afc || !ipc) {
+		job_report(job, "ERROR: Could not start the afc and installation_proxy services");
+		goto leave;
+	}
+
+	/* upload, bounded by the available upload slots */
+	job->stage = "upload";
+	upload_slot_acquire();
+	gettimeofday(&start, NULL);
+	if (upload_package(afc) < 0) {
+		upload_slot_release();
+		job_report(job, "ERROR: Could not upload the package");
+		goto leave;
+	}
+	job->upload_time = elapsed_sec(&start);
+	upload_slot_release();
+	afc_client_free(afc);
+	afc = NULL;
+	job_report(job, "uploaded, installing");
+
+	/* install right away, other devices may still be uploading */
+	job->stage = "install";
+	gettimeofday(&start, NULL);
+	err = instproxy_install(ipc, pkg_target, NULL, NULL, NULL);
+	job->install_time = elapsed_sec(&start);
+	if (err != INSTPROXY_E_SUCCESS) {
+		char msg[64];
+		snprintf(msg, sizeof(msg), "ERROR: Install failed (%d)", err);
+		job_report(job, msg);
+		goto leave;
+	}
+
+	job->stage = "done";
+	job->ok = 1;
+	job_report(job, "installed");
+
+leave:
+	if (afc)
+		afc_client_free(afc);
+	if (ipc)
+		instproxy_client_free(ipc);
+	if (client)
+		lockdownd_client_free(client);
+	if (device)
+		idevice_free(device);
+
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	char **uuids = NULL;
+	int count = 0;
+	char **dev_list = NULL;
+	char *pkg_path = NULL;
+	struct install_job *jobs = NULL;
+	struct timeval start;
+	GError *error = NULL;
+	int failed = 0;
+	int i;
+
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+
+	uuids = (char**)malloc(sizeof(char*) * argc);
+
+	/* parse cmdline args */
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--debug")) {
+			idevice_set_debug_level(1);
+			continue;
+		}
+		else if (!strcmp(argv[i], "-u") || !strcmp(argv[i], "--uuid")) {
+			i++;
+			if (!argv[i] || (strlen(argv[i]) != 40)) {
+				print_usage(argc, argv);
+				return 0;
+			}
+			uuids[count++] = argv[i];
+			continue;
+		}
+		else if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--uploads")) {
+			i++;
+			if (!argv[i] || (atoi(argv[i]) <= 0)) {
+				print_usage(argc, argv);
+				return 0;
+			}
+			uploads_free = atoi(argv[i]);
+			continue;
+		}
+		else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+			print_usage(argc, argv);
+			return 0;
+		}
+		else if (argv[i][0] != '-' && !pkg_path) {
+			pkg_path = argv[i];
+			continue;
+		}
+		else {
+			print_usage(argc, argv);
+			return 0;
+		}
+	}
+
+	if (!pkg_path) {
+		print_usage(argc, argv);
+		return 0;
+	}
+
+	/* read the package once, every device gets the same buffer */
+	if (!g_file_get_contents(pkg_path, &pkg_data, &pkg_size, &error)) {
+		printf("ERROR: Could not read '%s': %s\n", pkg_path, error->message);
+		g_error_free(error);
+		return -1;
+	}
+	gchar *basename = g_path_get_basename(pkg_path);
+	pkg_target = g_strdup_printf("%s/%s", PKG_PATH, basename);
+	g_free(basename);
+
+	if (count == 0) {
+		if (idevice_get_device_list(&dev_list, &count) < 0 || count == 0) {
+			printf("ERROR: No device found, is it plugged in?\n");
+			return -1;
+		}
+		free(uuids);
+		uuids = dev_list;
+	}
+
+	/* keep the first handshakes from waiting on key generation one by one */
+	lockdownd_prepare_host_keys(1);
+
+	upload_mutex = g_mutex_new();
+	upload_cond = g_cond_new();
+	print_mutex = g_mutex_new();
+
+	printf("Installing '%s' (%u bytes) on %d device(s), %d upload(s) at a time\n", pkg_path, (unsigned int)pkg_size, count, uploads_free);
+
+	gettimeofday(&start, NULL);
+	jobs = (struct install_job*)malloc(sizeof(struct install_job) * count);
+	memset(jobs, 0, sizeof(struct install_job) * count);
+	for (i = 0; i < count; i++) {
+		jobs[i].uuid = uuids[i];
+		jobs[i].stage = "queued";
+		jobs[i].thread = g_thread_create(install_worker, &jobs[i], TRUE, NULL);
+		if (!jobs[i].thread) {
+			job_report(&jobs[i], "ERROR: Could not create thread");
+		}
+	}
+	for (i = 0; i < count; i++) {
+		if (jobs[i].thread)
+			g_thread_join(jobs[i].thread);
+	}
+
+	printf("\n%-40s %9s %9s %9s %9s  %s\n", "device", "handshake", "upload", "install", "total", "result");
+	for (i = 0; i < count; i++) {
+		struct install_job *job = &jobs[i];
+		printf("%-40s %8.2fs %8.2fs %8.2fs %8.2fs  %s%s\n", job->uuid, job->handshake_time, job->upload_time, job->install_time,
+			job->handshake_time + job->upload_time + job->install_time, job->ok ? "OK" : "FAILED in ", job->ok ? "" : job->stage);
+		if (!job->ok)
+			failed++;
+	}
+	printf("\n%d of %d device(s) installed in %.2fs\n", count - failed, count, elapsed_sec(&start));
+
+	free(jobs);
+	if (dev_list)
+		idevice_device_list_free(dev_list);
+	else
+		free(uuids);
+	g_free(pkg_target);
+	g_free(pkg_data);
+	g_mutex_free(upload_mutex);
+	g_cond_free(upload_cond);
+	g_mutex_free(print_mutex);
+
+	return (failed > 0) ? -1 : 0;
+}
+
+void print_usage(int argc, char **argv)
+{
+	char *name = NULL;
+
+	name = strrchr(argv[0], '/');
+	printf("Usage: %s [OPTIONS] FILE\n", (name ? name + 1: argv[0]));
+	printf("Installs the application package FILE on all connected devices, or the\n");
+	printf("ones given with -u, and prints how long each step took per device.\n");
+	printf("Uploads run in parallel up to the given limit, each device starts\n");
+	printf("installing as soon as its upload finished.\n\n");
+	printf("  -u, --uuid UUID\tinstall on the device with UUID, may be repeated\n");
+	printf("  -j, --uploads N\tupload to at most N devices at once (default %d)\n", DEFAULT_UPLOADS);
+	printf("  -d, --debug\t\tenable communication debugging\n");
+	printf("  -h, --help\t\tprints usage information\n");
+	printf("\n");
+}
@@ -0,0 +1,76 @@
+/**
+ * idevicekeygen -- Pre-generates the host keys and certificates used for pairing
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more profile.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 
+ * USA
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/lockdown.h>
+
+void print_usage(int argc, char **argv);
+
+int main(int argc, char **argv)
+{
+	lockdownd_error_t ldret;
+	time_t start;
+	int i;
+
+	/* parse cmdline args */
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--debug")) {
+			idevice_set_debug_level(1);
+			continue;
+		}
+		else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+			print_usage(argc, argv);
+			return 0;
+		}
+		else {
+			print_usage(argc, argv);
+			return 0;
+		}
+	}
+
+	start = time(NULL);
+	ldret = lockdownd_prepare_host_keys(1);
+	if (ldret != LOCKDOWN_E_SUCCESS) {
+		printf("ERROR: Could not generate host keys and certificates (%d)\n", ldret);
+		return -1;
+	}
+	printf("Host keys and certificates are ready (%d seconds).\n", (int)(time(NULL) - start));
+
+	return 0;
+}
+
+void print_usage(int argc, char **argv)
+{
+	char *name = NULL;
+
+	name = strrchr(argv[0], '/');
+	printf("Usage: %s [OPTIONS]\n", (name ? name + 1: argv[0]));
+	printf("Generates the host keys and certificates used for pairing unless\n");
+	printf("usable ones already exist, so the first pairing does not have to wait.\n\n");
+	printf("  -d, --debug\t\tenable communication debugging\n");
+	printf("  -h, --help\t\tprints usage information\n");
+	printf("\n");
+}